@@ -0,0 +1,639 @@
+/*
+    Microbenchmarks for the inner kernels of the dictionaries, timed in
+    isolation on synthetic inputs:
+
+        getBit, bit_compare, createStem, editDistance   key length sweep
+        parseLine, checkLine                            line length sweep
+        ptDictInsert, ptDictLookup (exact, fuzzy),
+        ptDictFindSpan (miss), both also without
+        comparison counts (-plain), printQueryResult,
+        eyDictNew, eyDictLookup (exact, fuzzy),
+        eyDictFindSpan (miss)                           dict size sweep
+
+    The dict size sweep also prints the index bytes per row of the
+    Patricia tree and of the Eytzinger dictionary over the same rows.
+
+    Every case is calibrated during warmup so that one repetition takes
+    about BENCH_REP_NS, then timed `reps` times. Reported per case: mean,
+    standard deviation and minimum ns/op over the repetitions.
+
+    Usage: ./microbench [--warmup N] [--reps N] [--lengths L,L,...]
+                        [--lines L,L,...] [--keys N,N,...] [--only KERNEL]
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+
+#include "bit.h"
+#include "edit_distance.h"
+#include "record.h"
+#include "read.h"
+#include "dict_common.h"
+#include "patricia_tree_dict.h"
+#include "eytzinger_dict.h"
+#include "mem_account.h"
+
+#define DEFAULT_WARMUP 3
+#define DEFAULT_REPS 15
+#define MAX_SWEEP 8
+#define BENCH_REP_NS 2e6           // calibrated length of one repetition
+#define INPUT_VARIANTS 256         // distinct inputs cycled through per case
+#define MAX_LINE_LEN 511           // read.c's MAX_RECORD_LEN - 1
+#define KEY_FIELD 1                // EZI_ADD
+
+/* Kernels private to read.c, declared here for timing only; rows are
+   parsed without an interning pool or row filter */
+struct internColumns;
+struct rowKeep;
+struct csvRecord *parseLine(char *line, struct internColumns *columns,
+                            struct rowKeep *keep);
+void checkLine(char **line, FILE *csvFile, char **line2);
+
+/* Inputs of one case; a kernel uses the parts it needs */
+struct benchCase {
+    int size;                      // key length, line length or dict size
+    char *keys[INPUT_VARIANTS];    // strings of `size` bytes / CSV lines
+    char *others[INPUT_VARIANTS];  // a near miss of each key
+    struct csvRecord **records;    // dict sweep: `size` rows
+    char **queries;                // dict sweep: `size` lookups
+    struct ptDict *dict;           // dict sweep: built from records
+    struct data **rows;            // dict sweep: records as struct data
+    char **rowKeys;                // dict sweep: the key of each row
+    struct eyDict *eytzinger;      // dict sweep: built from rows
+    struct queryResult *results[INPUT_VARIANTS];
+    char *line;                    // scratch line buffers
+    char *line2;
+    FILE *sink;                    // /dev/null
+};
+
+/* Run `iterations` rounds of a kernel, adding the time spent in the
+   kernel itself to *ns; returns the number of operations done */
+typedef long (*kernelFn)(struct benchCase *c, long iterations, double *ns);
+
+enum sweep { SWEEP_LENGTHS, SWEEP_LINES, SWEEP_KEYS };
+
+struct kernel {
+    const char *name;
+    enum sweep sweep;
+    kernelFn run;
+};
+
+/* Helpers */
+static double nowNs(void);
+static unsigned int benchRand(unsigned long *state);
+static void randomKey(unsigned long *state, char *out, int len);
+static char *nearMiss(unsigned long *state, const char *key);
+static char *lateTypo(unsigned long *state, const char *key);
+static char *csvLine(unsigned long *state, int len);
+static struct csvRecord *syntheticRecord(unsigned long *state, int row);
+static void freeRecord(struct csvRecord *rec);
+static void setupCase(struct benchCase *c, enum sweep sweep, int size);
+static void teardownCase(struct benchCase *c, enum sweep sweep);
+static long indexBytes(void);
+static int parseSizes(const char *list, int *sizes);
+static void runCase(const struct kernel *k, struct benchCase *c, int warmup,
+                    int reps);
+
+static volatile long sink;         // keeps results alive
+
+static const char *STREETS[] = {"GRATTAN", "SWANSTON", "ELIZABETH", "LYGON",
+                                "BOUVERIE", "QUEENSBERRY", "LEICESTER",
+                                "FLEMINGTON", "ROYAL", "BERKELEY"};
+static const char *TYPES[] = {"STREET", "ROAD", "PLACE", "LANE", "PARADE"};
+static const char *LOCALITIES[] = {"CARLTON", "PARKVILLE", "MELBOURNE",
+                                   "NORTH MELBOURNE", "FITZROY"};
+#define COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+/* helper: monotonic clock in ns */
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* helper: 31-bit LCG, so inputs are the same on every run */
+static unsigned int benchRand(unsigned long *state) {
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return (unsigned int)(*state >> 33);
+}
+
+/* helper: len random upper case letters, digits and spaces */
+static void randomKey(unsigned long *state, char *out, int len) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+    for (int i = 0; i < len; i++) {
+        out[i] = alphabet[benchRand(state) % (sizeof(alphabet) - 1)];
+    }
+    out[len] = '\0';
+}
+
+/* helper: key with about one edit in eight characters (at least one),
+   a fresh string */
+static char *nearMiss(unsigned long *state, const char *key) {
+    char *copy = strdup(key);
+    assert(copy);
+    int len = strlen(copy);
+    int edits = len / 8 > 0 ? len / 8 : 1;
+    for (int e = 0; e < edits && len > 0; e++) {
+        copy[benchRand(state) % len] = 'a' + benchRand(state) % 26;
+    }
+    return copy;
+}
+
+/* helper: key with one character of its second half changed (a typo
+   the fuzzy fallback resolves low in the tree), a fresh string */
+static char *lateTypo(unsigned long *state, const char *key) {
+    char *copy = strdup(key);
+    assert(copy);
+    int len = strlen(copy);
+    copy[len / 2 + benchRand(state) % (len - len / 2)] = '#';
+    return copy;
+}
+
+/* helper: a CSV row of NUM_FIELDS fields and about len characters; every
+   fourth field is quoted and holds a comma */
+static char *csvLine(unsigned long *state, int len) {
+    char *line = malloc(MAX_LINE_LEN + 1);
+    assert(line);
+    int fieldLen = (len - NUM_FIELDS) / NUM_FIELDS;
+    if (fieldLen < 3) fieldLen = 3;
+    int pos = 0;
+    for (int f = 0; f < NUM_FIELDS; f++) {
+        char field[MAX_LINE_LEN + 1];
+        randomKey(state, field, fieldLen);
+        if (f % 4 == 3) {
+            field[0] = '"';
+            field[fieldLen / 2] = ',';
+            field[fieldLen - 1] = '"';
+        }
+        pos += snprintf(line + pos, MAX_LINE_LEN + 1 - pos, "%s%s",
+                        field, f + 1 < NUM_FIELDS ? "," : "\n");
+        assert(pos < MAX_LINE_LEN);
+    }
+    return line;
+}
+
+/* helper: a row keyed by an address-like EZI_ADD */
+static struct csvRecord *syntheticRecord(unsigned long *state, int row) {
+    struct csvRecord *rec = malloc(sizeof(*rec));
+    assert(rec);
+    rec->fieldCount = NUM_FIELDS;
+    rec->raw = NULL;
+    rec->key = NULL;
+    rec->offset = 0;
+    rec->fields = malloc(sizeof(char *) * NUM_FIELDS);
+    assert(rec->fields);
+    char buf[MAX_LINE_LEN + 1];
+    for (int f = 0; f < NUM_FIELDS; f++) {
+        snprintf(buf, sizeof(buf), "%d", row % 97 + f);
+        rec->fields[f] = strdup(buf);
+        assert(rec->fields[f]);
+    }
+    free(rec->fields[KEY_FIELD]);
+    snprintf(buf, sizeof(buf), "%u %s %s %s %u",
+             benchRand(state) % 400 + 1, STREETS[benchRand(state) % COUNT(STREETS)],
+             TYPES[benchRand(state) % COUNT(TYPES)],
+             LOCALITIES[benchRand(state) % COUNT(LOCALITIES)],
+             3000 + benchRand(state) % 100);
+    rec->fields[KEY_FIELD] = strdup(buf);
+    assert(rec->fields[KEY_FIELD]);
+    return rec;
+}
+
+/* helper: free one row made by parseLine */
+static void freeRecord(struct csvRecord *rec) {
+    for (int f = 0; f < rec->fieldCount; f++) free(rec->fields[f]);
+    free(rec->fields);
+    free(rec);
+}
+
+/* helper: live bytes of the index categories (not the records) */
+static long indexBytes(void) {
+    return memAccountBytes(MEM_NODES) + memAccountBytes(MEM_LEAF_KEYS) +
+           memAccountBytes(MEM_RECORD_ARRAYS);
+}
+
+/* helper: build the inputs of one sweep point */
+static void setupCase(struct benchCase *c, enum sweep sweep, int size) {
+    memset(c, 0, sizeof(*c));
+    c->size = size;
+    unsigned long state = (unsigned long)size * 7919 + sweep;
+    c->sink = fopen("/dev/null", "w");
+    assert(c->sink);
+    c->line = malloc(MAX_LINE_LEN + 1);
+    c->line2 = malloc(MAX_LINE_LEN + 1);
+    assert(c->line && c->line2);
+
+    if (sweep == SWEEP_LENGTHS) {
+        for (int i = 0; i < INPUT_VARIANTS; i++) {
+            c->keys[i] = malloc(size + 1);
+            assert(c->keys[i]);
+            randomKey(&state, c->keys[i], size);
+            c->others[i] = nearMiss(&state, c->keys[i]);
+        }
+    } else if (sweep == SWEEP_LINES) {
+        for (int i = 0; i < INPUT_VARIANTS; i++) {
+            c->keys[i] = csvLine(&state, size);
+        }
+    } else {
+        c->records = malloc(sizeof(*c->records) * size);
+        c->queries = malloc(sizeof(char *) * size);
+        assert(c->records && c->queries);
+        c->rows = malloc(sizeof(struct data *) * size);
+        c->rowKeys = malloc(sizeof(char *) * size);
+        assert(c->rows && c->rowKeys);
+        long before = indexBytes();
+        c->dict = ptDictNew(KEY_FIELD);
+        for (int row = 0; row < size; row++) {
+            c->records[row] = syntheticRecord(&state, row);
+            ptDictInsert(c->dict, c->records[row]);
+        }
+        long ptBytes = indexBytes() - before;
+        for (int row = 0; row < size; row++) {
+            c->rows[row] = readRecord(c->records[row]);
+            c->rowKeys[row] = c->records[row]->fields[KEY_FIELD];
+        }
+        before = indexBytes();
+        c->eytzinger = eyDictNew(c->rowKeys, c->rows, size);
+        long eyBytes = indexBytes() - before;
+        printf("%-26s %7d %12.1f B/row ptDict %12.1f B/row eyDict\n",
+               "memory", size, (double)ptBytes / size, (double)eyBytes / size);
+        // Lookups in random order; a typo'd key per variant for misses
+        for (int i = 0; i < size; i++) {
+            c->queries[i] = c->records[benchRand(&state) % size]->fields[KEY_FIELD];
+        }
+        for (int i = 0; i < INPUT_VARIANTS; i++) {
+            c->others[i] = lateTypo(&state, c->queries[i % size]);
+            c->results[i] = ptDictLookup(c->dict, c->queries[i % size]);
+        }
+    }
+}
+
+static void teardownCase(struct benchCase *c, enum sweep sweep) {
+    for (int i = 0; i < INPUT_VARIANTS; i++) {
+        free(c->keys[i]);
+        free(c->others[i]);
+        if (c->results[i]) freeQueryResult(c->results[i]);
+    }
+    if (sweep == SWEEP_KEYS) {
+        ptDictFree(c->dict);
+        eyDictFree(c->eytzinger);
+        for (int row = 0; row < c->size; row++) freeData(c->rows[row]);
+        free(c->rows);
+        free(c->rowKeys);
+        freeCSV(c->records, c->size);
+        free(c->queries);
+    }
+    free(c->line);
+    free(c->line2);
+    fclose(c->sink);
+}
+
+/* -------- kernels -------- */
+
+static long kernelGetBit(struct benchCase *c, long iterations, double *ns) {
+    unsigned int bits = c->size * BITS_PER_BYTE;
+    long total = 0;
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        char *key = c->keys[it % INPUT_VARIANTS];
+        for (unsigned int b = 0; b < bits; b++) total += getBit(key, b);
+    }
+    *ns += nowNs() - start;
+    sink += total;
+    return iterations * bits;
+}
+
+static long kernelBitCompare(struct benchCase *c, long iterations, double *ns) {
+    long total = 0;
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        int i = it % INPUT_VARIANTS;
+        total += bit_compare(c->keys[i], c->others[i]);
+    }
+    *ns += nowNs() - start;
+    sink += total;
+    return iterations;
+}
+
+static long kernelCreateStem(struct benchCase *c, long iterations, double *ns) {
+    unsigned int bits = c->size * BITS_PER_BYTE;
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        char *stem = createStem(c->keys[it % INPUT_VARIANTS], 0,
+                                bits - it % BITS_PER_BYTE);
+        sink += stem[0];
+        free(stem);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+static long kernelEditDistance(struct benchCase *c, long iterations, double *ns) {
+    long total = 0;
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        int i = it % INPUT_VARIANTS;
+        total += editDistance(c->keys[i], c->others[i], c->size, c->size);
+    }
+    *ns += nowNs() - start;
+    sink += total;
+    return iterations;
+}
+
+/* parseLine cuts its line up in place, so each call parses a fresh copy;
+   the copy is part of the time */
+static long kernelParseLine(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        strcpy(c->line, c->keys[it % INPUT_VARIANTS]);
+        struct csvRecord *rec = parseLine(c->line, NULL, NULL);
+        sink += rec->fieldCount;
+        freeRecord(rec);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+static long kernelCheckLine(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        strcpy(c->line, c->keys[it % INPUT_VARIANTS]);
+        checkLine(&c->line, c->sink, &c->line2);
+        sink += c->line[0];
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+/* One iteration inserts every row into a fresh dict; freeing it is not
+   timed */
+static long kernelInsert(struct benchCase *c, long iterations, double *ns) {
+    for (long it = 0; it < iterations; it++) {
+        struct ptDict *dict = ptDictNew(KEY_FIELD);
+        double start = nowNs();
+        for (int row = 0; row < c->size; row++) {
+            ptDictInsert(dict, c->records[row]);
+        }
+        *ns += nowNs() - start;
+        ptDictFree(dict);
+    }
+    return iterations * c->size;
+}
+
+static long kernelLookupExact(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        struct queryResult *r = ptDictLookup(c->dict, c->queries[it % c->size]);
+        sink += r->numRecords;
+        freeQueryResult(r);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+static long kernelLookupMiss(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        struct resultSpan span;
+        sink += ptDictFindSpan(c->dict, c->others[it % INPUT_VARIANTS], &span);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+/* The same lookups with the uncounted specialisation */
+static long kernelLookupExactPlain(struct benchCase *c, long iterations,
+                                   double *ns) {
+    ptDictSetCounting(c->dict, 0);
+    long done = kernelLookupExact(c, iterations, ns);
+    ptDictSetCounting(c->dict, 1);
+    return done;
+}
+
+static long kernelLookupMissPlain(struct benchCase *c, long iterations,
+                                  double *ns) {
+    ptDictSetCounting(c->dict, 0);
+    long done = kernelLookupMiss(c, iterations, ns);
+    ptDictSetCounting(c->dict, 1);
+    return done;
+}
+
+static long kernelLookupFuzzy(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        struct queryResult *r = ptDictLookup(c->dict,
+                                             c->others[it % INPUT_VARIANTS]);
+        sink += r->numRecords;
+        freeQueryResult(r);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+/* One iteration builds a fresh dict from every row; freeing it is not
+   timed */
+static long kernelEyBuild(struct benchCase *c, long iterations, double *ns) {
+    for (long it = 0; it < iterations; it++) {
+        double start = nowNs();
+        struct eyDict *dict = eyDictNew(c->rowKeys, c->rows, c->size);
+        *ns += nowNs() - start;
+        eyDictFree(dict);
+    }
+    return iterations * c->size;
+}
+
+static long kernelEyExact(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        struct queryResult *r = eyDictLookup(c->eytzinger,
+                                             c->queries[it % c->size]);
+        sink += r->numRecords;
+        freeQueryResult(r);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+static long kernelEyMiss(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        struct resultSpan span;
+        sink += eyDictFindSpan(c->eytzinger, c->others[it % INPUT_VARIANTS],
+                               &span);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+static long kernelEyFuzzy(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        struct queryResult *r = eyDictLookup(c->eytzinger,
+                                             c->others[it % INPUT_VARIANTS]);
+        sink += r->numRecords;
+        freeQueryResult(r);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+static char *HEADERS[NUM_FIELDS];
+
+static long kernelPrint(struct benchCase *c, long iterations, double *ns) {
+    double start = nowNs();
+    for (long it = 0; it < iterations; it++) {
+        printQueryResult(c->results[it % INPUT_VARIANTS], HEADERS, c->sink,
+                         c->sink);
+    }
+    *ns += nowNs() - start;
+    return iterations;
+}
+
+static const struct kernel KERNELS[] = {
+    {"getBit", SWEEP_LENGTHS, kernelGetBit},
+    {"bit_compare", SWEEP_LENGTHS, kernelBitCompare},
+    {"createStem", SWEEP_LENGTHS, kernelCreateStem},
+    {"editDistance", SWEEP_LENGTHS, kernelEditDistance},
+    {"parseLine", SWEEP_LINES, kernelParseLine},
+    {"checkLine", SWEEP_LINES, kernelCheckLine},
+    {"ptDictInsert", SWEEP_KEYS, kernelInsert},
+    {"ptDictLookup/exact", SWEEP_KEYS, kernelLookupExact},
+    {"ptDictFindSpan/miss", SWEEP_KEYS, kernelLookupMiss},
+    {"ptDictLookup/exact-plain", SWEEP_KEYS, kernelLookupExactPlain},
+    {"ptDictFindSpan/miss-plain", SWEEP_KEYS, kernelLookupMissPlain},
+    {"ptDictLookup/fuzzy", SWEEP_KEYS, kernelLookupFuzzy},
+    {"printQueryResult", SWEEP_KEYS, kernelPrint},
+    {"eyDictNew", SWEEP_KEYS, kernelEyBuild},
+    {"eyDictLookup/exact", SWEEP_KEYS, kernelEyExact},
+    {"eyDictFindSpan/miss", SWEEP_KEYS, kernelEyMiss},
+    {"eyDictLookup/fuzzy", SWEEP_KEYS, kernelEyFuzzy},
+};
+
+/* helper: calibrate, warm up and time one kernel on one input */
+static void runCase(const struct kernel *k, struct benchCase *c, int warmup,
+                    int reps) {
+    // Grow the iteration count until one repetition takes BENCH_REP_NS
+    long iterations = 1;
+    while (1) {
+        double ns = 0;
+        k->run(c, iterations, &ns);
+        if (ns >= BENCH_REP_NS || iterations >= (1L << 30)) break;
+        iterations *= ns > 0 && BENCH_REP_NS / ns < 16 ? 2 : 16;
+    }
+    for (int w = 0; w < warmup; w++) {
+        double ns = 0;
+        k->run(c, iterations, &ns);
+    }
+
+    double sum = 0, sumSquares = 0, min = INFINITY;
+    for (int r = 0; r < reps; r++) {
+        double ns = 0;
+        long ops = k->run(c, iterations, &ns);
+        double perOp = ns / ops;
+        sum += perOp;
+        sumSquares += perOp * perOp;
+        if (perOp < min) min = perOp;
+    }
+    double mean = sum / reps;
+    double variance = reps > 1 ? (sumSquares - sum * mean) / (reps - 1) : 0;
+    double sd = variance > 0 ? sqrt(variance) : 0;
+    printf("%-26s %7d %12.2f %10.2f %6.1f%% %12.2f\n", k->name, c->size,
+           mean, sd, mean > 0 ? 100 * sd / mean : 0, min);
+    fflush(stdout);
+}
+
+/* helper: "N,N,..." into sizes; returns how many, or -1 if malformed */
+static int parseSizes(const char *list, int *sizes) {
+    int count = 0;
+    const char *p = list;
+    while (*p) {
+        char *end = NULL;
+        long size = strtol(p, &end, 10);
+        if (end == p || size <= 0 || count == MAX_SWEEP) return -1;
+        sizes[count++] = (int)size;
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') return -1;
+    }
+    return count;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--warmup N] [--reps N] [--lengths L,L,...] "
+                    "[--lines L,L,...] [--keys N,N,...] [--only KERNEL]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int warmup = DEFAULT_WARMUP;
+    int reps = DEFAULT_REPS;
+    int sizes[3][MAX_SWEEP] = {{8, 32, 128}, {96, 256, 480},
+                               {1000, 10000, 100000}};
+    int numSizes[3] = {3, 3, 3};
+    const char *only = NULL;
+
+    int ok = 1;
+    for (int i = 1; ok && i < argc; i++) {
+        if (i + 1 >= argc) {
+            ok = 0;
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            warmup = atoi(argv[++i]);
+            ok = warmup >= 0;
+        } else if (strcmp(argv[i], "--reps") == 0) {
+            reps = atoi(argv[++i]);
+            ok = reps >= 1;
+        } else if (strcmp(argv[i], "--lengths") == 0) {
+            numSizes[SWEEP_LENGTHS] = parseSizes(argv[++i], sizes[SWEEP_LENGTHS]);
+            ok = numSizes[SWEEP_LENGTHS] > 0;
+        } else if (strcmp(argv[i], "--lines") == 0) {
+            numSizes[SWEEP_LINES] = parseSizes(argv[++i], sizes[SWEEP_LINES]);
+            ok = numSizes[SWEEP_LINES] > 0;
+            for (int s = 0; ok && s < numSizes[SWEEP_LINES]; s++) {
+                ok = sizes[SWEEP_LINES][s] < MAX_LINE_LEN;
+            }
+        } else if (strcmp(argv[i], "--keys") == 0) {
+            numSizes[SWEEP_KEYS] = parseSizes(argv[++i], sizes[SWEEP_KEYS]);
+            ok = numSizes[SWEEP_KEYS] > 0;
+        } else if (strcmp(argv[i], "--only") == 0) {
+            only = argv[++i];
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok) usage(argv[0]);
+
+    char headerBuf[NUM_FIELDS][16];
+    for (int f = 0; f < NUM_FIELDS; f++) {
+        snprintf(headerBuf[f], sizeof(headerBuf[f]), "FIELD%d", f);
+        HEADERS[f] = headerBuf[f];
+    }
+
+    printf("%-26s %7s %12s %10s %7s %12s\n", "kernel", "size", "ns/op",
+           "sd", "cv", "min ns/op");
+    for (enum sweep sweep = SWEEP_LENGTHS; sweep <= SWEEP_KEYS; sweep++) {
+        for (int s = 0; s < numSizes[sweep]; s++) {
+            int wanted = 0;
+            for (int k = 0; k < COUNT(KERNELS); k++) {
+                if (KERNELS[k].sweep == sweep &&
+                    (!only || strcmp(only, KERNELS[k].name) == 0)) {
+                    wanted = 1;
+                }
+            }
+            if (!wanted) continue;
+
+            struct benchCase c;
+            setupCase(&c, sweep, sizes[sweep][s]);
+            for (int k = 0; k < COUNT(KERNELS); k++) {
+                if (KERNELS[k].sweep != sweep) continue;
+                if (only && strcmp(only, KERNELS[k].name) != 0) continue;
+                runCase(&KERNELS[k], &c, warmup, reps);
+            }
+            teardownCase(&c, sweep);
+        }
+    }
+    return EXIT_SUCCESS;
+}
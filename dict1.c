@@ -7,8 +7,14 @@
 #include "dict_common.h"
 #include "linked_list_dict.h"
 #include "read.h"
+#include "decompress.h"
+#include "bloom_filter.h"
+#include "mem_account.h"
 
 #define EXPECTED_ARGC 4
+#define FIRST_OPTION_INDEX 4
+#define BLOOM_OPTION "--bloom"
+#define NO_COUNTS_OPTION "--no-counts"
 #define STAGE_INDEX 1
 #define INPUT_FILE_NAME_INDEX 2
 #define OUTPUT_FILE_NAME_INDEX 3
@@ -18,13 +24,28 @@
 
 
 int main (int argc, char *argv[]){
-    // check if there's 4 arguments and the stage input is correct
-    if (argc != 4){
+    // check if there's 4 arguments (plus options) and the stage input is correct
+    int bloomBits = 0;
+    int counting = 1;
+    int ok = argc >= EXPECTED_ARGC;
+    for (int i = FIRST_OPTION_INDEX; ok && i < argc; i++) {
+        if (strcmp(argv[i], BLOOM_OPTION) == 0 && i + 1 < argc) {
+            bloomBits = atoi(argv[++i]);
+            ok = bloomBits >= 1 && bloomBits <= BLOOM_MAX_BITS_PER_KEY;
+        } else if (strcmp(argv[i], NO_COUNTS_OPTION) == 0) {
+            counting = 0;
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok){
         printf("Please enter exactly 4 arguments:\n\
                     1st: Call to program\n\
                     2nd: Stage Num\n\
                     3rd: input file name\n\
-                    4th: output file name\n.");
+                    4th: output file name\n\
+                    optionally followed by --bloom BITS (1-32 bits per key)\n\
+                    and --no-counts (no comparison counts, uncounted lookups)\n.");
         exit(EXIT_FAILURE);
     } 
     if (strcmp(argv[STAGE_INDEX], PATRICIA_TREE_STAGE) == 0) {
@@ -39,7 +60,7 @@ int main (int argc, char *argv[]){
 
                                             /* Now Execute Stage 1*/
 
-    FILE *input_file = fopen(argv[INPUT_FILE_NAME_INDEX], "r");
+    FILE *input_file = compressedOpen(argv[INPUT_FILE_NAME_INDEX]);
     FILE *output_file = fopen(argv[OUTPUT_FILE_NAME_INDEX], "w");
     assert(output_file != NULL);
     assert(input_file != NULL);
@@ -54,6 +75,17 @@ int main (int argc, char *argv[]){
     // Build linked list dictionary with the Edzi_add field as search key
     struct llDict *dict = llDictNew(EDZI_ADD);
 
+    // Optional Bloom filter of the keys: most misses then skip the scan
+    if (bloomBits > 0) {
+        llDictEnableBloom(dict, num_records, bloomBits);
+    }
+
+    // Without the counts in the summary lines, the scan does no counting
+    if (!counting) {
+        llDictSetCounting(dict, 0);
+        setSummaryCounts(0);
+    }
+
     // pPopulate dictionary
     for (int i = 0; i < num_records; i++) {
         llDictInsert(dict, dataset[i]);
@@ -67,8 +99,12 @@ int main (int argc, char *argv[]){
         struct queryResult *results = llDictLookup(dict, query);
         printQueryResult(results, field_headers, stdout, output_file);
         freeQueryResult(results);
+        freeQuery(query);
     }
 
+    llDictPrintFilterStats(dict, stderr);
+    memAccountPrint(stderr, num_records);
+
     // free all the allocated 
     llDictFree(dict); 
     freeHeader(field_headers, NUM_FIELDS);
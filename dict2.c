@@ -1,25 +1,276 @@
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "record.h"
 #include "read.h"
 #include "dict_common.h"
-#include "patricia_tree_dict.h"
+#include "record_store.h"
+#include "multi_index.h"
+#include "spatial_index.h"
+#include "symspell.h"
+#include "inverted_index.h"
+#include "trigram_index.h"
+#include "typed_columns.h"
+#include "query_pipeline.h"
+#include "intern.h"
+#include "shard_router.h"
+#include "output_format.h"
+#include "mem_account.h"
+#include "decompress.h"
+#include "bloom_filter.h"
+#include "record_blocks.h"
 
 #define EXPECTED_ARGC 4
 #define STAGE_INDEX 1
 #define INPUT_IDX 2
 #define OUTPUT_IDX 3
+#define FIRST_OPTION_IDX 4
 
 #define PATRICIA_STAGE   "2"
-#define EZI_ADD_INDEX    1
+#define EZI_ADD_HEADER   "EZI_ADD"
+#define X_HEADER         "x"
+#define Y_HEADER         "y"
+#define INDEX_OPTION     "--index"
+#define SPATIAL_OPTION   "--spatial"
+#define PREFIX_LIMIT_OPTION "--prefix-limit"
+#define WORKERS_OPTION   "--workers"
+#define SYMSPELL_OPTION  "--symspell"
+#define STATS_OPTION     "--stats"
+#define SEARCH_OPTION    "--search"
+#define SEARCH_LIMIT_OPTION "--search-limit"
+#define CONTAINS_OPTION  "--contains"
+#define BUILD_THREADS_OPTION "--build-threads"
+#define SHARDS_OPTION    "--shards"
+#define LAZY_OPTION      "--lazy"
+#define FORMAT_OPTION    "--format"
+#define FIELDS_OPTION    "--fields"
+#define ONDISK_OPTION    "--ondisk"
+#define PACKED_OPTION    "--packed"
+#define RECORD_CACHE_OPTION "--record-cache"
+#define EXACT_OPTION     "--exact"
+#define BLOOM_OPTION     "--bloom"
+#define NO_COUNTS_OPTION "--no-counts"
+#define COLUMN_SEPARATOR "+"
+#define DEFAULT_PREFIX_LIMIT 10
+#define DEFAULT_WORKERS 1
+
+/* Everything built from the input file that queries can use */
+struct searchState {
+    char **headers;
+    struct recordStore *store;
+    struct multiIndex *indexes;
+    struct spatialIndex *spatial;   // NULL unless --spatial
+    struct typedColumns *columns;   // numeric/date columns for filters,
+                                    // built by the first filter query
+    pthread_mutex_t columnsLock;
+    struct invertedIndex *search;   // NULL unless --search
+    int searchLimit;                // rows returned by SEARCH: queries
+    struct trigramIndex *contains;  // NULL unless --contains
+    int prefixLimit;                // page size of PREFIX: queries
+    FILE *summaryFile;
+    FILE *outputFile;
+    struct recordWriter *writer;    // NULL unless --format or --fields
+};
+
+/* The answer to one query: an autocomplete page, a list of records, or
+   (for plain index lookups) a span borrowing the index's records */
+struct answer {
+    struct prefixResult *prefix;
+    struct queryResult *result;
+    struct resultSpan span;
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s 2 <input.csv> <output.txt> [--index COLUMN[+COLUMN...]]... "
+                    "[--spatial] [--prefix-limit N] [--workers N] [--symspell D] [--stats] "
+                    "[--search COLUMN[+COLUMN...]] [--search-limit N] "
+                    "[--contains COLUMN[+COLUMN...]] [--build-threads N] [--lazy] "
+                    "[--format text|ndjson|tsv|binary] [--fields COLUMN[+COLUMN...]] "
+                    "[--ondisk | --packed] [--record-cache N] [--exact [--bloom BITS]] "
+                    "[--no-counts] < <keys>\n"
+                    "       %s 2 <input.csv> <output.txt> --shards N < <keys>\n", prog, prog);
+    exit(EXIT_FAILURE);
+}
+
+/* helper: column number of a header name, or -1 */
+static int headerIndex(char **headers, const char *name) {
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (strcmp(headers[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+/* helper: N if the options are "--shards N" (1..SHARD_MAX), 0 if they do
+   not ask for shards */
+static int shardOption(int argc, char *argv[]) {
+    for (int i = FIRST_OPTION_IDX; i < argc; i++) {
+        if (strcmp(argv[i], SHARDS_OPTION) != 0) continue;
+        int shards = 0;
+        if (i == FIRST_OPTION_IDX && argc == FIRST_OPTION_IDX + 2) {
+            shards = atoi(argv[i + 1]);
+        }
+        if (shards < 1 || shards > SHARD_MAX) usage(argv[0]);
+        return shards;
+    }
+    return 0;
+}
+
+/* helper: column numbers of "COLUMN+COLUMN+..." into fields; returns how
+   many, or -1 if a column is unknown */
+static int parseColumns(char **headers, const char *spec, int *fields) {
+    char *copy = strdup(spec);
+    assert(copy);
+    int count = 0;
+    char *save = NULL;
+    for (char *name = strtok_r(copy, COLUMN_SEPARATOR, &save); name;
+         name = strtok_r(NULL, COLUMN_SEPARATOR, &save)) {
+        int field = headerIndex(headers, name);
+        if (field < 0 || count == NUM_FIELDS) {
+            count = -1;
+            break;
+        }
+        fields[count++] = field;
+    }
+    free(copy);
+    return count;
+}
+
+/* helper: the typed columns, built on first use: they read every field
+   of every row, which a lazy load (or a run without filters) avoids */
+static struct typedColumns *filterColumns(struct searchState *state) {
+    pthread_mutex_lock(&state->columnsLock);
+    if (!state->columns) {
+        state->columns = typedColumnsNew(state->store, state->headers);
+    }
+    struct typedColumns *tc = state->columns;
+    pthread_mutex_unlock(&state->columnsLock);
+    return tc;
+}
+
+/* helper: split "query | predicates" into its parts. Returns the parsed
+   filter and cuts query short, or NULL (query untouched) if there is no
+   well formed filter. */
+static struct rowFilter *splitFilter(struct searchState *state, char *query) {
+    char *separator = strrchr(query, FILTER_SEPARATOR);
+    if (!separator) return NULL;
+    struct rowFilter *filter = typedColumnsFilter(filterColumns(state),
+                                                 separator + 1);
+    if (!filter) return NULL;
+    while (separator > query && separator[-1] == ' ') separator--;
+    *separator = '\0';
+    return filter;
+}
+
+/* Answer one query: autocomplete pages, filter scans, spatial queries (if
+   enabled), then lookups on the indexes. Any but the first can be narrowed
+   by a trailing "| predicates" (a filtered autocomplete query finds
+   nothing). Runs on the pipeline's worker threads; a
+   plain index hit allocates nothing. */
+static void answerQuery(void *context, char *query, void *answer) {
+    struct searchState *state = context;
+    struct answer *a = answer;
+    a->prefix = NULL;
+    a->result = NULL;
+
+    // Only a filtered query needs its full text kept for the output
+    char *fullQuery = strchr(query, FILTER_SEPARATOR) ? strdup(query) : NULL;
+    struct rowFilter *filter = splitFilter(state, query);
+
+    if (!filter) {
+        free(fullQuery);
+    }
+    a->prefix = multiIndexPrefixQuery(state->indexes, query,
+                                      state->prefixLimit);
+    if (a->prefix) {
+        // Row predicates cannot narrow a page of keys (its counts and
+        // cursors are over all rows): the combination gets an empty page
+        if (filter) {
+            fprintf(stderr, "'%s': PREFIX: queries take no filter.\n",
+                    fullQuery);
+            freePrefixResult(a->prefix);
+            a->prefix = newPrefixResult(fullQuery);
+            rowFilterFree(filter);
+            free(fullQuery);
+        }
+        return;
+    }
+
+    struct queryResult *r = NULL;
+    if (strncmp(query, FILTER_PREFIX, strlen(FILTER_PREFIX)) == 0) {
+        r = typedColumnsQuery(filterColumns(state), query);
+    }
+    if (!r && state->spatial) {
+        r = spatialIndexQuery(state->spatial, query);
+    }
+    if (!r && state->search) {
+        r = invertedIndexQuery(state->search, query, state->searchLimit);
+    }
+    if (!r && state->contains) {
+        r = trigramIndexQuery(state->contains, query);
+    }
+    if (!r) {
+        multiIndexLookupSpan(state->indexes, query, &a->span);
+        if (!filter) return;
+        r = spanToQueryResult(&a->span);   // filtering needs its own copy
+    }
+    if (filter) {
+        typedColumnsApply(filterColumns(state), filter, r);
+        rowFilterFree(filter);
+        free(r->searchString);
+        r->searchString = fullQuery;
+    }
+    a->result = r;
+}
+
+/* helper: emitAnswer for --format/--fields: the summary as usual, the
+   output file through the record writer */
+static void emitFormatted(struct searchState *state, struct answer *a) {
+    if (a->prefix) {
+        printPrefixSummary(a->prefix, state->summaryFile);
+        recordWriterPrefix(state->writer, a->prefix);
+        freePrefixResult(a->prefix);
+        return;
+    }
+    struct resultSpan span = a->span;
+    if (a->result) {
+        struct queryResult *r = a->result;
+        span = (struct resultSpan){r->searchString, r->records, r->numRecords,
+                                   r->bitCount, r->nodeCount, r->stringCount};
+    }
+    printSpanSummary(&span, state->summaryFile);
+    recordWriterRecords(state->writer, span.searchString, span.records,
+                        span.numRecords);
+    freeQueryResult(a->result);
+}
+
+/* Print one answer and free what it owns, in input order */
+static void emitAnswer(void *context, char *query, void *answer) {
+    struct searchState *state = context;
+    struct answer *a = answer;
+    (void)query;
+    if (state->writer) {
+        emitFormatted(state, a);
+    } else if (a->prefix) {
+        printPrefixResult(a->prefix, state->summaryFile, state->outputFile);
+        freePrefixResult(a->prefix);
+    } else if (a->result) {
+        printQueryResult(a->result, state->headers, state->summaryFile,
+                         state->outputFile);
+        freeQueryResult(a->result);
+    } else {
+        printResultSpan(&a->span, state->headers, state->summaryFile,
+                        state->outputFile);
+    }
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != EXPECTED_ARGC) {
-        fprintf(stderr, "Usage: %s 2 <input.csv> <output.txt> < <keys>\n", argv[0]);
-        exit(EXIT_FAILURE);
+    if (argc < EXPECTED_ARGC) {
+        usage(argv[0]);
     }
     if (strcmp(argv[STAGE_INDEX], PATRICIA_STAGE) != 0) {
         fprintf(stderr, "This program runs Stage 2 only. Received stage '%s'.\n", argv[STAGE_INDEX]);
@@ -29,7 +280,8 @@ int main(int argc, char *argv[]) {
     const char *inputCSV = argv[INPUT_IDX];
     const char *outputTxt = argv[OUTPUT_IDX];
 
-    FILE *input_file = fopen(inputCSV, "r");
+    /* gzip (or zstd) input is decompressed on the fly by its own thread */
+    FILE *input_file = compressedOpen(inputCSV);
     FILE *output_file = fopen(outputTxt, "w");
     assert(input_file && output_file);
 
@@ -37,30 +289,267 @@ int main(int argc, char *argv[]) {
     char **headers = parse_header(input_file);
     assert(headers);
 
+    /* Sharded: this process only routes EZI_ADD lookups, each shard
+       process loads and indexes its own part of the file */
+    int shards = shardOption(argc, argv);
+    if (shards > 0) {
+        struct shardRouter *router = shardRouterNew(inputCSV, EZI_ADD_HEADER,
+                                                    shards);
+        char *query = NULL;
+        while ((query = getQuery(stdin)) != NULL) {
+            shardRouterAnswer(router, query, stdout, output_file);
+            freeQuery(query);
+        }
+        shardRouterFree(router);
+        freeHeader(headers, NUM_FIELDS);
+        fclose(input_file);
+        fclose(output_file);
+        return EXIT_SUCCESS;
+    }
+
+    /* Field values are interned: repeated values are stored once. With
+       --lazy only EZI_ADD is parsed now, the rest of a row on first use.
+       With --ondisk only EZI_ADD stays in memory: the lines go to an
+       unlinked record file and are read back when they are printed.
+       --packed loads the same way, then packs the record file into
+       compressed blocks in memory and only inflates the blocks of the
+       rows printed. */
+    int lazy = 0;
+    int packed = 0;
+    FILE *recordFile = NULL;
+    int cacheRows = RECORD_CACHE_DEFAULT_ROWS;
+    for (int i = FIRST_OPTION_IDX; i < argc; i++) {
+        if (strcmp(argv[i], LAZY_OPTION) == 0) lazy = 1;
+        if (strcmp(argv[i], PACKED_OPTION) == 0) packed = 1;
+        if ((strcmp(argv[i], ONDISK_OPTION) == 0 ||
+             strcmp(argv[i], PACKED_OPTION) == 0) && !recordFile) {
+            recordFile = tmpfile();
+            assert(recordFile);
+        }
+        if (strcmp(argv[i], RECORD_CACHE_OPTION) == 0 && i + 1 < argc) {
+            cacheRows = atoi(argv[i + 1]);
+        }
+    }
+    struct internPool *pool = internPoolNew(INTERN_DEFAULT_SLOTS);
     int n = 0;
-    struct csvRecord **dataset = readCSV(input_file, &n);
+    int dedupe[NUM_FIELDS];
+    int keyField = lazy || recordFile ? headerIndex(headers, EZI_ADD_HEADER)
+                                      : -1;
+    struct csvRecord **dataset = NULL;
+    if (recordFile) {
+        assert(keyField >= 0);
+        dataset = readCSVOnDisk(input_file, &n, pool, keyField, recordFile);
+    } else if (lazy) {
+        assert(keyField >= 0);
+        dataset = readCSVLazy(input_file, &n, pool, keyField, dedupe);
+    } else {
+        dataset = readCSVInterned(input_file, &n, pool);
+    }
+
+    /* Records are stored once; every index references them */
+    struct searchState state;
+    state.headers = headers;
+    if (packed) {
+        state.store = recordStoreNewPacked(dataset, n, pool, keyField,
+                                           recordFile, cacheRows);
+    } else if (recordFile) {
+        state.store = recordStoreNewOnDisk(dataset, n, pool, keyField,
+                                           recordFile, cacheRows);
+    } else if (lazy) {
+        state.store = recordStoreNewLazy(dataset, n, pool, keyField,
+                                         dedupe);
+    } else {
+        state.store = recordStoreNew(dataset, n, pool);
+    }
+    state.indexes = multiIndexNew(state.store, headers);
+    state.columns = NULL;
+    pthread_mutex_init(&state.columnsLock, NULL);
+    state.spatial = NULL;
+    state.search = NULL;
+    state.searchLimit = SEARCH_DEFAULT_LIMIT;
+    state.contains = NULL;
+    state.prefixLimit = DEFAULT_PREFIX_LIMIT;
+    state.summaryFile = stdout;
+    state.outputFile = output_file;
+    state.writer = NULL;
+    int workers = DEFAULT_WORKERS;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int buildThreads = online > 0 ? (int)online : 1;
 
-    struct ptDict *dict = ptDictNew(EZI_ADD_INDEX);
+    /* EZI_ADD is the default index, extra ones are named by --index */
+    int ok = multiIndexDeclare(state.indexes, EZI_ADD_HEADER) >= 0;
+    int useSpatial = 0;
+    int printStats = 0;
+    int searchFields[NUM_FIELDS];
+    int numSearchFields = 0;
+    int containsFields[NUM_FIELDS];
+    int numContainsFields = 0;
+    int format = -1;
+    int outputFields[NUM_FIELDS];
+    int numOutputFields = 0;
+    int exact = 0;
+    int bloomBits = 0;
+    int counting = 1;
+    for (int i = FIRST_OPTION_IDX; ok && i < argc; i++) {
+        if (strcmp(argv[i], INDEX_OPTION) == 0 && i + 1 < argc) {
+            i++;
+            if (multiIndexDeclare(state.indexes, argv[i]) < 0) {
+                fprintf(stderr, "Cannot index '%s': unknown column.\n", argv[i]);
+                ok = 0;
+            }
+        } else if (strcmp(argv[i], SPATIAL_OPTION) == 0) {
+            useSpatial = 1;
+        } else if (strcmp(argv[i], PREFIX_LIMIT_OPTION) == 0 && i + 1 < argc) {
+            state.prefixLimit = atoi(argv[++i]);
+            ok = state.prefixLimit > 0;
+        } else if (strcmp(argv[i], WORKERS_OPTION) == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            ok = workers >= 0 && workers <= PIPELINE_MAX_WORKERS;
+        } else if (strcmp(argv[i], SYMSPELL_OPTION) == 0 && i + 1 < argc) {
+            int distance = atoi(argv[++i]);
+            ok = distance >= 1 && distance <= SYMSPELL_MAX_DISTANCE;
+            if (ok) multiIndexEnableSymSpell(state.indexes, distance);
+        } else if (strcmp(argv[i], STATS_OPTION) == 0) {
+            printStats = 1;
+        } else if (strcmp(argv[i], SEARCH_OPTION) == 0 && i + 1 < argc) {
+            numSearchFields = parseColumns(headers, argv[++i], searchFields);
+            if (numSearchFields <= 0) {
+                fprintf(stderr, "Cannot search '%s': unknown column.\n", argv[i]);
+                ok = 0;
+            }
+        } else if (strcmp(argv[i], CONTAINS_OPTION) == 0 && i + 1 < argc) {
+            numContainsFields = parseColumns(headers, argv[++i], containsFields);
+            if (numContainsFields <= 0) {
+                fprintf(stderr, "Cannot index '%s': unknown column.\n", argv[i]);
+                ok = 0;
+            }
+        } else if (strcmp(argv[i], SEARCH_LIMIT_OPTION) == 0 && i + 1 < argc) {
+            state.searchLimit = atoi(argv[++i]);
+            ok = state.searchLimit > 0;
+        } else if (strcmp(argv[i], FORMAT_OPTION) == 0 && i + 1 < argc) {
+            format = outputFormatByName(argv[++i]);
+            ok = format >= 0;
+        } else if (strcmp(argv[i], FIELDS_OPTION) == 0 && i + 1 < argc) {
+            numOutputFields = parseColumns(headers, argv[++i], outputFields);
+            if (numOutputFields <= 0) {
+                fprintf(stderr, "Cannot print '%s': unknown column.\n", argv[i]);
+                ok = 0;
+            }
+        } else if (strcmp(argv[i], LAZY_OPTION) == 0 ||
+                   strcmp(argv[i], ONDISK_OPTION) == 0 ||
+                   strcmp(argv[i], PACKED_OPTION) == 0) {
+            // already applied when the file was read
+        } else if (strcmp(argv[i], RECORD_CACHE_OPTION) == 0 && i + 1 < argc) {
+            ok = atoi(argv[++i]) >= 1;
+        } else if (strcmp(argv[i], EXACT_OPTION) == 0) {
+            exact = 1;
+        } else if (strcmp(argv[i], BLOOM_OPTION) == 0 && i + 1 < argc) {
+            bloomBits = atoi(argv[++i]);
+            ok = bloomBits >= 1 && bloomBits <= BLOOM_MAX_BITS_PER_KEY;
+        } else if (strcmp(argv[i], NO_COUNTS_OPTION) == 0) {
+            counting = 0;
+        } else if (strcmp(argv[i], BUILD_THREADS_OPTION) == 0 && i + 1 < argc) {
+            buildThreads = atoi(argv[++i]);
+            ok = buildThreads >= 1;
+        } else {
+            ok = 0;
+        }
+    }
+    // The filter only answers "not a key", which is all an exact lookup needs
+    if (!ok || (bloomBits > 0 && !exact)) {
+        usage(argv[0]);
+    }
+    multiIndexSetExact(state.indexes, exact);
+    /* Without the counts in the summary lines the trees use their plain
+       lookups, which do no counting at all */
+    if (!counting) {
+        multiIndexSetCounting(state.indexes, 0);
+        setSummaryCounts(0);
+    }
+    if (bloomBits > 0) {
+        multiIndexEnableBloom(state.indexes, bloomBits);
+        multiIndexSetBloomStats(state.indexes, printStats);
+    }
+
+    /* Build all Patricia trees in one parallel pass, each tree split into
+       key-range partitions built side by side */
+    multiIndexBuild(state.indexes, buildThreads);
+    if (printStats) {
+        multiIndexPrintStats(state.indexes, stderr);
+    }
+
+    /* Optional k-d tree over the x/y columns for NEAR:/BOX: queries */
+    if (useSpatial) {
+        int xField = headerIndex(headers, X_HEADER);
+        int yField = headerIndex(headers, Y_HEADER);
+        assert(xField >= 0 && yField >= 0);
+        state.spatial = spatialIndexNew(state.store, xField, yField);
+    }
 
-    /* Build Patricia tree */
-    for (int i = 0; i < n; i++) {
-        ptDictInsert(dict, dataset[i]);
+    /* Optional word index for SEARCH: queries */
+    if (numSearchFields > 0) {
+        state.search = invertedIndexNew(state.store, searchFields,
+                                        numSearchFields);
+        if (printStats) {
+            fprintf(stderr, "search: %d words, %zu bytes\n",
+                    invertedIndexTerms(state.search),
+                    invertedIndexBytes(state.search));
+        }
     }
 
-    /* Process queries from stdin */
-    char *query = NULL;
-    while ((query = getQuery(stdin)) != NULL) {
-        struct queryResult *r = ptDictLookup(dict, query);
-        /* Stage string passed to printing: "2" */
-        printQueryResult(r, headers, stdout, output_file);
-        freeQueryResult(r);
-        free(query);
+    /* Optional trigram index for CONTAINS: queries */
+    if (numContainsFields > 0) {
+        state.contains = trigramIndexNew(state.store, containsFields,
+                                         numContainsFields);
+        if (printStats) {
+            fprintf(stderr, "contains: %d trigrams, %zu bytes\n",
+                    trigramIndexTrigrams(state.contains),
+                    trigramIndexBytes(state.contains));
+        }
+    }
+
+    /* Where the memory of the loaded dataset went */
+    if (printStats) {
+        memAccountPrint(stderr, n);
+    }
+
+    /* Compact output: the chosen format (text by default) with only the
+       --fields columns (all by default), headers written once */
+    if (format >= 0 || numOutputFields > 0) {
+        if (numOutputFields == 0) {
+            for (int i = 0; i < NUM_FIELDS; i++) outputFields[i] = i;
+            numOutputFields = NUM_FIELDS;
+        }
+        state.writer = recordWriterNew(output_file,
+                                       format >= 0 ? format : OUTPUT_TEXT,
+                                       headers, outputFields, numOutputFields);
+    }
+
+    /* Process queries from stdin: reader, lookup workers and writer run
+       as pipeline stages (--workers 0 keeps everything on this thread) */
+    pipelineRun(stdin, workers, sizeof(struct answer), answerQuery,
+                emitAnswer, &state);
+
+    /* At exit: filter and block statistics with --stats; the memory
+       report always, its peaks now including the query side */
+    if (printStats) {
+        multiIndexPrintFilterStats(state.indexes, stderr);
+        if (recordStoreBlocks(state.store)) {
+            recordBlocksPrintStats(recordStoreBlocks(state.store), stderr);
+        }
     }
+    memAccountPrint(stderr, n);
 
     /* Cleanup */
-    ptDictFree(dict);
+    recordWriterFree(state.writer);
+    trigramIndexFree(state.contains);
+    invertedIndexFree(state.search);
+    spatialIndexFree(state.spatial);
+    typedColumnsFree(state.columns);
+    pthread_mutex_destroy(&state.columnsLock);
+    multiIndexFree(state.indexes);
+    recordStoreFree(state.store);
     freeHeader(headers, NUM_FIELDS);
-    freeCSV(dataset, n);
     fclose(input_file);
     fclose(output_file);
 
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "record.h"
+#include "read.h"
+#include "dict_common.h"
+#include "record_store.h"
+#include "eytzinger_dict.h"
+#include "intern.h"
+#include "mem_account.h"
+#include "decompress.h"
+
+#define EXPECTED_ARGC 4
+#define STATS_ARGC 5
+#define STAGE_INDEX 1
+#define INPUT_IDX 2
+#define OUTPUT_IDX 3
+#define STATS_IDX 4
+
+#define EYTZINGER_STAGE "3"
+#define EZI_ADD_HEADER  "EZI_ADD"
+#define STATS_OPTION    "--stats"
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s 3 <input.csv> <output.txt> [--stats] < <keys>\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+/* Stage 3: the same lookups and output as stage 2, answered from a sorted
+   key array in Eytzinger layout instead of a Patricia tree */
+int main(int argc, char *argv[]) {
+    if (argc != EXPECTED_ARGC &&
+        !(argc == STATS_ARGC && strcmp(argv[STATS_IDX], STATS_OPTION) == 0)) {
+        usage(argv[0]);
+    }
+    if (strcmp(argv[STAGE_INDEX], EYTZINGER_STAGE) != 0) {
+        fprintf(stderr, "This program runs Stage 3 only. Received stage '%s'.\n",
+                argv[STAGE_INDEX]);
+        exit(EXIT_FAILURE);
+    }
+    int printStats = argc == STATS_ARGC;
+
+    FILE *input_file = compressedOpen(argv[INPUT_IDX]);
+    FILE *output_file = fopen(argv[OUTPUT_IDX], "w");
+    assert(input_file && output_file);
+
+    char **headers = parse_header(input_file);
+    assert(headers);
+    int keyField = -1;
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (strcmp(headers[i], EZI_ADD_HEADER) == 0) keyField = i;
+    }
+    assert(keyField >= 0);
+
+    /* Rows are stored once; the dictionary sorts references to them */
+    struct internPool *pool = internPoolNew(INTERN_DEFAULT_SLOTS);
+    int n = 0;
+    struct csvRecord **dataset = readCSVInterned(input_file, &n, pool);
+    struct recordStore *store = recordStoreNew(dataset, n, pool);
+    char **keys = malloc(sizeof(char *) * (n > 0 ? n : 1));
+    struct data **recs = malloc(sizeof(struct data *) * (n > 0 ? n : 1));
+    assert(keys && recs);
+    for (int row = 0; row < n; row++) {
+        recs[row] = recordStoreGet(store, row);
+        keys[row] = dataField(recs[row], keyField);
+    }
+    struct eyDict *dict = eyDictNew(keys, recs, n);
+    free(keys);
+    free(recs);
+    if (printStats) {
+        fprintf(stderr, "eytzinger: %d keys, %zu bytes\n", eyDictKeys(dict),
+                eyDictBytes(dict));
+        memAccountPrint(stderr, n);
+    }
+
+    char *query = NULL;
+    while ((query = getQuery(stdin)) != NULL) {
+        struct resultSpan span;
+        eyDictLookupSpan(dict, query, &span);
+        printResultSpan(&span, headers, stdout, output_file);
+        freeQuery(query);
+    }
+
+    /* Where the memory went, reported at exit */
+    memAccountPrint(stderr, n);
+
+    /* Cleanup */
+    eyDictFree(dict);
+    recordStoreFree(store);
+    freeHeader(headers, NUM_FIELDS);
+    fclose(input_file);
+    fclose(output_file);
+
+    return EXIT_SUCCESS;
+}
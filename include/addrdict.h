@@ -0,0 +1,103 @@
+/*
+    libaddrdict: the address dictionary as a library.
+
+    An addrDict is opened from a CSV file (plain, gzip or, when built with
+    ZSTD=1, zstd) and indexes it the way dict2 does: a Patricia tree over
+    EZI_ADD plus any extra indexes named in the options. Lookups return an
+    addrResult holding the matching rows, whose fields are read one at a
+    time by row and column number.
+
+        struct addrDict *d = addrDictOpen("dataset.csv", NULL);
+        struct addrResult *r = addrDictLookup(d, "PFI:422335994",
+                                              ADDRDICT_EXACT);
+        for (int row = 0; row < addrResultCount(r); row++)
+            puts(addrResultField(r, row, addrDictFieldIndex(d, "EZI_ADD")));
+        addrResultFree(r);
+        addrDictClose(d);
+
+    Once open, a dictionary is read-only: any number of threads may look
+    up keys and read results at the same time. A result (and every field
+    string it returns) stays valid until it is freed or the dictionary is
+    closed. Only the functions declared here are exported by the shared
+    library; ADDRDICT_API_VERSION changes whenever one of them does.
+*/
+#ifndef ADDRDICT_H
+#define ADDRDICT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ADDRDICT_API_VERSION 1
+
+#if defined(__GNUC__)
+#define ADDRDICT_API __attribute__((visibility("default")))
+#else
+#define ADDRDICT_API
+#endif
+
+struct addrDict;
+struct addrResult;
+
+enum addrDictMode {
+    ADDRDICT_EXACT,     // only rows whose key is the query
+    ADDRDICT_FUZZY      // else the closest key, as dict2 answers
+};
+
+struct addrDictOptions {
+    const char *const *indexes;   // extra indexes, "COLUMN[+COLUMN...]"
+    int numIndexes;
+    int lazy;                     // parse fields other than EZI_ADD on use
+    int bloomBitsPerKey;          // 0: no Bloom filters for exact misses
+    int buildThreads;             // 0: one per CPU
+};
+
+/* No extra indexes, eager loading, no filters, one thread per CPU. */
+ADDRDICT_API void addrDictDefaultOptions(struct addrDictOptions *options);
+
+/* Load and index csvPath; options may be NULL for the defaults. Returns
+   NULL if the file cannot be read, its header is missing, has fewer
+   columns than the dataset's or no EZI_ADD column, an index names an
+   unknown column, or an option is out of range (numIndexes < 0, a NULL
+   index name, bloomBitsPerKey outside 0..32). */
+ADDRDICT_API struct addrDict *addrDictOpen(const char *csvPath,
+                                           const struct addrDictOptions *options);
+
+/* Number of rows loaded. */
+ADDRDICT_API int addrDictSize(struct addrDict *d);
+
+/* Number of columns, the name of column `field`, and the column called
+   `name` (-1 if there is none). */
+ADDRDICT_API int addrDictNumFields(struct addrDict *d);
+ADDRDICT_API const char *addrDictFieldName(struct addrDict *d, int field);
+ADDRDICT_API int addrDictFieldIndex(struct addrDict *d, const char *name);
+
+/* Look up a key, "NAME:key" for an extra index. Never returns NULL; a
+   miss has no rows. */
+ADDRDICT_API struct addrResult *addrDictLookup(struct addrDict *d,
+                                               const char *query,
+                                               enum addrDictMode mode);
+
+/* addrDictLookup of queries[0..n) into results[0..n). */
+ADDRDICT_API void addrDictLookupBatch(struct addrDict *d,
+                                      const char *const *queries, int n,
+                                      enum addrDictMode mode,
+                                      struct addrResult **results);
+
+/* The query as given, its number of rows, and column `field` of row
+   `row` (file order within a key). */
+ADDRDICT_API const char *addrResultQuery(struct addrResult *r);
+ADDRDICT_API int addrResultCount(struct addrResult *r);
+ADDRDICT_API const char *addrResultField(struct addrResult *r, int row,
+                                         int field);
+
+ADDRDICT_API void addrResultFree(struct addrResult *r);
+
+/* Free the dictionary; every result must have been freed first. */
+ADDRDICT_API void addrDictClose(struct addrDict *d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,5 +4,6 @@
 
 int getBit(char *s, unsigned int bitIndex);
 int bit_compare(char *str1, char *str2);
+unsigned int firstBitDifference(const char *a, const char *b);
 char *createStem(char *oldKey, unsigned int startBit, unsigned int numBits);
 #endif 
\ No newline at end of file
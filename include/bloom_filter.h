@@ -0,0 +1,56 @@
+/*
+    Blocked Bloom filter over the keys of a dictionary.
+
+    The filter is an array of 64-byte blocks. A key's hash picks one
+    block and k bits inside it, so adding or probing a key touches a
+    single cache line. A probe that finds any of the k bits clear proves
+    the key was never added; one that finds them all set may still be a
+    false positive, which the caller settles with the real lookup and
+    reports back with bloomFilterMissed.
+
+    With b bits per key, k is about b ln 2 (10 bits per key: k = 7, about
+    1% false positives). Probes are safe from several threads once every
+    key has been added.
+*/
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define BLOOM_BLOCK_BYTES 64
+#define BLOOM_MAX_BITS_PER_KEY 32
+#define BLOOM_DEFAULT_BITS_PER_KEY 10
+
+struct bloomFilter;
+
+/* An empty filter sized for `expectedKeys` keys at bitsPerKey bits each
+   (1..BLOOM_MAX_BITS_PER_KEY). */
+struct bloomFilter *bloomFilterNew(int expectedKeys, int bitsPerKey);
+
+/* Add a key. Not safe to run alongside other adds or probes. */
+void bloomFilterAdd(struct bloomFilter *f, const char *key);
+
+/* 0 if key was certainly never added, 1 if it may have been. */
+int bloomFilterMayContain(struct bloomFilter *f, const char *key);
+
+/* A key bloomFilterMayContain let through turned out not to be a key. */
+void bloomFilterMissed(struct bloomFilter *f);
+
+/* Count probes, rejections and false positives for the statistics (off
+   by default). The counters are shared, so with several lookup threads
+   every probe would write the same cache line: turn them on only when
+   the statistics are printed. Call before probing. */
+void bloomFilterSetCounting(struct bloomFilter *f, int counting);
+
+/* Bytes of the bit array. */
+size_t bloomFilterBytes(struct bloomFilter *f);
+
+/* One line: size, k, the false positive rate expected for the keys
+   added, and (if counting) the probes, rejections and false positives
+   seen so far. */
+void bloomFilterPrintStats(struct bloomFilter *f, const char *name, FILE *out);
+
+void bloomFilterFree(struct bloomFilter *f);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+    Streaming decompression of CSV inputs.
+
+        file --> decompressor thread --> double buffer --> FILE * reader
+
+    compressedOpen looks at the first bytes of a file. Plain files are
+    opened as usual; gzip files (and, when built with ZSTD=1, zstd files)
+    are inflated by a thread of their own into two buffers that take
+    turns: while the reader parses one, the thread fills the other. The
+    caller gets an ordinary read-only FILE *, so readCSV and friends need
+    no change, and the decompressed data never touches the disk.
+*/
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stdio.h>
+
+#define DECOMPRESS_BUFFER_BYTES (1 << 20)
+#define DECOMPRESS_INPUT_BYTES (1 << 18)
+
+/* Open `path` for reading, decompressing it on the fly if it is gzip or
+   zstd data. Returns NULL if the file cannot be opened (or is zstd data
+   and zstd support was not built in). fclose stops the thread. */
+FILE *compressedOpen(const char *path);
+
+#endif
@@ -3,16 +3,47 @@
 
 #include <stdio.h>
 #include "record.h"
+#include "intern.h"
+#include "record_blocks.h"
 
 /* --------------------- Constants --------------------- */
 
 #define NUM_FIELDS 35
+#define NOTFOUND "NOTFOUND"
+#define RECORD_CACHE_WAYS 4
+#define RECORD_CACHE_DEFAULT_ROWS 1024
 
 /* --------------------- Forward Declarations --------------------- */
 
-/* A CSV record: all fields are strings */
+/* What the lazy rows of one record store share */
+struct lazyRows {
+    struct internPool *pool;   // owner of the fields parsed on first use
+    int keyField;              // the only field parsed at load time
+    int dedupe[NUM_FIELDS];    // lazy rows: intern column i, else copy it
+    int fd;                    // on-disk rows: the record file, else -1
+    struct recordBlocks *blocks;  // packed rows: the lines, else NULL
+    const long *offsets;       // on-disk and packed rows: row i is the
+                               // bytes [offsets[i], offsets[i + 1]) of
+                               // fd or of the blocks
+    struct data *rows;         // on-disk rows: row 0, to number rows
+    int cacheRows;             // on-disk rows: cached rows per thread
+};
+
+/* A CSV record: all fields are strings. Read them with dataField or
+   dataFields: a lazy row keeps its cleaned fields back to back, and
+   builds the fields array the first time a field other than the key is
+   needed. An on-disk row
+   keeps only its key; its line is read back from the record file into a
+   small per-thread cache whenever another field is needed. A packed row
+   is the same, with its line read from compressed blocks in memory
+   instead of a file. */
 struct data {
-    char **fields;  // must contain exactly NUM_FIELDS entries
+    char **fields;             // NUM_FIELDS entries; NULL for a lazy row
+                               // until it is parsed, and for on-disk rows
+    const char *raw;           // lazy rows: the NUM_FIELDS fields, each
+                               // '\0'-terminated, back to back; else NULL
+    char *key;                 // lazy and on-disk rows: field lazy->keyField
+    struct lazyRows *lazy;     // lazy, on-disk and packed rows only
 };
 
 /* Query result returned from lookup */
@@ -25,6 +56,30 @@ struct queryResult {
     int stringCount;
 };
 
+/* Borrowed view of a lookup answer, filled in without any allocation:
+   records point at the dictionary's own record run (valid while the
+   dictionary is unchanged) and searchString at the caller's query.
+   There is nothing to free. */
+struct resultSpan {
+    const char *searchString;
+    struct data **records;
+    int numRecords;
+    int bitCount;
+    int nodeCount;
+    int stringCount;
+};
+
+/* Page of keys returned by a prefix (autocomplete) search */
+struct prefixResult {
+    char *prefix;
+    int total;          // number of keys starting with prefix
+    int cursor;         // rank of the first key in this page
+    int nextCursor;     // rank of the next page, -1 if this is the last
+    int numKeys;
+    char **keys;        // in lexicographic order
+    int *recordCounts;  // records stored under each key
+};
+
 /* --------------------- Function Prototypes --------------------- */
 
 /* Build a data record from a csvRecord (deep copy of fields) */
@@ -33,6 +88,29 @@ struct data *readRecord(struct csvRecord *record);
 /* Free a data record */
 void freeData(struct data *d);
 
+/* Field i of a record. The first call for a field other than the key of
+   a lazy row parses the row; its values are interned and kept. Any
+   thread may call this. */
+char *dataField(struct data *d, int i);
+
+/* Every field of a record, parsing a lazy row first if needed. For an
+   on-disk row the array belongs to the calling thread's record cache:
+   it stays valid while the thread reads fewer than RECORD_CACHE_WAYS
+   other on-disk rows. */
+char **dataFields(struct data *d);
+
+/* 1 if the strings dataField(d, i) returns live as long as the row, 0 if
+   they are cache entries (non-key fields of on-disk rows). */
+int dataFieldStable(struct data *d, int i);
+
+/* Ask the kernel to read ahead the on-disk rows among records[0..n),
+   which are about to be printed. Does nothing for rows in memory. */
+void dataPrefetch(struct data **records, int n);
+
+/* Free the calling thread's record cache (other threads' caches go when
+   they exit). */
+void dataCacheRelease(void);
+
 /* Free a query result */
 void freeQueryResult(struct queryResult *r);
 
@@ -43,4 +121,40 @@ void printField(FILE *f, struct data *record, int fieldIndex);
 void printQueryResult(struct queryResult *r, char ** headers, FILE *summaryFile,
                       FILE *outputFile);
 
+/* Print a result span, in the same format as printQueryResult */
+void printResultSpan(struct resultSpan *s, char **headers, FILE *summaryFile,
+                     FILE *outputFile);
+
+/* The part of printResultSpan that does not need the records: the
+   summary line, the query line and (if nothing was found) NOTFOUND */
+void printSpanHeader(struct resultSpan *s, FILE *summaryFile,
+                     FILE *outputFile);
+
+/* Summary lines end in " - comparisons: bB nN sS" (the default); with
+   on 0 they stop after the record count. Call before any are printed. */
+void setSummaryCounts(int on);
+
+/* Just the summary line of a span */
+void printSpanSummary(struct resultSpan *s, FILE *summaryFile);
+
+/* The record lines of an output block (everything after the query) */
+void printRecords(struct data **records, int numRecords, char **headers,
+                  FILE *outputFile);
+
+/* An owned queryResult holding a copy of the span */
+struct queryResult *spanToQueryResult(struct resultSpan *s);
+
+/* An empty page (no completions) reported under `prefix` */
+struct prefixResult *newPrefixResult(const char *prefix);
+
+/* Free a prefix search result */
+void freePrefixResult(struct prefixResult *r);
+
+/* Print a prefix search result (summary + completions) */
+void printPrefixResult(struct prefixResult *r, FILE *summaryFile,
+                       FILE *outputFile);
+
+/* Just the summary line of a prefix search result */
+void printPrefixSummary(struct prefixResult *r, FILE *summaryFile);
+
 #endif
@@ -0,0 +1,17 @@
+/*
+    Levenshtein edit distance (insertions, deletions, substitutions).
+*/
+#ifndef EDIT_DISTANCE_H
+#define EDIT_DISTANCE_H
+
+/* Edit distance between str1[0..n) and str2[0..m). */
+int editDistance(char *str1, char *str2, int n, int m);
+
+/* Distance between a[0..n) and b[0..m) counting a swap of two adjacent
+   characters as one edit, like a typist would (optimal string alignment),
+   if it is at most limit; otherwise limit + 1. Only a band of
+   2 * limit + 1 diagonals is computed, and the scan stops as soon as a
+   whole row exceeds limit. */
+int typoDistanceWithin(const char *a, int n, const char *b, int m, int limit);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+    Read-only dictionary over a sorted key array in Eytzinger layout.
+
+    The distinct keys are sorted and stored once; a search array lays
+    them out in breadth-first order (the children of slot k are 2k and
+    2k + 1), so the first levels of every search share a few cache lines
+    and the slots a search may visit four levels further down are
+    prefetched while it compares. Each slot holds the first 8 bytes of
+    its key as a big-endian integer: one integer compare decides most
+    steps, the full key is only compared when the prefixes tie. The
+    search itself has no data-dependent branch other than that tie.
+
+    The search ends at the first key not below the query. On a miss the
+    keys either side of that position (EY_NEIGHBOURS on each side) are the
+    candidates for the closest match, chosen by edit distance. Every key
+    maps to its run of records in file order.
+*/
+#ifndef EYTZINGER_DICT_H
+#define EYTZINGER_DICT_H
+
+#include <stddef.h>
+#include "dict_common.h"
+
+#define EY_NEIGHBOURS 4
+
+struct eyDict;
+
+/* Build from n rows: recs[i] is stored under keys[i]. Keys are copied,
+   records are referenced (they must outlive the dict). */
+struct eyDict *eyDictNew(char **keys, struct data **recs, int n);
+
+/* Fill span with the records of query, or of the closest key if query
+   is not a key. Counts: nodeCount is the slots visited, bitCount the
+   prefix bits compared (64 per slot), stringCount the full key
+   comparisons plus the closest-match candidates. Safe to call from
+   several threads. */
+void eyDictLookupSpan(struct eyDict *d, char *query, struct resultSpan *span);
+
+/* Exact lookup only: returns 1 and fills span if query is a key,
+   otherwise returns 0 with an empty span. */
+int eyDictFindSpan(struct eyDict *d, char *query, struct resultSpan *span);
+
+/* eyDictLookupSpan as an owned queryResult. */
+struct queryResult *eyDictLookup(struct eyDict *d, char *query);
+
+/* Number of distinct keys. */
+int eyDictKeys(struct eyDict *d);
+
+/* Bytes of the key arena, the search array and the record runs. */
+size_t eyDictBytes(struct eyDict *d);
+
+void eyDictFree(struct eyDict *d);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+    String interning pool for CSV field values.
+
+    The pool owns every string it hands out. Interned strings are unique:
+    equal values share one immutable copy, found through an open-addressing
+    hash table. While the data is loaded the table doubles whenever it is
+    3/4 full; once the pool is sealed the table stays put and several
+    threads may intern at once (lock-free).
+    Strings that are not worth deduplicating (e.g. unique keys) can be
+    stored with internCopy, which only places them in the pool's arena.
+    The empty string is never stored and costs zero bytes.
+
+    Returned strings must not be modified or freed; they live until
+    internPoolFree.
+*/
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+#define INTERN_DEFAULT_SLOTS (1 << 16)
+
+struct internPool;
+
+/* Create a pool whose hash table starts with `slots` slots (rounded up to
+   a power of two). Until internPoolSeal the table grows as needed, and
+   only one thread may use the pool. */
+struct internPool *internPoolNew(size_t slots);
+
+/* Stop growing the hash table, so that several threads may intern at
+   once. New values that no longer fit in the 3/4 full table are still
+   stored, but not deduplicated. */
+void internPoolSeal(struct internPool *pool);
+
+/* The shared copy of s[0..len). If isNew is not NULL it is set to 1 when
+   this call added the value to the pool, 0 otherwise. */
+char *internString(struct internPool *pool, const char *s, size_t len,
+                   int *isNew);
+
+/* A private copy of s[0..len) in the pool arena (no deduplication). */
+char *internCopy(struct internPool *pool, const char *s, size_t len);
+
+/* Number of distinct strings in the hash table. */
+size_t internPoolUnique(struct internPool *pool);
+
+/* Bytes of string data (including terminators and entry headers) plus the
+   hash table itself. */
+size_t internPoolBytes(struct internPool *pool);
+
+/* Free the pool and every string it handed out. */
+void internPoolFree(struct internPool *pool);
+
+#endif
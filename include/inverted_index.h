@@ -0,0 +1,51 @@
+/*
+    Free-text search over one or more columns of a record store.
+
+    Every row is tokenized into words (runs of letters and digits,
+    case-folded) and each word gets a compressed posting list of the rows
+    containing it and how often. A query is a list of words; rows
+    containing any of them are ranked by BM25, and the top k are found
+    with WAND: a row is only scored once the score bounds of the words
+    that can still reach it add up to more than the current k-th best,
+    so most postings of common words are skipped.
+
+    Queries:
+        SEARCH:grattan parkville     best matching rows, best first
+*/
+#ifndef INVERTED_INDEX_H
+#define INVERTED_INDEX_H
+
+#include "dict_common.h"
+#include "record_store.h"
+
+#define SEARCH_PREFIX "SEARCH:"
+#define SEARCH_DEFAULT_LIMIT 10
+#define SEARCH_MAX_TERMS 16
+#define SEARCH_MAX_TOKEN 32
+
+struct invertedIndex;
+
+/* Index the words of fields[0..numFields) of every row. */
+struct invertedIndex *invertedIndexNew(struct recordStore *store,
+                                       const int *fields, int numFields);
+
+/* The at most k rows scoring best for the words of text, best first
+   (ties in file order). Words not in the index are ignored. */
+struct queryResult *invertedIndexSearch(struct invertedIndex *ii,
+                                        const char *text, int k);
+
+/* Answer a SEARCH: query with invertedIndexSearch. Returns NULL if
+   `query` does not start with SEARCH_PREFIX, so the caller can route it
+   elsewhere. */
+struct queryResult *invertedIndexQuery(struct invertedIndex *ii, char *query,
+                                       int k);
+
+/* Number of distinct words. */
+int invertedIndexTerms(struct invertedIndex *ii);
+
+/* Bytes used by the vocabulary, posting lists and row lengths. */
+size_t invertedIndexBytes(struct invertedIndex *ii);
+
+void invertedIndexFree(struct invertedIndex *ii);
+
+#endif
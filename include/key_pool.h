@@ -0,0 +1,38 @@
+/*
+    Front-coded, block-compressed pool of sorted keys.
+
+    Keys are grouped in blocks of KEY_POOL_BLOCK_KEYS. The first key of a
+    block is stored whole; each following key is stored as the length of
+    the prefix it shares with the previous key plus the remaining suffix,
+    with frequent words replaced by one-byte codes.
+    Key `id` is decoded by replaying its block up to that key, so only the
+    keys actually needed are ever expanded.
+*/
+#ifndef KEY_POOL_H
+#define KEY_POOL_H
+
+#include <stddef.h>
+
+#define KEY_POOL_BLOCK_KEYS 16
+
+struct keyPool;
+
+/* Build a pool from n keys given in sorted order (the keys are copied). */
+struct keyPool *keyPoolNew(char **sortedKeys, int n);
+
+/* Number of keys in the pool. */
+int keyPoolSize(struct keyPool *pool);
+
+/* Length of the longest key; decode buffers need one byte more. */
+size_t keyPoolMaxLen(struct keyPool *pool);
+
+/* Decode key `id` into buf (at least keyPoolMaxLen + 1 bytes); returns buf.
+   Safe to call from several threads with different buffers. */
+char *keyPoolGet(struct keyPool *pool, int id, char *buf);
+
+/* Bytes used by the encoded keys and the block directory. */
+size_t keyPoolBytes(struct keyPool *pool);
+
+void keyPoolFree(struct keyPool *pool);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef LINKED_LIST_DICT_H
 #define LINKED_LIST_DICT_H
 
+#include <stdio.h>
 #include "dict_common.h"
 #include "record.h"
 
@@ -17,12 +18,25 @@ struct llDict;
 /* Create a new linked list dictionary for a given key field */
 struct llDict *llDictNew(int keyFieldIndex);
 
+/* Keep a Bloom filter (bitsPerKey bits for each of about expectedKeys
+   keys) of the keys inserted from now on, so that lookups of keys not in
+   the dictionary skip the scan. Call on an empty dictionary. */
+void llDictEnableBloom(struct llDict *dict, int expectedKeys, int bitsPerKey);
+
 /* Insert a CSV record into the linked list dictionary */
 void llDictInsert(struct llDict *dict, struct csvRecord *record);
 
 /* Lookup by exact string match on the configured key field */
 struct queryResult *llDictLookup(struct llDict *dict, char *query);
 
+/* Lookups count the bits, nodes and strings compared (the default), or
+   with counting 0 run a specialisation without any counting that leaves
+   the counts 0. Both return the same records. */
+void llDictSetCounting(struct llDict *dict, int counting);
+
+/* One line of filter statistics (nothing if no filter is enabled) */
+void llDictPrintFilterStats(struct llDict *dict, FILE *out);
+
 /* Free entire linked list dictionary */
 void llDictFree(struct llDict *dict);
 
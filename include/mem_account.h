@@ -0,0 +1,51 @@
+/*
+    Memory accounting by subsystem.
+
+    Allocation sites report the bytes they ask for (not what malloc
+    rounds them up to) under one category each; frees report the same
+    amount back. Indexes built in one go report their finished size once.
+    Counters are atomic, so any thread may report. The report lists, per
+    category, the live allocations and bytes, the peak bytes and the
+    bytes per record; the total's peak is the highest sum of all
+    categories at any one time. Then come peak RSS and a projection of
+    the total for a larger dataset.
+*/
+#ifndef MEM_ACCOUNT_H
+#define MEM_ACCOUNT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define MEM_PROJECTION_RECORDS 10000000
+
+enum memCategory {
+    MEM_FIELDS,          // csvRecord field strings, field arrays and rows
+    MEM_DATA,            // struct data copies and the record store
+    MEM_NODES,           // Patricia tree nodes
+    MEM_LEAF_KEYS,       // leaf key copies, composite keys and key pools
+    MEM_RECORD_ARRAYS,   // record pointer arrays of the leaves
+    MEM_QUERY,           // query buffers, pipeline batches, output buffer
+    MEM_SYMSPELL,        // SymSpell deletion indexes
+    MEM_TEXT_INDEXES,    // SEARCH: word and CONTAINS: trigram indexes
+    MEM_SPATIAL,         // k-d tree points
+    MEM_TYPED_COLUMNS,   // packed numeric/date columns for filters
+    MEM_BLOOM,           // Bloom filters of index keys
+    MEM_CATEGORIES
+};
+
+/* Count one allocation of `bytes` under category c. */
+void memAccountAlloc(enum memCategory c, size_t bytes);
+
+/* Count the free of an allocation of `bytes`. */
+void memAccountFree(enum memCategory c, size_t bytes);
+
+/* An allocation of oldBytes grew or shrank to newBytes. */
+void memAccountResize(enum memCategory c, size_t oldBytes, size_t newBytes);
+
+/* Live bytes of category c. */
+long memAccountBytes(enum memCategory c);
+
+/* Print the report; per-record figures divide by `records`. */
+void memAccountPrint(FILE *out, int records);
+
+#endif
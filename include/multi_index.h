@@ -0,0 +1,100 @@
+/*
+    Multiple secondary indexes over one shared record store.
+
+    Each index is a Patricia tree dictionary keyed by one column or by
+    several columns joined with single spaces, and holds only references
+    to rows of the store. Queries choose an index by prefixing its name,
+    e.g. "PFI:422335994" or "POSTCODE+LOCALITY:3052 PARKVILLE"; queries
+    without a known name prefix go to the first declared index.
+    "PREFIX:230 GR" lists the keys of an index that start with "230 GR".
+    With SymSpell enabled, a query that is not a key is answered with the
+    nearest key of the whole index by edit distance (e.g. "320 GRATTAN"
+    finds "230 GRATTAN") before falling back to the tree's closest match.
+    In exact mode a query that is not a key finds nothing; with a Bloom
+    filter over an index's keys, most such queries stop at the filter.
+*/
+#ifndef MULTI_INDEX_H
+#define MULTI_INDEX_H
+
+#include <stdio.h>
+#include "dict_common.h"
+#include "record_store.h"
+
+#define MI_MAX_INDEXES 16
+#define MI_MAX_COLUMNS 8
+#define MI_NAME_SEPARATOR ':'
+#define MI_COLUMN_SEPARATOR '+'
+#define MI_PREFIX_QUERY "PREFIX"
+#define MI_CURSOR_SEPARATOR '@'
+
+struct multiIndex;
+
+/* Create an empty set of indexes over `store`. `headers` names the
+   NUM_FIELDS columns and must outlive the multiIndex. */
+struct multiIndex *multiIndexNew(struct recordStore *store, char **headers);
+
+/* Declare an index over "COLUMN" or "COLUMN+COLUMN+...". The spec is also
+   the index name used in queries. Returns the index number, or -1 if a
+   column is unknown or too many indexes/columns were requested. */
+int multiIndexDeclare(struct multiIndex *mi, const char *spec);
+
+/* Give every index a SymSpell deletion index correcting up to
+   maxDistance edits (1..SYMSPELL_MAX_DISTANCE). Call before building. */
+void multiIndexEnableSymSpell(struct multiIndex *mi, int maxDistance);
+
+/* Give every index a blocked Bloom filter of its keys with bitsPerKey
+   bits per key (1..BLOOM_MAX_BITS_PER_KEY). Only exact lookups consult
+   it. Call before building. */
+void multiIndexEnableBloom(struct multiIndex *mi, int bitsPerKey);
+
+/* on != 0: the filters count probes, rejections and false positives for
+   multiIndexPrintFilterStats (see bloomFilterSetCounting). Call before
+   building. */
+void multiIndexSetBloomStats(struct multiIndex *mi, int on);
+
+/* exact != 0: lookups return only exact matches, with no SymSpell or
+   closest-match fallback. */
+void multiIndexSetExact(struct multiIndex *mi, int exact);
+
+/* counting 0: the trees of every index, declared now or later, use their
+   lookup without comparison counts (see ptDictSetCounting). */
+void multiIndexSetCounting(struct multiIndex *mi, int counting);
+
+/* Build every declared index in one parallel pass using about `threads`
+   threads: one per index, each of which builds its tree with an equal
+   share of the threads (see ptDictInsertAll). Within an index, records
+   keep file order. */
+void multiIndexBuild(struct multiIndex *mi, int threads);
+
+/* Route `query` to the named index (or the default one) and look it up.
+   The result's searchString is the full query as typed. */
+struct queryResult *multiIndexLookup(struct multiIndex *mi, char *query);
+
+/* multiIndexLookup without allocation: the span borrows the index's
+   records and `query` itself. */
+void multiIndexLookupSpan(struct multiIndex *mi, char *query,
+                          struct resultSpan *span);
+
+/* multiIndexLookupSpan as if in exact mode, whatever the mode is. */
+void multiIndexFindSpan(struct multiIndex *mi, char *query,
+                        struct resultSpan *span);
+
+/* Answer an autocomplete query "PREFIX[@cursor]:[NAME:]text": a page of at
+   most `limit` keys of the chosen index starting with text, in order,
+   beginning at rank `cursor` (default 0). Returns NULL if `query` does not
+   start with PREFIX; an empty page if the cursor or separator after it is
+   malformed. */
+struct prefixResult *multiIndexPrefixQuery(struct multiIndex *mi, char *query,
+                                           int limit);
+
+/* One line per index: its keys and the bytes of its key pool and
+   SymSpell index. */
+void multiIndexPrintStats(struct multiIndex *mi, FILE *out);
+
+/* One line per Bloom filter: expected and measured false positive rates. */
+void multiIndexPrintFilterStats(struct multiIndex *mi, FILE *out);
+
+/* Free all indexes (the record store is left untouched). */
+void multiIndexFree(struct multiIndex *mi);
+
+#endif
@@ -0,0 +1,59 @@
+/*
+    Machine-readable output formats for dict2's output file.
+
+        text    the usual "--> HEADER: value || " blocks
+        ndjson  {"fields":[...]} once, then one object per query:
+                {"query":"...","rows":[["value",...],...]}
+        tsv     "query<TAB>FIELD..." once, then one line per row:
+                query<TAB>value...; a query without rows is a line
+                holding only the query
+        binary  "ADB1", u32 field count and the field names once, then
+                per query: the query, u32 row count, u32 values per row
+                and the values
+
+    Strings in the binary format are a u32 byte length and the bytes; all
+    integers are little endian. Rows hold the projected fields of each
+    record, or for a PREFIX: page the completion key and its record count.
+    Tabs, newlines and backslashes in TSV values are written as \t, \n
+    and \\. Everything goes through one large buffer that is written out
+    when it fills, so the output file should not be written to directly
+    while a writer is open.
+*/
+#ifndef OUTPUT_FORMAT_H
+#define OUTPUT_FORMAT_H
+
+#include <stdio.h>
+#include "dict_common.h"
+
+#define OUTPUT_BUFFER_BYTES (1 << 20)
+
+enum outputFormat {
+    OUTPUT_TEXT,
+    OUTPUT_NDJSON,
+    OUTPUT_TSV,
+    OUTPUT_BINARY
+};
+
+struct recordWriter;
+
+/* The format called `name` ("text", "ndjson", "tsv", "binary"), or -1. */
+int outputFormatByName(const char *name);
+
+/* A writer of `format` to `out` printing the numFields columns listed in
+   fields (column numbers into headers, in output order). Headers must
+   outlive the writer. Streams that have one start with their header. */
+struct recordWriter *recordWriterNew(FILE *out, enum outputFormat format,
+                                     char **headers, const int *fields,
+                                     int numFields);
+
+/* Write the answer to `query`: numRecords records (none if not found). */
+void recordWriterRecords(struct recordWriter *w, const char *query,
+                         struct data **records, int numRecords);
+
+/* Write a PREFIX: page. */
+void recordWriterPrefix(struct recordWriter *w, struct prefixResult *r);
+
+/* Write out whatever is buffered and free the writer. */
+void recordWriterFree(struct recordWriter *w);
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "dict_common.h"  // brings NUM_FIELDS, data, queryResult
 #include "record.h"       // brings struct csvRecord
+#include "key_pool.h"
+
+#define PT_MAX_BUILD_THREADS 64
 
 struct ptDict;
 
@@ -12,11 +15,68 @@ struct ptDict *ptDictNew(int keyFieldIndex);
 /* Insert one CSV record (preserve file order for duplicates of the same key). */
 void ptDictInsert(struct ptDict *dict, struct csvRecord *rec);
 
+/* Insert a reference to a record owned elsewhere (e.g. a recordStore) under
+   an explicit key. The key is copied; the record is never freed by the dict.
+   A dictionary holds either copies or references, never both. */
+void ptDictInsertRef(struct ptDict *dict, char *key, struct data *rec);
+
+/* As ptDictInsertRef, but the key is not copied: it must stay valid until
+   ptDictCompactKeys has run or the dict is freed. Don't mix with
+   ptDictInsertRef on one dict. */
+void ptDictInsertBorrowed(struct ptDict *dict, char *key, struct data *rec);
+
+/* Insert recs[0..n) under the borrowed keys[0..n) (as ptDictInsertBorrowed)
+   into an empty dict with `threads` threads. Rows are partitioned by the
+   first two bytes of their key, each thread builds the subtrees of a run
+   of partitions, and the subtrees are then grafted under new branch
+   nodes. The tree, and the order of the records of each key, are the
+   same as inserting the rows one by one. */
+void ptDictInsertAll(struct ptDict *dict, char **keys, struct data **recs,
+                     int n, int threads);
+
 /* Lookup: exact match or “closest” (mismatch node + edit distance).
    Fills comparisons (bitCount/nodeCount/stringCount) inside queryResult.
 */
 struct queryResult *ptDictLookup(struct ptDict *dict, char *query);
 
+/* Like ptDictLookup, but fills a borrowed span pointing at the matching
+   leaf's records; allocates nothing unless the fuzzy fallback runs. */
+void ptDictLookupSpan(struct ptDict *dict, char *query, struct resultSpan *span);
+
+/* Exact lookup only: returns 1 and fills the span if query is a key,
+   otherwise returns 0 with an empty span (no fuzzy fallback). */
+int ptDictFindSpan(struct ptDict *dict, char *query, struct resultSpan *span);
+
+/* Lookups fill the comparison counts (the default), or with counting 0
+   run a specialisation without any counting that leaves them 0. Both
+   return the same records. Not safe while other threads look up. */
+void ptDictSetCounting(struct ptDict *dict, int counting);
+
+/* Prefix search: the keys starting with `prefix`, in lexicographic order,
+   skipping the first `cursor` of them and returning at most `limit`.
+   The total number of matching keys is read from subtree counts. */
+struct prefixResult *ptDictPrefixSearch(struct ptDict *dict, char *prefix,
+                                        int cursor, int limit);
+
+/* Move every leaf key into a front-coded key pool (in key order); leaves
+   stop referring to borrowed key strings, which may then be freed.
+   Lookups decode only the keys they compare, but each one decoded replays
+   its block up to that key, so they are slower than on borrowed keys.
+   Call once the tree is built; later inserts still work. */
+void ptDictCompactKeys(struct ptDict *dict);
+
+/* The key pool made by ptDictCompactKeys, where key id i is the i-th key
+   in order; NULL if the dict was not compacted or has grown since. */
+struct keyPool *ptDictKeyPool(struct ptDict *dict);
+
+/* Number of distinct keys in the dict. */
+int ptDictKeyCount(struct ptDict *dict);
+
+/* Call visit(key, arg) for every distinct key, in key order. The key is
+   only valid during the call. */
+typedef void (*ptKeyFn)(const char *key, void *arg);
+void ptDictForEachKey(struct ptDict *dict, ptKeyFn visit, void *arg);
+
 /* Free everything in the dictt. */
 void ptDictFree(struct ptDict *dict);
 
@@ -0,0 +1,71 @@
+/*
+    Compressed posting lists: ascending row numbers, each with an
+    optional count (e.g. how often a term occurs in the row).
+
+    Rows are cut into blocks of POSTINGS_BLOCK. Within a block rows are
+    stored as varint gaps, followed by the counts as varints; a skip
+    table holds the last row, the byte offset and optionally the largest
+    weight (e.g. score) of every block. A cursor decodes one block at a
+    time, so skipping ahead only touches the blocks it lands in, and
+    block weights can be read without decoding anything.
+*/
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+#define POSTINGS_BLOCK 128
+#define POSTINGS_END INT_MAX
+
+struct postings;
+
+/* Reading position in a posting list. Lives on the caller's stack; the
+   fields are private to postings.c. */
+struct postingsCursor {
+    const struct postings *list;
+    int block;                 // decoded block, -1 before the first
+    int pos;                   // index of row in the decoded block
+    int len;
+    int row;                   // current row, POSTINGS_END when exhausted
+    int blocksDecoded;         // cost counter for the caller's statistics
+    _Alignas(16) int32_t rows[POSTINGS_BLOCK];
+    int32_t counts[POSTINGS_BLOCK];
+};
+
+/* Encode n strictly ascending rows; counts may be NULL (all 1).
+   weights may be NULL; otherwise the skip table keeps an upper bound of
+   the weights of each block. */
+struct postings *postingsEncode(const int *rows, const int *counts,
+                                const double *weights, int n);
+
+/* Number of rows in the list. */
+int postingsSize(const struct postings *list);
+
+/* Bytes used by the encoded rows, counts and skip table. */
+size_t postingsBytes(const struct postings *list);
+
+/* Position c on the first row of list. */
+void postingsOpen(const struct postings *list, struct postingsCursor *c);
+
+/* Move to the next row. */
+void postingsNext(struct postingsCursor *c);
+
+/* Move to the first row >= target (never backwards). The skip table is
+   searched by galloping, then the landing block with vector compares. */
+void postingsAdvance(struct postingsCursor *c, int target);
+
+/* Upper bound of the weights of the block that would hold `row`
+   (>= the current row), and in *blockEnd the last row of that block;
+   0 and POSTINGS_END past the end of the list. Decodes nothing. */
+double postingsBlockBound(struct postingsCursor *c, int row, int *blockEnd);
+
+/* Count stored with the current row. */
+static inline int postingsCount(const struct postingsCursor *c) {
+    return c->counts[c->pos];
+}
+
+void postingsFree(struct postings *list);
+
+#endif
@@ -0,0 +1,38 @@
+/*
+    Staged query pipeline.
+
+        reader --> lookup workers --> writer
+
+    The calling thread reads queries and groups them into batches, which
+    are dealt round-robin to the workers over one SPSC ring each. Every
+    worker answers its batches and passes them to the writer over a
+    second SPSC ring. The writer collects batches in the same round-robin
+    order, so output stays in input order without any reordering.
+    Rings are bounded: a slow writer holds back the workers and a slow
+    reader only idles them, so throughput is set by the slowest stage.
+*/
+#ifndef QUERY_PIPELINE_H
+#define QUERY_PIPELINE_H
+
+#include <stdio.h>
+
+#define PIPELINE_BATCH 64
+#define PIPELINE_RING_BATCHES 8
+#define PIPELINE_MAX_WORKERS 64
+
+/* Answer one query into its answer slot (on a worker thread; must not
+   touch shared state). The query stays valid until it has been emitted. */
+typedef void (*pipelineAnswerFn)(void *context, char *query, void *answer);
+
+/* Print one answer and release whatever it holds (always on a single
+   thread, in input order). */
+typedef void (*pipelineEmitFn)(void *context, char *query, void *answer);
+
+/* Answer and emit every query read from `in` with `workers` lookup
+   threads. Answer slots of answerSize bytes are carved out of each batch,
+   so answering needs no allocation of its own. With 0 workers everything
+   runs on the calling thread. */
+void pipelineRun(FILE *in, int workers, size_t answerSize,
+                 pipelineAnswerFn answer, pipelineEmitFn emit, void *context);
+
+#endif
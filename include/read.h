@@ -9,16 +9,62 @@
 #include <stdio.h>
 
 #include "record.h"
+#include "intern.h"
 
 /* Returns a list of CSV records. */
 struct csvRecord **readCSV(FILE *csvFile, int *n);
 
+/* Like readCSV, but every field string is owned by `pool` (repeated values
+   share one interned copy, empty fields cost nothing). The pool is sealed
+   once the file is read. Records read this way must not be passed to
+   freeCSV; hand them to a recordStore instead. */
+struct csvRecord **readCSVInterned(FILE *csvFile, int *n,
+                                   struct internPool *pool);
+
+/* Decides from the value of one field whether a row is loaded. */
+typedef int (*rowKeepFn)(const char *value, void *arg);
+
+/* Like readCSVInterned, but only rows for which keep(value of field
+   keyField, arg) is true become records; the others are parsed but
+   never copied. */
+struct csvRecord **readCSVFiltered(FILE *csvFile, int *n,
+                                   struct internPool *pool, int keyField,
+                                   rowKeepFn keep, void *arg);
+
+/* Like readCSVInterned, but only field keyField of each row is parsed
+   (csvRecord.key, fields is NULL); the row is kept as its cleaned fields
+   back to back (csvRecord.raw, holding the key) and split on first use
+   once it is in a recordStore (see dataField).
+   dedupe[i] (NUM_FIELDS entries) is set to whether values of column i
+   repeat enough to be interned when the rows are parsed. */
+struct csvRecord **readCSVLazy(FILE *csvFile, int *n,
+                               struct internPool *pool, int keyField,
+                               int *dedupe);
+
+/* Like readCSVLazy, but the lines are not kept in memory: each one is
+   appended to recordFile with its terminating '\0' and csvRecord.offset
+   says where (raw is NULL). Only the keys stay in the pool. */
+struct csvRecord **readCSVOnDisk(FILE *csvFile, int *n,
+                                 struct internPool *pool, int keyField,
+                                 FILE *recordFile);
+
+/* Cut a CSV line (without its newline) into NUM_FIELDS fields in place,
+   removing quoting; fields[i] points into line. */
+void splitLine(char *line, char **fields);
+
+/* Like splitLine, but only field `field` is cleaned; returns it. */
+char *lineField(char *line, int field);
+
 /* Read a line of input from the given file. */
 char *getQuery(FILE *f);
 
+/* Free a query returned by getQuery. */
+void freeQuery(char *query);
+
 /* Read the csv header row from `fp`,
  each dynamically allocated of exact string length. 
--> Return the Array of header strings*/
+-> Return the Array of header strings (NULL if there is no header line;
+ columns past the last one named are NULL)*/
 char **parse_header(FILE *input_file);
 
 /* if any, strip trailing newline/CR (handles \n, \r, \r\n) */
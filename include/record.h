@@ -10,6 +10,11 @@
 struct csvRecord {
     int fieldCount;
     char **fields;
+    char *raw;     // lazy rows (fields NULL): the cleaned fields, each
+                   // '\0'-terminated, back to back
+    char *key;     // lazy rows: the key field (inside raw when in memory)
+    long offset;   // on-disk rows (fields and raw NULL): where the line
+                   // starts in the record file
 };
 #endif
 
@@ -0,0 +1,63 @@
+/*
+    A record store holds every CSV row exactly once as a struct data.
+    Indexes built over the store (see multi_index.h) keep only pointers
+    to its rows, so adding an index never copies record payloads.
+*/
+#ifndef RECORD_STORE_H
+#define RECORD_STORE_H
+
+#include <stdio.h>
+
+#include "dict_common.h"
+#include "record.h"
+#include "intern.h"
+
+struct recordStore;
+
+/* Build a store from a parsed dataset. The store takes over the field
+   strings of every csvRecord; the dataset array and its csvRecord shells
+   are freed, so the caller must not call freeCSV on it afterwards.
+   If the dataset was read with readCSVInterned, pass its pool: the store
+   then owns the pool and frees it instead of the individual strings. */
+struct recordStore *recordStoreNew(struct csvRecord **dataset, int n,
+                                   struct internPool *pool);
+
+/* recordStoreNew for rows read by readCSVLazy with this keyField, pool
+   and dedupe; the fields they parse later are interned into the pool
+   (or only copied into it, for columns dedupe says are mostly unique). */
+struct recordStore *recordStoreNewLazy(struct csvRecord **dataset, int n,
+                                       struct internPool *pool,
+                                       int keyField, const int *dedupe);
+
+/* recordStoreNewLazy for rows read by readCSVOnDisk into recordFile,
+   which the store takes over. Fields other than the key are read back
+   from it into per-thread caches of cacheRows rows. */
+struct recordStore *recordStoreNewOnDisk(struct csvRecord **dataset, int n,
+                                         struct internPool *pool,
+                                         int keyField, FILE *recordFile,
+                                         int cacheRows);
+
+/* recordStoreNewOnDisk, but recordFile is packed into compressed blocks
+   in memory (see record_blocks.h) and closed: fields other than the key
+   are inflated from the block holding their row. */
+struct recordStore *recordStoreNewPacked(struct csvRecord **dataset, int n,
+                                         struct internPool *pool,
+                                         int keyField, FILE *recordFile,
+                                         int cacheRows);
+
+/* The compressed blocks of a packed store, else NULL. */
+struct recordBlocks *recordStoreBlocks(struct recordStore *store);
+
+/* Number of rows held by the store. */
+int recordStoreSize(struct recordStore *store);
+
+/* Row `row` (0-based, file order). */
+struct data *recordStoreGet(struct recordStore *store, int row);
+
+/* File-order row number of a record that belongs to the store. */
+int recordStoreRow(struct recordStore *store, struct data *rec);
+
+/* Free the store and every row in it. */
+void recordStoreFree(struct recordStore *store);
+
+#endif
@@ -0,0 +1,39 @@
+/*
+    Sharded lookups: one router and N shard processes on this machine.
+
+        router --socketpair--> shard 0 .. shard N-1
+
+    Every shard reads the CSV itself, keeps only the rows whose key
+    hashes to it and builds its own Patricia tree over them, so no
+    process holds the whole dataset and the shards load in parallel.
+    The router sends each query to every shard and merges the answers.
+    A key lives on exactly one shard, which answers it exactly. For a
+    closest match, each shard answers with the best key of its own tree;
+    the router keeps the one sharing the most leading bits with the query,
+    then applies the tree's tie-break (smallest edit distance, then the
+    smallest key). That is the key the unsharded tree would pick, since
+    its fallback compares exactly the keys with the longest common prefix.
+*/
+#ifndef SHARD_ROUTER_H
+#define SHARD_ROUTER_H
+
+#include <stdio.h>
+
+#define SHARD_MAX 64
+
+struct shardRouter;
+
+/* Start `shards` shard processes, each loading its part of inputCSV
+   keyed by the column keyColumn. Call before any thread is started. */
+struct shardRouter *shardRouterNew(const char *inputCSV,
+                                   const char *keyColumn, int shards);
+
+/* Look `query` up on every shard and print the merged answer in the
+   usual format. Comparison counts are the sums over all shards. */
+void shardRouterAnswer(struct shardRouter *router, char *query,
+                       FILE *summaryFile, FILE *outputFile);
+
+/* Stop the shards and wait for them to exit. */
+void shardRouterFree(struct shardRouter *router);
+
+#endif
@@ -0,0 +1,49 @@
+/*
+    Spatial index over the x/y columns of a record store.
+
+    Points are kept in a packed (implicit) k-d tree: one array sorted so
+    that the median of every range splits it, alternating x and y by
+    depth, with no child pointers. Distances are planar, in x/y units.
+
+    Queries:
+        NEAR:x,y[,k]              the k nearest addresses (default 1)
+        BOX:minX,minY,maxX,maxY   every address inside the box
+*/
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "dict_common.h"
+#include "record_store.h"
+
+#define SPATIAL_NEAR_PREFIX "NEAR:"
+#define SPATIAL_BOX_PREFIX "BOX:"
+#define SPATIAL_DEFAULT_K 1
+#define SPATIAL_MAX_K 1000
+
+struct spatialIndex;
+
+/* Bulk-load a k-d tree from the xField/yField columns of every row.
+   Rows whose coordinates do not parse as numbers are skipped. */
+struct spatialIndex *spatialIndexNew(struct recordStore *store, int xField,
+                                     int yField);
+
+/* k nearest rows to (x, y), nearest first (ties in file order). */
+struct queryResult *spatialIndexNearest(struct spatialIndex *si, double x,
+                                        double y, int k);
+
+/* Rows inside [minX, maxX] x [minY, maxY], in file order. */
+struct queryResult *spatialIndexBox(struct spatialIndex *si, double minX,
+                                    double minY, double maxX, double maxY);
+
+/* Answer a NEAR:/BOX: query. Returns NULL if `query` is not a spatial
+   query, so the caller can route it elsewhere; one that has the prefix
+   but does not parse (bad numbers, k outside 1..SPATIAL_MAX_K) matches
+   nothing. */
+struct queryResult *spatialIndexQuery(struct spatialIndex *si, char *query);
+
+/* Number of indexed points. */
+int spatialIndexSize(struct spatialIndex *si);
+
+void spatialIndexFree(struct spatialIndex *si);
+
+#endif
@@ -0,0 +1,28 @@
+/*
+    Bounded single-producer / single-consumer ring of pointers.
+
+    Pushing and popping are lock-free: the producer only writes the tail,
+    the consumer only writes the head. A push into a full ring or a pop
+    from an empty one spins briefly and then sleeps until the other side
+    makes progress, which gives backpressure between pipeline stages.
+*/
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stddef.h>
+
+struct spscRing;
+
+/* A ring with room for `capacity` items (rounded up to a power of two). */
+struct spscRing *ringNew(size_t capacity);
+
+/* Append item, waiting while the ring is full. Producer side only. */
+void ringPush(struct spscRing *r, void *item);
+
+/* Remove the oldest item, waiting while the ring is empty.
+   Consumer side only. */
+void *ringPop(struct spscRing *r);
+
+void ringFree(struct spscRing *r);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+    Symmetric deletion index (SymSpell) over the keys of a key pool.
+
+    Every key is indexed under each string obtained by deleting at most
+    maxDistance characters from its first prefixLength characters. Two
+    strings within distance d (insertions, deletions, substitutions and
+    swaps of adjacent characters) share such a deletion with at most d
+    characters deleted from each side, and that still holds for their
+    prefixes, so probing the deletions of a query's prefix finds every key
+    within maxDistance of the query. The candidates are then checked with
+    typoDistanceWithin.
+
+    Deletions are stored only as 64-bit hashes: a collision adds a
+    candidate that verification rejects, it never loses one.
+*/
+#ifndef SYMSPELL_H
+#define SYMSPELL_H
+
+#include <stddef.h>
+#include "key_pool.h"
+
+#define SYMSPELL_MAX_DISTANCE 3
+#define SYMSPELL_PREFIX_LENGTH 7
+#define SYMSPELL_MAX_PREFIX 16
+
+struct symSpell;
+
+/* Index every key of pool (which must outlive the index). maxDistance is
+   1..SYMSPELL_MAX_DISTANCE, prefixLength maxDistance+1..SYMSPELL_MAX_PREFIX. */
+struct symSpell *symSpellNew(struct keyPool *pool, int maxDistance,
+                             int prefixLength);
+
+/* The key nearest to query, if one is within the
+   index's maxDistance; ties go to the smallest key. Writes the key to
+   keyOut (keyPoolMaxLen + 1 bytes) and returns its id, or returns -1.
+   *candidates is set to the number of keys whose distance was computed.
+   Safe to call from several threads. */
+int symSpellCorrect(struct symSpell *ss, const char *query, char *keyOut,
+                    int *candidates);
+
+/* Maximum distance corrected. */
+int symSpellMaxDistance(struct symSpell *ss);
+
+/* Number of distinct deletions indexed. */
+size_t symSpellVariants(struct symSpell *ss);
+
+/* Bytes used by the hash table and the posting lists (not the keys). */
+size_t symSpellBytes(struct symSpell *ss);
+
+void symSpellFree(struct symSpell *ss);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+    Substring search over one or more columns of a record store.
+
+    Every run of three consecutive characters (a trigram, case-folded)
+    of the chosen fields gets a compressed posting list of the rows it
+    occurs in. A row containing the query text contains every trigram of
+    it, so the rows found in all of the query's lists are the only
+    candidates; each candidate is then checked for the text itself.
+    Text shorter than a trigram has no lists and is checked on every row.
+
+    Queries:
+        CONTAINS:SWANSTON      every row containing the text, in file order
+*/
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include "dict_common.h"
+#include "record_store.h"
+
+#define CONTAINS_PREFIX "CONTAINS:"
+#define TRIGRAM_LENGTH 3
+
+struct trigramIndex;
+
+/* Index the trigrams of fields[0..numFields) of every row. */
+struct trigramIndex *trigramIndexNew(struct recordStore *store,
+                                     const int *fields, int numFields);
+
+/* Rows where one of the indexed fields contains text (ignoring case),
+   in file order. */
+struct queryResult *trigramIndexSearch(struct trigramIndex *ti,
+                                       const char *text);
+
+/* Answer a CONTAINS: query. Returns NULL if `query` does not start with
+   CONTAINS_PREFIX, so the caller can route it elsewhere. */
+struct queryResult *trigramIndexQuery(struct trigramIndex *ti, char *query);
+
+/* Number of distinct trigrams. */
+int trigramIndexTrigrams(struct trigramIndex *ti);
+
+/* Bytes used by the trigram table and posting lists. */
+size_t trigramIndexBytes(struct trigramIndex *ti);
+
+void trigramIndexFree(struct trigramIndex *ti);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+    Typed columns over a record store.
+
+    At load time every column whose non-empty values are all integers,
+    all dates (YYYY-MM-DD) or all numbers gets a packed array of values
+    next to its strings: int32 for integers and dates (a date is stored
+    as YYYYMMDD), double otherwise. Empty fields are missing and never
+    match a predicate. Text columns cannot be filtered.
+
+    A filter is a list of space separated predicates COLUMN OP VALUE with
+    OP one of = != < <= > >=, all of which must hold, e.g.
+        POSTCODE=3052 HSE_NUM1>=100 SRC_VERIF>=2024-01-01
+    Predicates are evaluated a block of rows at a time with vector
+    comparisons over the packed arrays.
+
+    Queries:
+        FILTER:predicates          scan every row
+        query | predicates         filter the answer to any other query
+*/
+#ifndef TYPED_COLUMNS_H
+#define TYPED_COLUMNS_H
+
+#include "dict_common.h"
+#include "record_store.h"
+
+#define FILTER_PREFIX "FILTER:"
+#define FILTER_SEPARATOR '|'
+#define FILTER_MAX_PREDICATES 16
+
+struct typedColumns;
+struct rowFilter;
+
+/* Detect the type of every column and build the packed arrays. */
+struct typedColumns *typedColumnsNew(struct recordStore *store,
+                                     char **headers);
+
+/* Number of columns that have a packed array. */
+int typedColumnsCount(struct typedColumns *tc);
+
+/* Parse a list of predicates. Returns NULL if the text is malformed or
+   names a column that is unknown or not typed. */
+struct rowFilter *typedColumnsFilter(struct typedColumns *tc,
+                                     const char *text);
+
+/* Every row matching the filter, in file order. */
+struct queryResult *typedColumnsScan(struct typedColumns *tc,
+                                     struct rowFilter *filter,
+                                     const char *searchString);
+
+/* Drop the records of r (rows of the store) that fail the filter,
+   keeping the order of the rest. */
+void typedColumnsApply(struct typedColumns *tc, struct rowFilter *filter,
+                       struct queryResult *r);
+
+/* Answer a FILTER: query; a malformed filter matches nothing. Returns
+   NULL if `query` does not start with FILTER_PREFIX, so the caller can
+   route it elsewhere. */
+struct queryResult *typedColumnsQuery(struct typedColumns *tc, char *query);
+
+void rowFilterFree(struct rowFilter *filter);
+
+void typedColumnsFree(struct typedColumns *tc);
+
+#endif
@@ -0,0 +1,39 @@
+/*
+    LEB128 varints: 7 bits per byte, low bits first, high bit set on
+    every byte but the last. Shared by the compressed key and posting
+    formats.
+*/
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stddef.h>
+
+#define VARINT_MAX_BYTES 5      // enough for any 32-bit value
+#define VARINT_MORE 0x80
+#define VARINT_BITS 7
+
+/* Append value as a varint, returns bytes written */
+static inline size_t putVarint(unsigned char *out, size_t value) {
+    size_t used = 0;
+    while (value >= VARINT_MORE) {
+        out[used++] = (unsigned char)(value | VARINT_MORE);
+        value >>= VARINT_BITS;
+    }
+    out[used++] = (unsigned char)value;
+    return used;
+}
+
+/* Read a varint, returns bytes consumed */
+static inline size_t getVarint(const unsigned char *in, size_t *value) {
+    size_t used = 0;
+    unsigned int shift = 0;
+    *value = 0;
+    while (in[used] & VARINT_MORE) {
+        *value |= (size_t)(in[used++] & ~VARINT_MORE) << shift;
+        shift += VARINT_BITS;
+    }
+    *value |= (size_t)in[used++] << shift;
+    return used;
+}
+
+#endif
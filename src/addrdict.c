@@ -0,0 +1,222 @@
+/*
+    libaddrdict: opening a dictionary is the load and build half of
+    dict2 (interned or lazy rows in a record store, a multi index over
+    it); a result is a span of the index's records plus a copy of the
+    query, so lookups allocate one small block and copy no rows.
+*/
+#include "addrdict.h"
+#include "dict_common.h"
+#include "record_store.h"
+#include "multi_index.h"
+#include "bloom_filter.h"
+#include "intern.h"
+#include "read.h"
+#include "decompress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#define KEY_HEADER "EZI_ADD"
+
+struct addrDict {
+    char **headers;
+    struct recordStore *store;
+    struct multiIndex *indexes;
+};
+
+struct addrResult {
+    char *query;
+    struct data **records;         // borrowed from the index
+    int numRecords;
+};
+
+/* Helpers */
+static int optionsValid(const struct addrDictOptions *options);
+static int findKeyField(char **headers);
+static int declareIndexes(struct multiIndex *mi,
+                          const struct addrDictOptions *options);
+
+/* helper: 1 if the caller's options are in range */
+static int optionsValid(const struct addrDictOptions *options) {
+    if (options->numIndexes < 0) return 0;
+    if (options->numIndexes > 0 && !options->indexes) return 0;
+    for (int i = 0; i < options->numIndexes; i++) {
+        if (!options->indexes[i]) return 0;
+    }
+    return options->bloomBitsPerKey >= 0 &&
+           options->bloomBitsPerKey <= BLOOM_MAX_BITS_PER_KEY;
+}
+
+/* helper: the EZI_ADD column; -1 if it is missing or the header names
+   fewer than NUM_FIELDS columns */
+static int findKeyField(char **headers) {
+    int keyField = -1;
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (!headers[i]) return -1;
+        if (strcmp(headers[i], KEY_HEADER) == 0) keyField = i;
+    }
+    return keyField;
+}
+
+/* helper: EZI_ADD first, then the extra indexes; 0 if one is unknown */
+static int declareIndexes(struct multiIndex *mi,
+                          const struct addrDictOptions *options) {
+    if (multiIndexDeclare(mi, KEY_HEADER) < 0) return 0;
+    for (int i = 0; i < options->numIndexes; i++) {
+        if (multiIndexDeclare(mi, options->indexes[i]) < 0) return 0;
+    }
+    return 1;
+}
+
+void addrDictDefaultOptions(struct addrDictOptions *options) {
+    assert(options);
+    options->indexes = NULL;
+    options->numIndexes = 0;
+    options->lazy = 0;
+    options->bloomBitsPerKey = 0;
+    options->buildThreads = 0;
+}
+
+struct addrDict *addrDictOpen(const char *csvPath,
+                              const struct addrDictOptions *options) {
+    struct addrDictOptions defaults;
+    if (!options) {
+        addrDictDefaultOptions(&defaults);
+        options = &defaults;
+    }
+    if (!csvPath || !optionsValid(options)) return NULL;
+    FILE *input = compressedOpen(csvPath);
+    if (!input) return NULL;
+
+    char **headers = parse_header(input);
+    int keyField = headers ? findKeyField(headers) : -1;
+    if (keyField < 0) {
+        if (headers) freeHeader(headers, NUM_FIELDS);
+        fclose(input);
+        return NULL;
+    }
+
+    struct internPool *pool = internPoolNew(INTERN_DEFAULT_SLOTS);
+    int n = 0;
+    struct recordStore *store = NULL;
+    if (options->lazy) {
+        int dedupe[NUM_FIELDS];
+        struct csvRecord **dataset = readCSVLazy(input, &n, pool, keyField,
+                                                 dedupe);
+        store = recordStoreNewLazy(dataset, n, pool, keyField, dedupe);
+    } else {
+        struct csvRecord **dataset = readCSVInterned(input, &n, pool);
+        store = recordStoreNew(dataset, n, pool);
+    }
+    fclose(input);
+
+    // Results carry no comparison counts, so the trees keep none
+    struct multiIndex *indexes = multiIndexNew(store, headers);
+    multiIndexSetCounting(indexes, 0);
+    if (!declareIndexes(indexes, options)) {
+        multiIndexFree(indexes);
+        recordStoreFree(store);
+        freeHeader(headers, NUM_FIELDS);
+        return NULL;
+    }
+    if (options->bloomBitsPerKey > 0) {
+        multiIndexEnableBloom(indexes, options->bloomBitsPerKey);
+    }
+    int threads = options->buildThreads;
+    if (threads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int)online : 1;
+    }
+    multiIndexBuild(indexes, threads);
+
+    struct addrDict *d = malloc(sizeof(*d));
+    assert(d);
+    d->headers = headers;
+    d->store = store;
+    d->indexes = indexes;
+    return d;
+}
+
+int addrDictSize(struct addrDict *d) {
+    assert(d);
+    return recordStoreSize(d->store);
+}
+
+int addrDictNumFields(struct addrDict *d) {
+    assert(d);
+    return NUM_FIELDS;
+}
+
+const char *addrDictFieldName(struct addrDict *d, int field) {
+    assert(d && field >= 0 && field < NUM_FIELDS);
+    return d->headers[field];
+}
+
+int addrDictFieldIndex(struct addrDict *d, const char *name) {
+    assert(d && name);
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (strcmp(d->headers[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+struct addrResult *addrDictLookup(struct addrDict *d, const char *query,
+                                  enum addrDictMode mode) {
+    assert(d && query);
+    struct addrResult *r = malloc(sizeof(*r));
+    assert(r);
+    r->query = strdup(query);
+    assert(r->query);
+    // The index only reads the query; the copy is what it is handed
+    struct resultSpan span;
+    if (mode == ADDRDICT_EXACT) {
+        multiIndexFindSpan(d->indexes, r->query, &span);
+    } else {
+        multiIndexLookupSpan(d->indexes, r->query, &span);
+    }
+    r->records = span.records;
+    r->numRecords = span.numRecords;
+    return r;
+}
+
+void addrDictLookupBatch(struct addrDict *d, const char *const *queries,
+                         int n, enum addrDictMode mode,
+                         struct addrResult **results) {
+    assert(d && (n == 0 || (queries && results)));
+    for (int i = 0; i < n; i++) {
+        results[i] = addrDictLookup(d, queries[i], mode);
+    }
+}
+
+const char *addrResultQuery(struct addrResult *r) {
+    assert(r);
+    return r->query;
+}
+
+int addrResultCount(struct addrResult *r) {
+    assert(r);
+    return r->numRecords;
+}
+
+const char *addrResultField(struct addrResult *r, int row, int field) {
+    assert(r && row >= 0 && row < r->numRecords);
+    assert(field >= 0 && field < NUM_FIELDS);
+    return dataField(r->records[row], field);
+}
+
+void addrResultFree(struct addrResult *r) {
+    if (!r) return;
+    free(r->query);
+    free(r);
+}
+
+void addrDictClose(struct addrDict *d) {
+    if (!d) return;
+    multiIndexFree(d->indexes);
+    recordStoreFree(d->store);
+    freeHeader(d->headers, NUM_FIELDS);
+    free(d);
+}
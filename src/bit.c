@@ -50,6 +50,25 @@ int bit_compare(char *str1, char *str2) {
     return count;
 }
  
+/* index of the first bit where two strings differ, or the bit length of a
+   (with its null terminator) if they are equal; compares a byte at a time */
+unsigned int firstBitDifference(const char *a, const char *b){
+    assert(a && b);
+    unsigned int byte = 0;
+    while (a[byte] == b[byte]) {
+        if (a[byte] == '\0') {
+            return (byte + 1) * BITS_PER_BYTE;
+        }
+        byte++;
+    }
+    unsigned int diff = (unsigned char)(a[byte] ^ b[byte]);
+    unsigned int bit = 0;
+    while (!(diff & (1 << (BITS_PER_BYTE - 1 - bit)))) {
+        bit++;
+    }
+    return byte * BITS_PER_BYTE + bit;
+}
+
 /* Allocates new memory to hold the numBits specified and fills the allocated
     memory with the numBits specified starting from the startBit of the oldKey
     array of bytes. */
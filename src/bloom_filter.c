@@ -0,0 +1,183 @@
+/*
+    Blocked Bloom filter: the high half of a key's 64-bit hash picks the
+    block, the low half gives a start bit and an odd stride, and the k
+    probed bits are start, start + stride, ... modulo the block's 512
+    bits (all distinct, since the stride is odd).
+*/
+#include "bloom_filter.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <assert.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define BLOCK_BITS (BLOOM_BLOCK_BYTES * 8)
+#define BLOCK_WORDS (BLOOM_BLOCK_BYTES / 8)
+#define MAX_PROBES 16
+#define LOAD_TAIL 16            // expected-rate sum stops this many sigmas out
+
+struct bloomFilter {
+    uint64_t *words;            // numBlocks * BLOCK_WORDS, 64-byte aligned
+    uint64_t numBlocks;
+    int probes;                 // k: bits per key
+    int bitsPerKey;
+    long added;
+    int counting;               // probes update the counters below
+    atomic_long probed;
+    atomic_long rejected;
+    atomic_long falsePositives;
+};
+
+/* Helpers */
+static uint64_t hashKey(const char *key);
+static uint64_t *keyBlock(struct bloomFilter *f, uint64_t h);
+static double expectedRate(struct bloomFilter *f);
+
+/* helper: FNV-1a of key, finished with a multiply-xorshift so the high
+   and low halves both depend on every byte */
+static uint64_t hashKey(const char *key) {
+    uint64_t h = FNV_OFFSET;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h ^= *p;
+        h *= FNV_PRIME;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* helper: the block of hash h (multiply-shift instead of a modulo) */
+static uint64_t *keyBlock(struct bloomFilter *f, uint64_t h) {
+    uint64_t block = ((h >> 32) * f->numBlocks) >> 32;
+    return f->words + block * BLOCK_WORDS;
+}
+
+/* helper: false positive rate for the keys added so far. The keys per
+   block are Poisson distributed; a block holding j keys has each bit set
+   with probability 1 - (1 - 1/512)^(jk). */
+static double expectedRate(struct bloomFilter *f) {
+    double mean = (double)f->added / (double)f->numBlocks;
+    int last = (int)(mean + LOAD_TAIL * sqrt(mean + 1)) + 1;
+    double p = exp(-mean);   // P(j keys), starting at j = 0
+    double rate = 0;
+    for (int j = 0; j <= last; j++) {
+        if (j > 0) p *= mean / j;
+        double bitSet = 1 - pow(1 - 1.0 / BLOCK_BITS, (double)j * f->probes);
+        rate += p * pow(bitSet, f->probes);
+    }
+    return rate;
+}
+
+struct bloomFilter *bloomFilterNew(int expectedKeys, int bitsPerKey) {
+    assert(expectedKeys >= 0 && bitsPerKey >= 1 &&
+           bitsPerKey <= BLOOM_MAX_BITS_PER_KEY);
+    struct bloomFilter *f = malloc(sizeof(*f));
+    assert(f);
+    uint64_t bits = (uint64_t)expectedKeys * (uint64_t)bitsPerKey;
+    f->numBlocks = (bits + BLOCK_BITS - 1) / BLOCK_BITS;
+    if (f->numBlocks == 0) f->numBlocks = 1;
+    f->words = aligned_alloc(BLOOM_BLOCK_BYTES,
+                             f->numBlocks * BLOOM_BLOCK_BYTES);
+    assert(f->words);
+    memset(f->words, 0, f->numBlocks * BLOOM_BLOCK_BYTES);
+
+    // k = b ln 2 minimises the false positives of a plain Bloom filter
+    int probes = (int)lround(bitsPerKey * M_LN2);
+    f->probes = probes < 1 ? 1 : probes > MAX_PROBES ? MAX_PROBES : probes;
+    f->bitsPerKey = bitsPerKey;
+    f->added = 0;
+    f->counting = 0;
+    atomic_init(&f->probed, 0);
+    atomic_init(&f->rejected, 0);
+    atomic_init(&f->falsePositives, 0);
+    memAccountAlloc(MEM_BLOOM, sizeof(*f) + bloomFilterBytes(f));
+    return f;
+}
+
+void bloomFilterAdd(struct bloomFilter *f, const char *key) {
+    assert(f && key);
+    uint64_t h = hashKey(key);
+    uint64_t *block = keyBlock(f, h);
+    uint32_t bit = (uint32_t)h;
+    uint32_t stride = (bit >> 9) | 1;
+    for (int i = 0; i < f->probes; i++, bit += stride) {
+        uint32_t b = bit % BLOCK_BITS;
+        block[b / 64] |= 1ULL << (b % 64);
+    }
+    f->added++;
+}
+
+int bloomFilterMayContain(struct bloomFilter *f, const char *key) {
+    assert(f && key);
+    if (f->counting) {
+        atomic_fetch_add_explicit(&f->probed, 1, memory_order_relaxed);
+    }
+    uint64_t h = hashKey(key);
+    uint64_t *block = keyBlock(f, h);
+    uint32_t bit = (uint32_t)h;
+    uint32_t stride = (bit >> 9) | 1;
+    for (int i = 0; i < f->probes; i++, bit += stride) {
+        uint32_t b = bit % BLOCK_BITS;
+        if (!(block[b / 64] & (1ULL << (b % 64)))) {
+            if (f->counting) {
+                atomic_fetch_add_explicit(&f->rejected, 1,
+                                          memory_order_relaxed);
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void bloomFilterMissed(struct bloomFilter *f) {
+    assert(f);
+    if (f->counting) {
+        atomic_fetch_add_explicit(&f->falsePositives, 1, memory_order_relaxed);
+    }
+}
+
+void bloomFilterSetCounting(struct bloomFilter *f, int counting) {
+    assert(f);
+    f->counting = counting;
+}
+
+size_t bloomFilterBytes(struct bloomFilter *f) {
+    assert(f);
+    return (size_t)f->numBlocks * BLOOM_BLOCK_BYTES;
+}
+
+void bloomFilterPrintStats(struct bloomFilter *f, const char *name, FILE *out) {
+    assert(f && name && out);
+    long probed = atomic_load(&f->probed);
+    long rejected = atomic_load(&f->rejected);
+    long falsePositives = atomic_load(&f->falsePositives);
+    if (!f->counting) {
+        fprintf(out, "bloom %s: %ld keys, %zu bytes, %d bits/key, k=%d, "
+                     "expected fp %.3f%%; probes not counted\n",
+                name, f->added, bloomFilterBytes(f), f->bitsPerKey, f->probes,
+                100 * expectedRate(f));
+        return;
+    }
+    // Measured over the probes of non-keys only: rejected or let through
+    long misses = rejected + falsePositives;
+    fprintf(out, "bloom %s: %ld keys, %zu bytes, %d bits/key, k=%d, "
+                 "expected fp %.3f%%; %ld probes, %ld rejected, "
+                 "%ld false positives (%.3f%% of misses)\n",
+            name, f->added, bloomFilterBytes(f), f->bitsPerKey, f->probes,
+            100 * expectedRate(f), probed, rejected, falsePositives,
+            misses > 0 ? 100.0 * falsePositives / misses : 0.0);
+}
+
+void bloomFilterFree(struct bloomFilter *f) {
+    if (!f) return;
+    memAccountFree(MEM_BLOOM, sizeof(*f) + bloomFilterBytes(f));
+    free(f->words);
+    free(f);
+}
@@ -0,0 +1,261 @@
+/*
+    Decompressing reader: a producer thread inflates the input into two
+    buffers that it hands over in turn; the FILE * returned to the caller
+    is a stdio cookie stream whose read function drains them.
+    A buffer marked full belongs to the reader until the reader has
+    emptied it; one that is not full belongs to the producer.
+*/
+#define _GNU_SOURCE
+#include "decompress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define MAGIC_BYTES 4
+#define GZIP_WINDOW_BITS (15 + 16)   // gzip framing, largest window
+
+enum inputKind {
+    INPUT_PLAIN,
+    INPUT_GZIP,
+    INPUT_ZSTD
+};
+
+struct inflater {
+    FILE *in;
+    enum inputKind kind;
+    unsigned char *input;            // compressed bytes read from `in`
+    z_stream gz;
+    int inMember;                    // gzip: inside an unfinished member
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+    ZSTD_inBuffer zin;
+    size_t frameLeft;                // zstd: nonzero inside a frame
+#endif
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char *bufs[2];
+    size_t lens[2];
+    int full[2];
+    int done;                        // no buffer will be filled any more
+    int stop;                        // the reader closed the stream
+
+    int reading;                     // buffer the reader drains
+    size_t offset;                   // read position in it
+};
+
+/* Helpers */
+static enum inputKind inputKind(FILE *in);
+static size_t gzipFill(struct inflater *z, char *out, size_t cap);
+#ifdef HAVE_ZSTD
+static size_t zstdFill(struct inflater *z, char *out, size_t cap);
+#endif
+static void *producerThread(void *arg);
+static ssize_t cookieRead(void *cookie, char *buf, size_t size);
+static int cookieClose(void *cookie);
+
+/* helper: what the first bytes of a file say it holds; rewinds it */
+static enum inputKind inputKind(FILE *in) {
+    unsigned char magic[MAGIC_BYTES] = {0};
+    size_t got = fread(magic, 1, MAGIC_BYTES, in);
+    rewind(in);
+    if (got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return INPUT_GZIP;
+    if (got == MAGIC_BYTES && magic[0] == 0x28 && magic[1] == 0xb5 &&
+        magic[2] == 0x2f && magic[3] == 0xfd) {
+        return INPUT_ZSTD;
+    }
+    return INPUT_PLAIN;
+}
+
+/* helper: inflate up to cap bytes of gzip data (any number of
+   concatenated members); 0 at the end of the input */
+static size_t gzipFill(struct inflater *z, char *out, size_t cap) {
+    z->gz.next_out = (unsigned char *)out;
+    z->gz.avail_out = (uInt)cap;
+    while (z->gz.avail_out > 0) {
+        if (z->gz.avail_in == 0) {
+            size_t got = fread(z->input, 1, DECOMPRESS_INPUT_BYTES, z->in);
+            if (got == 0) {
+                assert(!z->inMember);   // truncated gzip input
+                break;
+            }
+            z->gz.next_in = z->input;
+            z->gz.avail_in = (uInt)got;
+        }
+        z->inMember = 1;
+        int ret = inflate(&z->gz, Z_NO_FLUSH);
+        assert(ret == Z_OK || ret == Z_STREAM_END);
+        if (ret == Z_STREAM_END) {
+            // The next member, if any, starts right after this one
+            z->inMember = 0;
+            ret = inflateReset(&z->gz);
+            assert(ret == Z_OK);
+        }
+    }
+    return cap - z->gz.avail_out;
+}
+
+#ifdef HAVE_ZSTD
+/* helper: decompress up to cap bytes of zstd frames; 0 at the end */
+static size_t zstdFill(struct inflater *z, char *out, size_t cap) {
+    ZSTD_outBuffer zout = {out, cap, 0};
+    while (zout.pos < zout.size) {
+        if (z->zin.pos == z->zin.size) {
+            size_t got = fread(z->input, 1, DECOMPRESS_INPUT_BYTES, z->in);
+            if (got == 0) {
+                assert(z->frameLeft == 0);   // truncated zstd input
+                break;
+            }
+            z->zin.src = z->input;
+            z->zin.size = got;
+            z->zin.pos = 0;
+        }
+        z->frameLeft = ZSTD_decompressStream(z->zstd, &zout, &z->zin);
+        assert(!ZSTD_isError(z->frameLeft));
+    }
+    return zout.pos;
+}
+#endif
+
+/* Producer: fill the buffers in turn until the input ends or the
+   reader goes away */
+static void *producerThread(void *arg) {
+    struct inflater *z = arg;
+    for (int b = 0;; b ^= 1) {
+        pthread_mutex_lock(&z->lock);
+        while (z->full[b] && !z->stop) {
+            pthread_cond_wait(&z->changed, &z->lock);
+        }
+        int stop = z->stop;
+        pthread_mutex_unlock(&z->lock);
+        if (stop) break;
+
+        size_t len = 0;
+#ifdef HAVE_ZSTD
+        if (z->kind == INPUT_ZSTD) {
+            len = zstdFill(z, z->bufs[b], DECOMPRESS_BUFFER_BYTES);
+        }
+#endif
+        if (z->kind == INPUT_GZIP) {
+            len = gzipFill(z, z->bufs[b], DECOMPRESS_BUFFER_BYTES);
+        }
+        if (len == 0) break;
+
+        pthread_mutex_lock(&z->lock);
+        z->lens[b] = len;
+        z->full[b] = 1;
+        pthread_cond_broadcast(&z->changed);
+        pthread_mutex_unlock(&z->lock);
+    }
+    pthread_mutex_lock(&z->lock);
+    z->done = 1;
+    pthread_cond_broadcast(&z->changed);
+    pthread_mutex_unlock(&z->lock);
+    return NULL;
+}
+
+/* Reader side of the cookie stream: copy out of the current buffer,
+   handing it back once it is empty */
+static ssize_t cookieRead(void *cookie, char *buf, size_t size) {
+    struct inflater *z = cookie;
+    pthread_mutex_lock(&z->lock);
+    while (1) {
+        int b = z->reading;
+        if (z->full[b] && z->offset < z->lens[b]) break;
+        if (z->full[b]) {
+            z->full[b] = 0;
+            z->offset = 0;
+            z->reading ^= 1;
+            pthread_cond_broadcast(&z->changed);
+        } else if (z->done) {
+            pthread_mutex_unlock(&z->lock);
+            return 0;
+        } else {
+            pthread_cond_wait(&z->changed, &z->lock);
+        }
+    }
+    pthread_mutex_unlock(&z->lock);
+
+    // The full buffer is the reader's own until it is handed back
+    int b = z->reading;
+    size_t n = z->lens[b] - z->offset;
+    if (n > size) n = size;
+    memcpy(buf, z->bufs[b] + z->offset, n);
+    z->offset += n;
+    return (ssize_t)n;
+}
+
+static int cookieClose(void *cookie) {
+    struct inflater *z = cookie;
+    pthread_mutex_lock(&z->lock);
+    z->stop = 1;
+    pthread_cond_broadcast(&z->changed);
+    pthread_mutex_unlock(&z->lock);
+    pthread_join(z->thread, NULL);
+
+    if (z->kind == INPUT_GZIP) inflateEnd(&z->gz);
+#ifdef HAVE_ZSTD
+    if (z->kind == INPUT_ZSTD) ZSTD_freeDStream(z->zstd);
+#endif
+    pthread_cond_destroy(&z->changed);
+    pthread_mutex_destroy(&z->lock);
+    free(z->bufs[0]);
+    free(z->bufs[1]);
+    free(z->input);
+    int err = fclose(z->in);
+    free(z);
+    return err;
+}
+
+FILE *compressedOpen(const char *path) {
+    assert(path);
+    FILE *in = fopen(path, "r");
+    if (!in) return NULL;
+    enum inputKind kind = inputKind(in);
+    if (kind == INPUT_PLAIN) return in;
+#ifndef HAVE_ZSTD
+    if (kind == INPUT_ZSTD) {
+        fprintf(stderr, "%s: zstd input needs a build with ZSTD=1.\n", path);
+        fclose(in);
+        return NULL;
+    }
+#endif
+
+    struct inflater *z = calloc(1, sizeof(*z));
+    assert(z);
+    z->in = in;
+    z->kind = kind;
+    z->input = malloc(DECOMPRESS_INPUT_BYTES);
+    z->bufs[0] = malloc(DECOMPRESS_BUFFER_BYTES);
+    z->bufs[1] = malloc(DECOMPRESS_BUFFER_BYTES);
+    assert(z->input && z->bufs[0] && z->bufs[1]);
+    if (kind == INPUT_GZIP) {
+        int ret = inflateInit2(&z->gz, GZIP_WINDOW_BITS);
+        assert(ret == Z_OK);
+    }
+#ifdef HAVE_ZSTD
+    if (kind == INPUT_ZSTD) {
+        z->zstd = ZSTD_createDStream();
+        assert(z->zstd);
+        size_t ret = ZSTD_initDStream(z->zstd);
+        assert(!ZSTD_isError(ret));
+    }
+#endif
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->changed, NULL);
+    int err = pthread_create(&z->thread, NULL, producerThread, z);
+    assert(err == 0);
+
+    cookie_io_functions_t io = {cookieRead, NULL, NULL, cookieClose};
+    FILE *stream = fopencookie(z, "r", io);
+    assert(stream);
+    return stream;
+}
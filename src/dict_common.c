@@ -11,32 +11,48 @@
 #include "dict_common.h"
 #include "bit.h"
 #include "record.h"
+#include "read.h"
+#include "mem_account.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #define NUM_FIELDS 35
-#define NOTFOUND "NOTFOUND"
 
-/* --------------------- Data Structures --------------------- */
-
-/* A CSV record: all fields are strings */
-struct data {
-    char **fields;  // must contain exactly NUM_FIELDS entries
+/* One row of a thread's record cache */
+struct cachedRow {
+    struct data *row;          // NULL while the slot is free
+    unsigned long used;        // LRU stamp
+    char *line;                // the row's line, cut into fields in place
+    size_t cap;
+    char *fields[NUM_FIELDS];
 };
 
-/* Query result returned from lookup */
-struct queryResult {
-    char *searchString;
-    int numRecords;
-    struct data **records;
-    int bitCount;
-    int nodeCount;
-    int stringCount;
+/* A thread's cache of on-disk rows: sets of RECORD_CACHE_WAYS slots,
+   least recently used slot of a set replaced first */
+struct recordCache {
+    int sets;
+    unsigned long clock;
+    struct cachedRow *last;    // printing reads one row many times
+    struct cachedRow slots[];
 };
 
+static int summaryCounts = 1;   // summary lines end in the comparison counts
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+
+/* Helpers */
+static char **parseLazyFields(struct data *d);
+static void createCacheKey(void);
+static void freeRecordCache(void *arg);
+static void readRow(struct lazyRows *lazy, int row, struct cachedRow *slot);
+static char **cachedFields(struct data *d);
+
 /* --------------------- Record Utilities --------------------- */
 
 /* Build a data record from a csvRecord */
@@ -47,20 +63,198 @@ struct data *readRecord(struct csvRecord *record) {
 
     ret->fields = malloc(sizeof(char *) * NUM_FIELDS);
     assert(ret->fields);
+    memAccountAlloc(MEM_DATA, sizeof(struct data));
+    memAccountAlloc(MEM_DATA, sizeof(char *) * NUM_FIELDS);
 
     for (int i = 0; i < NUM_FIELDS; i++) {
         ret->fields[i] = strdup(record->fields[i]);
         assert(ret->fields[i]);
+        memAccountAlloc(MEM_DATA, strlen(ret->fields[i]) + 1);
     }
+    ret->raw = NULL;
+    ret->key = NULL;
+    ret->lazy = NULL;
     return ret;
 }
 
+/* helper: parse a lazy row into a complete fields array and publish it.
+   Columns the load found mostly unique point into the row's cleaned
+   fields, the others are interned. Two threads may parse the same row at
+   once; the first to publish wins and the other's array is dropped.
+   A published array never changes. */
+static char **parseLazyFields(struct data *d) {
+    const char *values[NUM_FIELDS];
+    const char *value = d->raw;
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        values[i] = value;
+        value += strlen(value) + 1;
+    }
+
+    char **fresh = malloc(sizeof(char *) * NUM_FIELDS);
+    assert(fresh);
+    memAccountAlloc(MEM_FIELDS, sizeof(char *) * NUM_FIELDS);
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        size_t fieldLen = strlen(values[i]);
+        if (i == d->lazy->keyField) {
+            fresh[i] = d->key;
+        } else if (d->lazy->dedupe[i]) {
+            fresh[i] = internString(d->lazy->pool, values[i], fieldLen, NULL);
+        } else {
+            fresh[i] = (char *)values[i];  // the row's own copy, never freed
+        }
+    }
+    char **fields = NULL;
+    if (__atomic_compare_exchange_n(&d->fields, &fields, fresh, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return fresh;
+    }
+    memAccountFree(MEM_FIELDS, sizeof(char *) * NUM_FIELDS);
+    free(fresh);
+    return fields;
+}
+
+static void createCacheKey(void) {
+    int err = pthread_key_create(&cacheKey, freeRecordCache);
+    assert(err == 0);
+}
+
+/* helper: free a record cache (also run for each thread as it exits) */
+static void freeRecordCache(void *arg) {
+    struct recordCache *cache = arg;
+    if (!cache) return;
+    int slots = cache->sets * RECORD_CACHE_WAYS;
+    for (int i = 0; i < slots; i++) {
+        if (!cache->slots[i].line) continue;
+        memAccountFree(MEM_DATA, cache->slots[i].cap);
+        free(cache->slots[i].line);
+    }
+    memAccountFree(MEM_DATA,
+                   sizeof(*cache) + slots * sizeof(struct cachedRow));
+    free(cache);
+}
+
+/* helper: read an on-disk (or packed) row into a cache slot and cut it
+   into fields */
+static void readRow(struct lazyRows *lazy, int row, struct cachedRow *slot) {
+    long start = lazy->offsets[row];
+    size_t len = (size_t)(lazy->offsets[row + 1] - start);  // with its '\0'
+    if (len > slot->cap) {
+        if (slot->line) {
+            memAccountResize(MEM_DATA, slot->cap, len);
+        } else {
+            memAccountAlloc(MEM_DATA, len);
+        }
+        slot->line = realloc(slot->line, len);
+        assert(slot->line);
+        slot->cap = len;
+    }
+    if (lazy->blocks) {
+        recordBlocksRead(lazy->blocks, start, len, slot->line);
+    }
+    size_t done = lazy->blocks ? len : 0;
+    while (done < len) {
+        ssize_t got = pread(lazy->fd, slot->line + done, len - done,
+                            start + (long)done);
+        assert(got > 0);
+        done += (size_t)got;
+    }
+    assert(slot->line[len - 1] == '\0');
+    splitLine(slot->line, slot->fields);
+}
+
+/* helper: the fields of an on-disk row, from this thread's cache */
+static char **cachedFields(struct data *d) {
+    pthread_once(&cacheKeyOnce, createCacheKey);
+    struct recordCache *cache = pthread_getspecific(cacheKey);
+    if (cache && cache->last && cache->last->row == d) {
+        return cache->last->fields;
+    }
+    if (!cache) {
+        int sets = d->lazy->cacheRows / RECORD_CACHE_WAYS;
+        if (sets < 1) sets = 1;
+        size_t bytes = sizeof(*cache) +
+                       sets * RECORD_CACHE_WAYS * sizeof(struct cachedRow);
+        cache = calloc(1, bytes);
+        assert(cache);
+        memAccountAlloc(MEM_DATA, bytes);
+        cache->sets = sets;
+        pthread_setspecific(cacheKey, cache);
+    }
+
+    int row = (int)(d - d->lazy->rows);
+    struct cachedRow *set = &cache->slots[(row % cache->sets) *
+                                          RECORD_CACHE_WAYS];
+    struct cachedRow *victim = &set[0];
+    for (int w = 0; w < RECORD_CACHE_WAYS; w++) {
+        if (set[w].row == d) {
+            set[w].used = ++cache->clock;
+            cache->last = &set[w];
+            return set[w].fields;
+        }
+        if (set[w].used < victim->used) victim = &set[w];
+    }
+    readRow(d->lazy, row, victim);
+    victim->row = d;
+    victim->used = ++cache->clock;
+    cache->last = victim;
+    return victim->fields;
+}
+
+char *dataField(struct data *d, int i) {
+    assert(d && i >= 0 && i < NUM_FIELDS);
+    if (!d->lazy) return d->fields[i];
+    if (i == d->lazy->keyField) return d->key;
+    return dataFields(d)[i];
+}
+
+char **dataFields(struct data *d) {
+    assert(d);
+    if (!d->lazy) return d->fields;
+    if (!d->raw) return cachedFields(d);
+    char **fields = __atomic_load_n(&d->fields, __ATOMIC_ACQUIRE);
+    return fields ? fields : parseLazyFields(d);
+}
+
+int dataFieldStable(struct data *d, int i) {
+    assert(d && i >= 0 && i < NUM_FIELDS);
+    return !d->lazy || d->raw || i == d->lazy->keyField;
+}
+
+void dataPrefetch(struct data **records, int n) {
+    if (n < 2) return;     // a single row is read right away anyway
+    for (int i = 0; i < n; i++) {
+        struct data *d = records[i];
+        if (!d->lazy || d->raw || d->lazy->fd < 0) continue;
+        struct lazyRows *lazy = d->lazy;
+        int first = (int)(d - lazy->rows), last = first;
+        // One request for a run of rows that follow each other in the file
+        while (i + 1 < n && records[i + 1] == lazy->rows + last + 1) {
+            last++;
+            i++;
+        }
+        posix_fadvise(lazy->fd, lazy->offsets[first],
+                      lazy->offsets[last + 1] - lazy->offsets[first],
+                      POSIX_FADV_WILLNEED);
+    }
+}
+
+void dataCacheRelease(void) {
+    pthread_once(&cacheKeyOnce, createCacheKey);
+    freeRecordCache(pthread_getspecific(cacheKey));
+    pthread_setspecific(cacheKey, NULL);
+}
+
 /* Free a single data record */
 void freeData(struct data *d) {
     if (!d) return;
     for (int i = 0; i < NUM_FIELDS; i++) {
-        if (d->fields[i]) free(d->fields[i]);
+        if (d->fields[i]) {
+            memAccountFree(MEM_DATA, strlen(d->fields[i]) + 1);
+            free(d->fields[i]);
+        }
     }
+    memAccountFree(MEM_DATA, sizeof(char *) * NUM_FIELDS);
+    memAccountFree(MEM_DATA, sizeof(struct data));
     free(d->fields);
     free(d);
 }
@@ -77,39 +271,153 @@ void freeQueryResult(struct queryResult *r) {
 
 /* Print one field from a record */
 void printField(FILE *f, struct data *record, int fieldIndex) {
-    assert(record && record->fields && fieldIndex >= 0 && fieldIndex < NUM_FIELDS);
-    fprintf(f, "%s", record->fields[fieldIndex]);
+    assert(record && fieldIndex >= 0 && fieldIndex < NUM_FIELDS);
+    fprintf(f, "%s", dataField(record, fieldIndex));
 }
 
 /* Print full query result (general, reused across dict types) */
 void printQueryResult(struct queryResult *r, char **headers, FILE *summaryFile,
                       FILE *outputFile) {
+    struct resultSpan s = {r->searchString, r->records, r->numRecords,
+                           r->bitCount, r->nodeCount, r->stringCount};
+    printResultSpan(&s, headers, summaryFile, outputFile);
+}
 
-    if (r->numRecords == 0) {
-        fprintf(summaryFile,
-                "%s --> %s - comparisons: b%d n%d s%d\n",
-                r->searchString, NOTFOUND,
-                r->bitCount, r->nodeCount, r->stringCount);
-        fprintf(outputFile, "%s\n", r->searchString);
+/* Print the comparison counts on summary lines, or leave them out */
+void setSummaryCounts(int on) {
+    summaryCounts = on;
+}
+
+/* Print a result span: one summary line, then every record */
+void printResultSpan(struct resultSpan *s, char **headers, FILE *summaryFile,
+                     FILE *outputFile) {
+    printSpanHeader(s, summaryFile, outputFile);
+    printRecords(s->records, s->numRecords, headers, outputFile);
+}
+
+/* Print the summary line and the start of the output block of a span */
+void printSpanHeader(struct resultSpan *s, FILE *summaryFile,
+                     FILE *outputFile) {
+    printSpanSummary(s, summaryFile);
+
+    /* Print details to output file */
+    fprintf(outputFile, "%s\n", s->searchString);
+    if (s->numRecords == 0) {
         fprintf(outputFile, "--> %s\n", NOTFOUND);
+    }
+}
+
+/* Print the summary line of a span */
+void printSpanSummary(struct resultSpan *s, FILE *summaryFile) {
+    if (!summaryCounts) {
+        if (s->numRecords == 0) {
+            fprintf(summaryFile, "%s --> %s\n", s->searchString, NOTFOUND);
+        } else {
+            fprintf(summaryFile, "%s --> %d records found\n",
+                    s->searchString, s->numRecords);
+        }
         return;
+    }
+    if (s->numRecords == 0) {
+        fprintf(summaryFile,
+                "%s --> %s - comparisons: b%d n%d s%d\n",
+                s->searchString, NOTFOUND,
+                s->bitCount, s->nodeCount, s->stringCount);
     } else {
         fprintf(summaryFile,
                 "%s --> %d records found - comparisons: b%d n%d s%d\n",
-                r->searchString, r->numRecords,
-                r->bitCount, r->nodeCount, r->stringCount);
-        }
-
+                s->searchString, s->numRecords,
+                s->bitCount, s->nodeCount, s->stringCount);
+    }
+}
 
-    /* Print details to output file */
-    fprintf(outputFile, "%s\n", r->searchString);
-    for (int i = 0; i < r->numRecords; i++) {
+/* Print one "--> HEADER: value || ..." line per record */
+void printRecords(struct data **records, int numRecords, char **headers,
+                  FILE *outputFile) {
+    dataPrefetch(records, numRecords);
+    for (int i = 0; i < numRecords; i++) {
         fprintf(outputFile, "--> ");
         for (int j = 0; j < NUM_FIELDS; j++) {
             fprintf(outputFile, "%s: ", headers[j]);
-            printField(outputFile, r->records[i], j);
+            printField(outputFile, records[i], j);
             fprintf(outputFile, " || ");
         }
         fprintf(outputFile, "\n");
     }
 }
+
+/* Copy a span into a fresh queryResult */
+struct queryResult *spanToQueryResult(struct resultSpan *s) {
+    struct queryResult *qr = malloc(sizeof(*qr));
+    assert(qr);
+    qr->searchString = strdup(s->searchString);
+    assert(qr->searchString);
+    qr->numRecords = s->numRecords;
+    qr->records = NULL;
+    if (s->numRecords > 0) {
+        qr->records = malloc(s->numRecords * sizeof(*qr->records));
+        assert(qr->records);
+        memcpy(qr->records, s->records, s->numRecords * sizeof(*qr->records));
+    }
+    qr->bitCount = s->bitCount;
+    qr->nodeCount = s->nodeCount;
+    qr->stringCount = s->stringCount;
+    return qr;
+}
+
+/* --------------------- Prefix Result Utilities --------------------- */
+
+/* Free a prefix search result */
+struct prefixResult *newPrefixResult(const char *prefix) {
+    struct prefixResult *r = malloc(sizeof(*r));
+    assert(r);
+    r->prefix = strdup(prefix);
+    assert(r->prefix);
+    r->total = 0;
+    r->cursor = 0;
+    r->nextCursor = -1;
+    r->numKeys = 0;
+    r->keys = NULL;
+    r->recordCounts = NULL;
+    return r;
+}
+
+void freePrefixResult(struct prefixResult *r) {
+    if (!r) return;
+    for (int i = 0; i < r->numKeys; i++) {
+        free(r->keys[i]);
+    }
+    free(r->keys);
+    free(r->recordCounts);
+    free(r->prefix);
+    free(r);
+}
+
+/* Print a prefix search result: one summary line, then one line per key */
+void printPrefixResult(struct prefixResult *r, FILE *summaryFile,
+                       FILE *outputFile) {
+    printPrefixSummary(r, summaryFile);
+    fprintf(outputFile, "%s\n", r->prefix);
+    if (r->numKeys == 0) {
+        fprintf(outputFile, "--> %s\n", NOTFOUND);
+        return;
+    }
+    for (int i = 0; i < r->numKeys; i++) {
+        fprintf(outputFile, "--> %s (%d records)\n", r->keys[i], r->recordCounts[i]);
+    }
+}
+
+/* Print the summary line of a prefix search result */
+void printPrefixSummary(struct prefixResult *r, FILE *summaryFile) {
+    if (r->numKeys == 0) {
+        fprintf(summaryFile, "%s --> %s - %d completions\n",
+                r->prefix, NOTFOUND, r->total);
+        return;
+    }
+    fprintf(summaryFile, "%s --> %d-%d of %d completions",
+            r->prefix, r->cursor + 1, r->cursor + r->numKeys, r->total);
+    if (r->nextCursor >= 0) {
+        fprintf(summaryFile, " - next cursor %d", r->nextCursor);
+    }
+    fprintf(summaryFile, "\n");
+}
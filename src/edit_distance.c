@@ -0,0 +1,111 @@
+/*
+    Edit distance between strings: the full dynamic programming table,
+    and a banded version for callers that only care about small distances.
+*/
+#include "edit_distance.h"
+
+#include <assert.h>
+
+static int minOf3(int a, int b, int c);
+
+/* Returns min of 3 integers 
+    reference: https://www.geeksforgeeks.org/edit-distance-in-c/ */
+static int minOf3(int a, int b, int c) {
+    if (a < b) {
+        if(a < c) {
+            return a;
+        } else {
+            return c;
+        }
+    } else {
+        if(b < c) {
+            return b;
+        } else {
+            return c;
+        }
+    }
+}
+
+/* Returns the edit distance of two strings
+    reference: https://www.geeksforgeeks.org/edit-distance-in-c/ */
+int editDistance(char *str1, char *str2, int n, int m){
+    assert(m >= 0 && n >= 0 && (str1 || m == 0) && (str2 || n == 0));
+    // Declare a 2D array to store the dynamic programming
+    // table
+    int dp[n + 1][m + 1];
+
+    // Initialize the dp table
+    for (int i = 0; i <= n; i++) {
+        for (int j = 0; j <= m; j++) {
+            // If the first string is empty, the only option
+            // is to insert all characters of the second
+            // string
+            if (i == 0) {
+                dp[i][j] = j;
+            }
+            // If the second string is empty, the only
+            // option is to remove all characters of the
+            // first string
+            else if (j == 0) {
+                dp[i][j] = i;
+            }
+            // If the last characters are the same, no
+            // modification is necessary to the string.
+            else if (str1[i - 1] == str2[j - 1]) {
+                dp[i][j] = dp[i - 1][j - 1];
+            }
+            // If the last characters are different,
+            // consider all three operations and find the
+            // minimum
+            else {
+                dp[i][j] = 1 + minOf3(dp[i - 1][j], dp[i][j - 1],
+                    dp[i - 1][j - 1]);
+            }
+        }
+    }
+
+    // Return the result from the dynamic programming table
+    return dp[n][m];
+}
+
+int typoDistanceWithin(const char *a, int n, const char *b, int m, int limit) {
+    assert(n >= 0 && m >= 0 && limit >= 0);
+    int over = limit + 1;
+    if (n - m > limit || m - n > limit) return over;
+
+    // Three rows of the table (a swap looks two rows back); every cell
+    // read at row i is inside the band or on its edges, which hold `over`
+    int rows[3][m + 2];
+    int *older = rows[0], *prev = rows[1], *curr = rows[2];
+    for (int j = 0; j <= m + 1; j++) {
+        older[j] = over;
+        prev[j] = (j <= limit && j <= m) ? j : over;
+    }
+
+    for (int i = 1; i <= n; i++) {
+        int lo = (i - limit > 1) ? i - limit : 1;
+        int hi = (i + limit < m) ? i + limit : m;
+        curr[0] = (i <= limit) ? i : over;
+        curr[lo - 1] = (lo > 1) ? over : curr[0];
+        curr[hi + 1] = over;
+        int rowMin = curr[0];
+        for (int j = lo; j <= hi; j++) {
+            int best = prev[j - 1] + (a[i - 1] != b[j - 1]);
+            best = minOf3(best, prev[j] + 1, curr[j - 1] + 1);
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] &&
+                older[j - 2] + 1 < best) {
+                best = older[j - 2] + 1;
+            }
+            curr[j] = (best < over) ? best : over;
+            if (curr[j] < rowMin) rowMin = curr[j];
+        }
+        // Rows never get cheaper than the row above minus one swap
+        if (rowMin > limit) return over;
+
+        int *swap = older;
+        older = prev;
+        prev = curr;
+        curr = swap;
+    }
+    return prev[m];
+}
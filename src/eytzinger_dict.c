@@ -0,0 +1,286 @@
+/*
+    Eytzinger dictionary: rows are sorted by (key, file row); each run of
+    equal keys becomes one distinct key with a run of records. Slot k of
+    the search array (1-based) holds the 8-byte prefix and the sorted
+    rank of its key; an in-order walk of the implicit tree assigns the
+    ranks, so the walk down from slot 1 is a binary search.
+*/
+#include "eytzinger_dict.h"
+#include "edit_distance.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+
+#define CACHE_LINE 64
+#define PREFIX_BYTES 8
+#define PREFIX_BITS (PREFIX_BYTES * 8)
+#define PREFETCH_LEVELS 4                            // levels looked ahead
+#define PREFETCH_SLOTS (1 << PREFETCH_LEVELS)        // slots on that level
+#define SLOTS_PER_LINE (CACHE_LINE / PREFIX_BYTES)
+
+struct eyDict {
+    int numKeys;
+    char *arena;                 // distinct keys in order, NUL-terminated
+    size_t arenaBytes;
+    uint32_t *keyStart;          // rank -> offset of its key in arena
+    uint64_t *prefixes;          // slot -> key prefix; slot 0 unused
+    uint32_t *ranks;             // slot -> rank
+    struct data **records;       // all rows, by (key, file row)
+    uint32_t *runStart;          // rank -> first record; numKeys + 1
+    int numRecords;
+};
+
+/* A row while sorting */
+struct sortRow {
+    const char *key;
+    int row;
+};
+
+/* Helpers */
+static int compareRows(const void *a, const void *b);
+static uint64_t keyPrefix(const char *key);
+static int fillSlots(struct eyDict *d, int slot, int rank);
+static const char *rankKey(struct eyDict *d, int rank);
+static int lowerBound(struct eyDict *d, const char *query,
+                      struct resultSpan *span);
+static int findRank(struct eyDict *d, char *query, struct resultSpan *span,
+                    int *rank);
+static int keyDistance(const char *a, int n, const char *b, int m);
+static void *alignedArray(size_t count, size_t size);
+static size_t keyBytes(struct eyDict *d);
+static size_t slotBytes(struct eyDict *d);
+static size_t runBytes(struct eyDict *d);
+
+static int compareRows(const void *a, const void *b) {
+    const struct sortRow *x = a, *y = b;
+    int order = strcmp(x->key, y->key);
+    return order ? order : (x->row > y->row) - (x->row < y->row);
+}
+
+/* helper: the first 8 bytes of key, zero padded, as a big-endian number,
+   so prefixes order like strcmp orders the keys */
+static uint64_t keyPrefix(const char *key) {
+    uint64_t prefix = 0;
+    int i = 0;
+    for (; i < PREFIX_BYTES && key[i]; i++) {
+        prefix = (prefix << 8) | (unsigned char)key[i];
+    }
+    return i == 0 ? 0 : prefix << (8 * (PREFIX_BYTES - i));
+}
+
+/* helper: in-order walk of the subtree at slot, giving it the ranks from
+   `rank` on; returns the next unused rank */
+static int fillSlots(struct eyDict *d, int slot, int rank) {
+    if (slot > d->numKeys) return rank;
+    rank = fillSlots(d, 2 * slot, rank);
+    d->ranks[slot] = (uint32_t)rank;
+    d->prefixes[slot] = keyPrefix(rankKey(d, rank));
+    return fillSlots(d, 2 * slot + 1, rank + 1);
+}
+
+static const char *rankKey(struct eyDict *d, int rank) {
+    return d->arena + d->keyStart[rank];
+}
+
+/* helper: editDistance of a[0..n) and b[0..m) with their common prefix
+   and suffix cut off first, which leaves the distance unchanged; sorted
+   neighbours share long prefixes, so the table shrinks a lot */
+static int keyDistance(const char *a, int n, const char *b, int m) {
+    while (n > 0 && m > 0 && *a == *b) {
+        a++;
+        b++;
+        n--;
+        m--;
+    }
+    while (n > 0 && m > 0 && a[n - 1] == b[m - 1]) {
+        n--;
+        m--;
+    }
+    return editDistance((char *)a, (char *)b, n, m);
+}
+
+/* helpers: bytes of the keys, of the search array and of the runs */
+static size_t keyBytes(struct eyDict *d) {
+    return d->arenaBytes + sizeof(uint32_t) * (size_t)d->numKeys;
+}
+
+static size_t slotBytes(struct eyDict *d) {
+    return (sizeof(uint64_t) + sizeof(uint32_t)) * (size_t)(d->numKeys + 1);
+}
+
+static size_t runBytes(struct eyDict *d) {
+    return sizeof(uint32_t) * (size_t)(d->numKeys + 1) +
+           sizeof(struct data *) * (size_t)d->numRecords;
+}
+
+/* helper: cache-line aligned zeroed array */
+static void *alignedArray(size_t count, size_t size) {
+    size_t bytes = (count * size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    void *p = aligned_alloc(CACHE_LINE, bytes);
+    assert(p);
+    memset(p, 0, bytes);
+    return p;
+}
+
+struct eyDict *eyDictNew(char **keys, struct data **recs, int n) {
+    assert(n >= 0 && (n == 0 || (keys && recs)));
+    struct sortRow *rows = malloc(sizeof(*rows) * (n > 0 ? n : 1));
+    assert(rows);
+    for (int i = 0; i < n; i++) {
+        rows[i].key = keys[i];
+        rows[i].row = i;
+    }
+    qsort(rows, n, sizeof(*rows), compareRows);
+
+    struct eyDict *d = malloc(sizeof(*d));
+    assert(d);
+    int numKeys = 0;
+    size_t arenaBytes = 0;
+    for (int i = 0; i < n; i++) {
+        if (i > 0 && strcmp(rows[i - 1].key, rows[i].key) == 0) continue;
+        numKeys++;
+        arenaBytes += strlen(rows[i].key) + 1;
+    }
+    d->numKeys = numKeys;
+    d->numRecords = n;
+    d->arenaBytes = arenaBytes;
+    d->arena = malloc(arenaBytes > 0 ? arenaBytes : 1);
+    d->keyStart = malloc(sizeof(uint32_t) * (numKeys > 0 ? numKeys : 1));
+    d->runStart = malloc(sizeof(uint32_t) * (numKeys + 1));
+    d->records = malloc(sizeof(struct data *) * (n > 0 ? n : 1));
+    assert(d->arena && d->keyStart && d->runStart && d->records);
+    assert(arenaBytes <= UINT32_MAX);
+
+    // Distinct keys into the arena, rows into runs
+    size_t used = 0;
+    int rank = -1;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || strcmp(rows[i - 1].key, rows[i].key) != 0) {
+            rank++;
+            size_t len = strlen(rows[i].key) + 1;
+            memcpy(d->arena + used, rows[i].key, len);
+            d->keyStart[rank] = (uint32_t)used;
+            d->runStart[rank] = (uint32_t)i;
+            used += len;
+        }
+        d->records[i] = recs[rows[i].row];
+    }
+    d->runStart[numKeys] = (uint32_t)n;
+    free(rows);
+
+    d->prefixes = alignedArray(numKeys + 1, sizeof(uint64_t));
+    d->ranks = alignedArray(numKeys + 1, sizeof(uint32_t));
+    fillSlots(d, 1, 0);
+    memAccountAlloc(MEM_LEAF_KEYS, keyBytes(d));
+    memAccountAlloc(MEM_NODES, slotBytes(d));
+    memAccountAlloc(MEM_RECORD_ARRAYS, runBytes(d));
+    return d;
+}
+
+/* helper: rank of the first key not below query (numKeys if none) */
+static int lowerBound(struct eyDict *d, const char *query,
+                      struct resultSpan *span) {
+    uint64_t want = keyPrefix(query);
+    size_t n = (size_t)d->numKeys;
+    size_t slot = 1;
+    while (slot <= n) {
+        // The 16 slots four levels down are two cache lines
+        size_t ahead = slot * PREFETCH_SLOTS;
+        size_t second = ahead + SLOTS_PER_LINE;
+        __builtin_prefetch(d->prefixes + (ahead <= n ? ahead : n));
+        __builtin_prefetch(d->prefixes + (second <= n ? second : n));
+
+        uint64_t prefix = d->prefixes[slot];
+        int below = prefix < want;
+        if (prefix == want) {
+            span->stringCount++;
+            below = strcmp(rankKey(d, (int)d->ranks[slot]), query) < 0;
+        }
+        span->nodeCount++;
+        slot = 2 * slot + (size_t)below;
+    }
+    span->bitCount = span->nodeCount * PREFIX_BITS;
+    // Undo the right turns taken after the last left turn
+    slot >>= __builtin_ffsll((long long)~slot);
+    return slot == 0 ? d->numKeys : (int)d->ranks[slot];
+}
+
+/* helper: search for query; returns 1 and fills the span on an exact
+   match. *rank is the rank of the first key not below query. */
+static int findRank(struct eyDict *d, char *query, struct resultSpan *span,
+                    int *rank) {
+    *span = (struct resultSpan){query, NULL, 0, 0, 0, 0};
+    *rank = lowerBound(d, query, span);
+    if (*rank == d->numKeys) return 0;
+    span->stringCount++;
+    if (strcmp(rankKey(d, *rank), query) != 0) return 0;
+    span->records = d->records + d->runStart[*rank];
+    span->numRecords = (int)(d->runStart[*rank + 1] - d->runStart[*rank]);
+    return 1;
+}
+
+int eyDictFindSpan(struct eyDict *d, char *query, struct resultSpan *span) {
+    assert(d && query && span);
+    int rank;
+    return findRank(d, query, span, &rank);
+}
+
+void eyDictLookupSpan(struct eyDict *d, char *query, struct resultSpan *span) {
+    assert(d && query && span);
+    int rank;
+    if (findRank(d, query, span, &rank) || d->numKeys == 0) return;
+
+    // Closest match among the sorted neighbours of the insertion point;
+    // ties go to the smaller key
+    int first = rank - EY_NEIGHBOURS > 0 ? rank - EY_NEIGHBOURS : 0;
+    int last = rank + EY_NEIGHBOURS < d->numKeys ? rank + EY_NEIGHBOURS
+                                                 : d->numKeys;
+    int best = -1, bestDistance = INT_MAX;
+    int queryLen = (int)strlen(query);
+    for (int r = first; r < last; r++) {
+        const char *key = rankKey(d, r);
+        span->stringCount++;
+        int distance = keyDistance(query, queryLen, key, (int)strlen(key));
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = r;
+        }
+    }
+    span->records = d->records + d->runStart[best];
+    span->numRecords = (int)(d->runStart[best + 1] - d->runStart[best]);
+}
+
+struct queryResult *eyDictLookup(struct eyDict *d, char *query) {
+    struct resultSpan span;
+    eyDictLookupSpan(d, query, &span);
+    return spanToQueryResult(&span);
+}
+
+int eyDictKeys(struct eyDict *d) {
+    assert(d);
+    return d->numKeys;
+}
+
+size_t eyDictBytes(struct eyDict *d) {
+    assert(d);
+    return keyBytes(d) + slotBytes(d) + runBytes(d);
+}
+
+void eyDictFree(struct eyDict *d) {
+    if (!d) return;
+    memAccountFree(MEM_LEAF_KEYS, keyBytes(d));
+    memAccountFree(MEM_NODES, slotBytes(d));
+    memAccountFree(MEM_RECORD_ARRAYS, runBytes(d));
+    free(d->arena);
+    free(d->keyStart);
+    free(d->prefixes);
+    free(d->ranks);
+    free(d->records);
+    free(d->runStart);
+    free(d);
+}
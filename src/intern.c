@@ -0,0 +1,219 @@
+/*
+    Interning pool: a hash set of strings backed by a bump allocator.
+
+    Strings are stored in large arena chunks. A chunk is filled with an
+    atomic fetch-and-add; only installing a new chunk takes a mutex.
+    The hash table is an array of entry pointers probed linearly; a new
+    entry is published with a compare-and-swap on an empty slot, so a
+    reader either sees a fully written entry or an empty slot. Until the
+    pool is sealed only the loading thread uses it, so the table can be
+    rehashed into one twice the size whenever it gets 3/4 full.
+*/
+#include "intern.h"
+#include "mem_account.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define ARENA_CHUNK_BYTES (1 << 20)
+#define ENTRY_ALIGN 8
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+/* A stored string: header followed by the bytes and '\0' */
+struct internEntry {
+    uint32_t hash;
+    uint32_t len;
+    char str[];
+};
+
+/* One arena chunk */
+struct arenaChunk {
+    struct arenaChunk *next;
+    size_t size;
+    atomic_size_t used;
+    char bytes[];
+};
+
+struct internPool {
+    _Atomic(struct internEntry *) *slots;
+    size_t mask;                       // number of slots - 1
+    atomic_size_t unique;
+    int sealed;                        // table no longer grows
+
+    _Atomic(struct arenaChunk *) chunk; // chunk being filled
+    pthread_mutex_t chunkLock;
+    atomic_size_t arenaBytes;
+};
+
+/* The empty string: shared, never stored */
+static char emptyString[1] = "";
+
+/* Helpers */
+static uint32_t hashBytes(const char *s, size_t len);
+static void *arenaAlloc(struct internPool *pool, size_t bytes);
+static void growTable(struct internPool *pool);
+
+struct internPool *internPoolNew(size_t slots) {
+    struct internPool *pool = malloc(sizeof(*pool));
+    assert(pool);
+
+    size_t size = 1;
+    while (size < slots) size <<= 1;
+    pool->slots = calloc(size, sizeof(*pool->slots));
+    assert(pool->slots);
+    memAccountAlloc(MEM_FIELDS, sizeof(*pool));
+    memAccountAlloc(MEM_FIELDS, size * sizeof(*pool->slots));
+    pool->mask = size - 1;
+    atomic_init(&pool->unique, 0);
+    pool->sealed = 0;
+
+    atomic_init(&pool->chunk, NULL);
+    pthread_mutex_init(&pool->chunkLock, NULL);
+    atomic_init(&pool->arenaBytes, 0);
+    return pool;
+}
+
+void internPoolSeal(struct internPool *pool) {
+    pool->sealed = 1;
+}
+
+/* helper: FNV-1a hash of s[0..len) */
+static uint32_t hashBytes(const char *s, size_t len) {
+    uint32_t h = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/* helper: `bytes` of 8-byte aligned arena memory, safe to call concurrently */
+static void *arenaAlloc(struct internPool *pool, size_t bytes) {
+    bytes = (bytes + ENTRY_ALIGN - 1) & ~(size_t)(ENTRY_ALIGN - 1);
+    while (1) {
+        struct arenaChunk *chunk = atomic_load(&pool->chunk);
+        if (chunk) {
+            size_t offset = atomic_fetch_add(&chunk->used, bytes);
+            if (offset + bytes <= chunk->size) {
+                return chunk->bytes + offset;
+            }
+        }
+
+        // Current chunk is full (or missing): install a new one once
+        pthread_mutex_lock(&pool->chunkLock);
+        if (atomic_load(&pool->chunk) == chunk) {
+            size_t size = (bytes > ARENA_CHUNK_BYTES) ? bytes : ARENA_CHUNK_BYTES;
+            struct arenaChunk *fresh = malloc(sizeof(*fresh) + size);
+            assert(fresh);
+            fresh->next = chunk;
+            fresh->size = size;
+            atomic_init(&fresh->used, 0);
+            atomic_fetch_add(&pool->arenaBytes, sizeof(*fresh) + size);
+            memAccountAlloc(MEM_FIELDS, sizeof(*fresh) + size);
+            atomic_store(&pool->chunk, fresh);
+        }
+        pthread_mutex_unlock(&pool->chunkLock);
+    }
+}
+
+/* helper: rehash the table into one twice the size (single-threaded) */
+static void growTable(struct internPool *pool) {
+    size_t oldSize = pool->mask + 1, size = oldSize * 2;
+    _Atomic(struct internEntry *) *slots = calloc(size, sizeof(*slots));
+    assert(slots);
+    for (size_t i = 0; i < oldSize; i++) {
+        struct internEntry *entry = atomic_load(&pool->slots[i]);
+        if (!entry) continue;
+        size_t j = entry->hash & (size - 1);
+        while (atomic_load(&slots[j])) j = (j + 1) & (size - 1);
+        atomic_store(&slots[j], entry);
+    }
+    memAccountResize(MEM_FIELDS, oldSize * sizeof(*slots),
+                     size * sizeof(*slots));
+    free(pool->slots);
+    pool->slots = slots;
+    pool->mask = size - 1;
+}
+
+char *internCopy(struct internPool *pool, const char *s, size_t len) {
+    if (len == 0) return emptyString;
+    char *copy = arenaAlloc(pool, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char *internString(struct internPool *pool, const char *s, size_t len,
+                   int *isNew) {
+    if (isNew) *isNew = 0;
+    if (len == 0) return emptyString;
+
+    uint32_t hash = hashBytes(s, len);
+    struct internEntry *mine = NULL;
+    size_t probes = 0;
+
+    for (size_t i = hash & pool->mask; probes <= pool->mask;
+         i = (i + 1) & pool->mask, probes++) {
+        struct internEntry *entry = atomic_load(&pool->slots[i]);
+        if (!entry) {
+            // Keep the table at most 3/4 full: grow it while loading,
+            // afterwards just copy
+            if (atomic_load(&pool->unique) >= (pool->mask + 1) / 4 * 3) {
+                if (pool->sealed) break;
+                growTable(pool);
+                return internString(pool, s, len, isNew);
+            }
+            if (!mine) {
+                mine = arenaAlloc(pool, sizeof(*mine) + len + 1);
+                mine->hash = hash;
+                mine->len = (uint32_t)len;
+                memcpy(mine->str, s, len);
+                mine->str[len] = '\0';
+            }
+            struct internEntry *expected = NULL;
+            if (atomic_compare_exchange_strong(&pool->slots[i], &expected, mine)) {
+                atomic_fetch_add(&pool->unique, 1);
+                if (isNew) *isNew = 1;
+                return mine->str;
+            }
+            entry = expected;  // another thread claimed the slot first
+        }
+        if (entry->hash == hash && entry->len == len &&
+            memcmp(entry->str, s, len) == 0) {
+            return entry->str;  // a lost race leaves `mine` unused in the arena
+        }
+    }
+
+    if (isNew) *isNew = 1;
+    return mine ? mine->str : internCopy(pool, s, len);
+}
+
+size_t internPoolUnique(struct internPool *pool) {
+    return atomic_load(&pool->unique);
+}
+
+size_t internPoolBytes(struct internPool *pool) {
+    return atomic_load(&pool->arenaBytes) +
+           (pool->mask + 1) * sizeof(*pool->slots) + sizeof(*pool);
+}
+
+void internPoolFree(struct internPool *pool) {
+    if (!pool) return;
+    struct arenaChunk *chunk = atomic_load(&pool->chunk);
+    while (chunk) {
+        struct arenaChunk *next = chunk->next;
+        memAccountFree(MEM_FIELDS, sizeof(*chunk) + chunk->size);
+        free(chunk);
+        chunk = next;
+    }
+    pthread_mutex_destroy(&pool->chunkLock);
+    memAccountFree(MEM_FIELDS, (pool->mask + 1) * sizeof(*pool->slots));
+    memAccountFree(MEM_FIELDS, sizeof(*pool));
+    free(pool->slots);
+    free(pool);
+}
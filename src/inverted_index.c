@@ -0,0 +1,495 @@
+/*
+    Inverted index: a hash table from word to term id, and per term a
+    posting list of (row, occurrences) plus the term's idf and the
+    largest score it can give any row (its WAND upper bound). The skip
+    table of each list also bounds the term's score per block, which
+    lets the search skip whole blocks (block-max WAND).
+
+    BM25 weight of a term in a row:
+        idf * tf * (K1 + 1) / (tf + K1 * (1 - B + B * length / avgLength))
+    with idf = log(1 + (rows - df + 0.5) / (df + 0.5)), which is always
+    positive. A row's length is its number of words (capped at
+    UCHAR_MAX).
+*/
+#include "inverted_index.h"
+#include "postings.h"
+#include "record_store.h"
+#include "dict_common.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+#include <assert.h>
+
+#define BM25_K1 1.2
+#define BM25_B 0.75
+#define FNV32_OFFSET 2166136261u
+#define FNV32_PRIME 16777619u
+#define INITIAL_SLOTS 1024
+#define INITIAL_POSTINGS 4
+#define INITIAL_ROW_WORDS 64
+
+struct term {
+    char *text;
+    struct postings *list;
+    double idf;
+    double maxScore;           // no row scores higher for this term
+};
+
+/* Postings of one term while building */
+struct termBuilder {
+    int *rows;
+    int *counts;
+    int n;
+    int cap;
+};
+
+struct invertedIndex {
+    struct recordStore *store;
+    struct term *terms;
+    int numTerms;
+    int termCap;
+    int *slots;                // term id + 1, 0 if empty
+    size_t mask;
+    unsigned char *lengths;    // words per row
+    double avgLength;
+    int rows;
+};
+
+/* A bounded min-heap of the best k rows found so far */
+struct topHeap {
+    double *score;
+    int *row;
+    int size;
+    int k;
+};
+
+/* Helpers */
+static int nextToken(const char **s, char *token);
+static unsigned int hashToken(const char *token);
+static int findTerm(struct invertedIndex *ii, const char *token);
+static int addTerm(struct invertedIndex *ii, const char *token);
+static void growSlots(struct invertedIndex *ii);
+static void addPosting(struct termBuilder *b, int row, int count);
+static int compareInts(const void *a, const void *b);
+static double termWeight(struct invertedIndex *ii, struct term *t, int count,
+                         int row);
+static int heapWorse(double scoreA, int rowA, double scoreB, int rowB);
+static void heapSiftDown(struct topHeap *h, int i, double score, int row);
+static void heapOffer(struct topHeap *h, double score, int row);
+static int heapPop(struct topHeap *h);
+static int queryTerms(struct invertedIndex *ii, const char *text, int *ids);
+static void sortCursors(struct postingsCursor *cursors, int *order, int n);
+static struct queryResult *newResult(const char *searchString);
+
+/* helper: copy the next word of *s (upper case, at most SEARCH_MAX_TOKEN
+   characters kept) to token and move *s past it; 0 at end of string */
+static int nextToken(const char **s, char *token) {
+    const unsigned char *p = (const unsigned char *)*s;
+    while (*p && !isalnum(*p)) p++;
+    int len = 0;
+    for (; *p && isalnum(*p); p++) {
+        if (len < SEARCH_MAX_TOKEN) token[len++] = (char)toupper(*p);
+    }
+    token[len] = '\0';
+    *s = (const char *)p;
+    return len;
+}
+
+/* helper: FNV-1a of a token */
+static unsigned int hashToken(const char *token) {
+    unsigned int h = FNV32_OFFSET;
+    for (const unsigned char *p = (const unsigned char *)token; *p; p++) {
+        h ^= *p;
+        h *= FNV32_PRIME;
+    }
+    return h;
+}
+
+/* helper: term id of token, or -1 */
+static int findTerm(struct invertedIndex *ii, const char *token) {
+    size_t i = hashToken(token) & ii->mask;
+    while (ii->slots[i] != 0) {
+        int id = ii->slots[i] - 1;
+        if (strcmp(ii->terms[id].text, token) == 0) return id;
+        i = (i + 1) & ii->mask;
+    }
+    return -1;
+}
+
+/* helper: double the hash table, keeping it at most half full */
+static void growSlots(struct invertedIndex *ii) {
+    free(ii->slots);
+    ii->mask = ii->mask * 2 + 1;
+    ii->slots = calloc(ii->mask + 1, sizeof(*ii->slots));
+    assert(ii->slots);
+    for (int id = 0; id < ii->numTerms; id++) {
+        size_t i = hashToken(ii->terms[id].text) & ii->mask;
+        while (ii->slots[i] != 0) i = (i + 1) & ii->mask;
+        ii->slots[i] = id + 1;
+    }
+}
+
+/* helper: term id of token, adding it if new */
+static int addTerm(struct invertedIndex *ii, const char *token) {
+    int id = findTerm(ii, token);
+    if (id >= 0) return id;
+    if ((size_t)(ii->numTerms + 1) * 2 > ii->mask + 1) growSlots(ii);
+    if (ii->numTerms == ii->termCap) {
+        ii->termCap *= 2;
+        ii->terms = realloc(ii->terms, sizeof(*ii->terms) * ii->termCap);
+        assert(ii->terms);
+    }
+    id = ii->numTerms++;
+    ii->terms[id].text = strdup(token);
+    assert(ii->terms[id].text);
+    ii->terms[id].list = NULL;
+
+    size_t i = hashToken(token) & ii->mask;
+    while (ii->slots[i] != 0) i = (i + 1) & ii->mask;
+    ii->slots[i] = id + 1;
+    return id;
+}
+
+/* helper: append (row, count) to a term's postings */
+static void addPosting(struct termBuilder *b, int row, int count) {
+    if (b->n == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : INITIAL_POSTINGS;
+        b->rows = realloc(b->rows, sizeof(*b->rows) * b->cap);
+        b->counts = realloc(b->counts, sizeof(*b->counts) * b->cap);
+        assert(b->rows && b->counts);
+    }
+    b->rows[b->n] = row;
+    b->counts[b->n] = count;
+    b->n++;
+}
+
+static int compareInts(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* helper: BM25 weight of term t occurring count times in row */
+static double termWeight(struct invertedIndex *ii, struct term *t, int count,
+                         int row) {
+    double norm = 1 - BM25_B + BM25_B * ii->lengths[row] / ii->avgLength;
+    return t->idf * count * (BM25_K1 + 1) / (count + BM25_K1 * norm);
+}
+
+struct invertedIndex *invertedIndexNew(struct recordStore *store,
+                                       const int *fields, int numFields) {
+    assert(store && fields && numFields > 0);
+    struct invertedIndex *ii = malloc(sizeof(*ii));
+    assert(ii);
+    ii->store = store;
+    ii->rows = recordStoreSize(store);
+    ii->numTerms = 0;
+    ii->termCap = INITIAL_SLOTS / 2;
+    ii->terms = malloc(sizeof(*ii->terms) * ii->termCap);
+    ii->mask = INITIAL_SLOTS - 1;
+    ii->slots = calloc(INITIAL_SLOTS, sizeof(*ii->slots));
+    ii->lengths = malloc(ii->rows > 0 ? ii->rows : 1);
+    assert(ii->terms && ii->slots && ii->lengths);
+
+    // One pass over the rows: term ids of each row, sorted, become
+    // (row, count) postings; rows arrive in order so lists stay sorted
+    struct termBuilder *builders = NULL;
+    int builderCap = 0;
+    int wordCap = INITIAL_ROW_WORDS;
+    int *words = malloc(sizeof(*words) * wordCap);
+    assert(words);
+    char token[SEARCH_MAX_TOKEN + 1];
+    double totalLength = 0;
+    for (int row = 0; row < ii->rows; row++) {
+        struct data *rec = recordStoreGet(store, row);
+        int numWords = 0;
+        for (int f = 0; f < numFields; f++) {
+            const char *s = dataField(rec, fields[f]);
+            while (nextToken(&s, token) > 0) {
+                if (numWords == wordCap) {
+                    wordCap *= 2;
+                    words = realloc(words, sizeof(*words) * wordCap);
+                    assert(words);
+                }
+                words[numWords++] = addTerm(ii, token);
+            }
+        }
+        ii->lengths[row] = (unsigned char)(numWords < UCHAR_MAX ? numWords
+                                                                : UCHAR_MAX);
+        totalLength += ii->lengths[row];
+
+        if (ii->numTerms > builderCap) {
+            int oldCap = builderCap;
+            builderCap = ii->termCap;
+            builders = realloc(builders, sizeof(*builders) * builderCap);
+            assert(builders);
+            memset(builders + oldCap, 0,
+                   sizeof(*builders) * (builderCap - oldCap));
+        }
+        qsort(words, numWords, sizeof(*words), compareInts);
+        for (int i = 0; i < numWords;) {
+            int j = i;
+            while (j < numWords && words[j] == words[i]) j++;
+            addPosting(&builders[words[i]], row, j - i);
+            i = j;
+        }
+    }
+    free(words);
+    ii->avgLength = (ii->rows > 0 && totalLength > 0) ? totalLength / ii->rows
+                                                       : 1;
+
+    // Compress every list and record its score bound
+    for (int id = 0; id < ii->numTerms; id++) {
+        struct termBuilder *b = &builders[id];
+        struct term *t = &ii->terms[id];
+        t->idf = log(1 + (ii->rows - b->n + 0.5) / (b->n + 0.5));
+        t->maxScore = 0;
+        double *weights = malloc(sizeof(*weights) * (b->n > 0 ? b->n : 1));
+        assert(weights);
+        for (int i = 0; i < b->n; i++) {
+            weights[i] = termWeight(ii, t, b->counts[i], b->rows[i]);
+            if (weights[i] > t->maxScore) t->maxScore = weights[i];
+        }
+        t->list = postingsEncode(b->rows, b->counts, weights, b->n);
+        free(weights);
+        free(b->rows);
+        free(b->counts);
+    }
+    free(builders);
+    memAccountAlloc(MEM_TEXT_INDEXES, invertedIndexBytes(ii));
+    return ii;
+}
+
+/* helper: heap order - lower score, or equal score and later row */
+static int heapWorse(double scoreA, int rowA, double scoreB, int rowB) {
+    if (scoreA != scoreB) return scoreA < scoreB;
+    return rowA > rowB;
+}
+
+/* helper: place (score, row) at slot i and sift it down */
+static void heapSiftDown(struct topHeap *h, int i, double score, int row) {
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= h->size) break;
+        if (child + 1 < h->size &&
+            heapWorse(h->score[child + 1], h->row[child + 1],
+                      h->score[child], h->row[child])) {
+            child++;
+        }
+        if (!heapWorse(h->score[child], h->row[child], score, row)) break;
+        h->score[i] = h->score[child];
+        h->row[i] = h->row[child];
+        i = child;
+    }
+    h->score[i] = score;
+    h->row[i] = row;
+}
+
+/* helper: keep the k best rows, the worst one at the root */
+static void heapOffer(struct topHeap *h, double score, int row) {
+    if (h->size == h->k) {
+        if (heapWorse(h->score[0], h->row[0], score, row)) {
+            heapSiftDown(h, 0, score, row);
+        }
+        return;
+    }
+    int i = h->size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!heapWorse(score, row, h->score[parent], h->row[parent])) break;
+        h->score[i] = h->score[parent];
+        h->row[i] = h->row[parent];
+        i = parent;
+    }
+    h->score[i] = score;
+    h->row[i] = row;
+}
+
+/* helper: remove and return the worst row */
+static int heapPop(struct topHeap *h) {
+    int worst = h->row[0];
+    h->size--;
+    if (h->size > 0) {
+        heapSiftDown(h, 0, h->score[h->size], h->row[h->size]);
+    }
+    return worst;
+}
+
+/* helper: distinct known term ids of the words of text; returns how many */
+static int queryTerms(struct invertedIndex *ii, const char *text, int *ids) {
+    char token[SEARCH_MAX_TOKEN + 1];
+    int n = 0;
+    while (n < SEARCH_MAX_TERMS && nextToken(&text, token) > 0) {
+        int id = findTerm(ii, token);
+        int seen = 0;
+        for (int i = 0; i < n; i++) {
+            if (ids[i] == id) seen = 1;
+        }
+        if (id >= 0 && !seen) ids[n++] = id;
+    }
+    return n;
+}
+
+/* helper: order cursors by current row, then by query position
+   (insertion sort; there are at most SEARCH_MAX_TERMS) */
+static void sortCursors(struct postingsCursor *cursors, int *order, int n) {
+    for (int i = 1; i < n; i++) {
+        int v = order[i];
+        int j = i - 1;
+        while (j >= 0 && (cursors[order[j]].row > cursors[v].row ||
+                          (cursors[order[j]].row == cursors[v].row &&
+                           order[j] > v))) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = v;
+    }
+}
+
+/* helper: an empty result for searchString */
+static struct queryResult *newResult(const char *searchString) {
+    struct queryResult *qr = malloc(sizeof(*qr));
+    assert(qr);
+    qr->searchString = strdup(searchString);
+    assert(qr->searchString);
+    qr->numRecords = 0;
+    qr->records = NULL;
+    qr->bitCount = 0;
+    qr->nodeCount = 0;
+    qr->stringCount = 0;
+    return qr;
+}
+
+struct queryResult *invertedIndexSearch(struct invertedIndex *ii,
+                                        const char *text, int k) {
+    assert(ii && text && k > 0);
+    struct queryResult *qr = newResult(text);
+    int ids[SEARCH_MAX_TERMS];
+    int n = queryTerms(ii, text, ids);
+    if (n == 0) return qr;
+
+    struct postingsCursor cursors[SEARCH_MAX_TERMS];
+    int order[SEARCH_MAX_TERMS];
+    for (int i = 0; i < n; i++) {
+        postingsOpen(ii->terms[ids[i]].list, &cursors[i]);
+        order[i] = i;
+    }
+    struct topHeap h = {malloc(sizeof(double) * k), malloc(sizeof(int) * k),
+                        0, k};
+    assert(h.score && h.row);
+
+    // WAND: walk cursors in row order; the pivot is the first cursor at
+    // which the score bounds so far could beat the k-th best score
+    while (1) {
+        sortCursors(cursors, order, n);
+        double threshold = (h.size == k) ? h.score[0] : -1;
+        double bound = 0;
+        int pivot = -1;
+        for (int p = 0; p < n && cursors[order[p]].row != POSTINGS_END; p++) {
+            bound += ii->terms[ids[order[p]]].maxScore;
+            if (bound > threshold) {
+                pivot = p;
+                break;
+            }
+        }
+        if (pivot < 0) break;
+        int pivotRow = cursors[order[pivot]].row;
+        while (pivot + 1 < n && cursors[order[pivot + 1]].row == pivotRow) {
+            pivot++;
+        }
+
+        // Tighter check with the bounds of the blocks holding pivotRow;
+        // if it fails, no row before the first block end (or the next
+        // cursor) can qualify either
+        double blockBound = 0;
+        int next = (pivot + 1 < n) ? cursors[order[pivot + 1]].row
+                                   : POSTINGS_END;
+        for (int p = 0; p <= pivot; p++) {
+            int blockEnd;
+            blockBound += postingsBlockBound(&cursors[order[p]], pivotRow,
+                                             &blockEnd);
+            if (blockEnd < next - 1) next = blockEnd + 1;
+        }
+        if (blockBound <= threshold) {
+            if (next <= pivotRow) next = pivotRow + 1;
+            for (int p = 0; p <= pivot; p++) {
+                postingsAdvance(&cursors[order[p]], next);
+            }
+        } else if (cursors[order[0]].row == pivotRow) {
+            // Every cursor up to the pivot is on pivotRow: score it
+            double score = 0;
+            for (int p = 0; p < n && cursors[order[p]].row == pivotRow; p++) {
+                struct postingsCursor *c = &cursors[order[p]];
+                score += termWeight(ii, &ii->terms[ids[order[p]]],
+                                    postingsCount(c), pivotRow);
+                postingsNext(c);
+            }
+            heapOffer(&h, score, pivotRow);
+            qr->stringCount++;
+        } else {
+            // Rows before pivotRow cannot make the top k
+            for (int p = 0; p < pivot; p++) {
+                postingsAdvance(&cursors[order[p]], pivotRow);
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        qr->nodeCount += cursors[i].blocksDecoded;
+    }
+
+    // Empty the heap worst first into the result, best first
+    qr->numRecords = h.size;
+    qr->records = malloc(sizeof(struct data *) * (h.size > 0 ? h.size : 1));
+    assert(qr->records);
+    while (h.size > 0) {
+        int slot = h.size - 1;
+        qr->records[slot] = recordStoreGet(ii->store, heapPop(&h));
+    }
+
+    free(h.score);
+    free(h.row);
+    return qr;
+}
+
+struct queryResult *invertedIndexQuery(struct invertedIndex *ii, char *query,
+                                       int k) {
+    assert(ii && query);
+    if (strncmp(query, SEARCH_PREFIX, strlen(SEARCH_PREFIX)) != 0) return NULL;
+    struct queryResult *qr = invertedIndexSearch(ii, query + strlen(SEARCH_PREFIX),
+                                                 k);
+    free(qr->searchString);
+    qr->searchString = strdup(query);
+    assert(qr->searchString);
+    return qr;
+}
+
+int invertedIndexTerms(struct invertedIndex *ii) {
+    return ii->numTerms;
+}
+
+size_t invertedIndexBytes(struct invertedIndex *ii) {
+    size_t bytes = sizeof(*ii) + sizeof(*ii->terms) * ii->termCap +
+                   sizeof(*ii->slots) * (ii->mask + 1) + (size_t)ii->rows;
+    for (int id = 0; id < ii->numTerms; id++) {
+        bytes += strlen(ii->terms[id].text) + 1 +
+                 postingsBytes(ii->terms[id].list);
+    }
+    return bytes;
+}
+
+void invertedIndexFree(struct invertedIndex *ii) {
+    if (!ii) return;
+    memAccountFree(MEM_TEXT_INDEXES, invertedIndexBytes(ii));
+    for (int id = 0; id < ii->numTerms; id++) {
+        free(ii->terms[id].text);
+        postingsFree(ii->terms[id].list);
+    }
+    free(ii->terms);
+    free(ii->slots);
+    free(ii->lengths);
+    free(ii);
+}
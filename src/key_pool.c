@@ -0,0 +1,279 @@
+/*
+    Front-coded key pool.
+
+    Encoding of one block (lengths are LEB128 varints):
+        first key:      encodedLen, encoded bytes
+        following keys: shared, encodedLen, encoded suffix bytes
+    `shared` counts decoded bytes; blockOffsets[b] is where block b starts.
+
+    Address keys share little beyond the house number, so the bytes of a
+    suffix are also word coded: up to KEY_POOL_MAX_TOKENS frequent words
+    (a space plus the word, e.g. " STREET" or " PARKVILLE") chosen from a
+    sample of the keys are replaced by a single byte TOKEN_BASE + t. Any
+    key byte that is itself >= TOKEN_ESCAPE is written as TOKEN_ESCAPE
+    followed by the byte.
+*/
+#include "key_pool.h"
+#include "varint.h"
+#include "mem_account.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#define KEY_POOL_MAX_TOKENS 127
+#define TOKEN_ESCAPE 0x80
+#define TOKEN_BASE 0x81
+#define TOKEN_MIN_LEN 3          // space plus at least two characters
+#define TOKEN_SAMPLE_KEYS 65536
+
+/* A candidate word while choosing tokens */
+struct tokenCount {
+    const char *s;
+    size_t len;
+    size_t count;
+};
+
+struct keyPool {
+    unsigned char *bytes;
+    size_t numBytes;
+    uint32_t *blockOffsets;
+    int n;
+    size_t maxLen;
+
+    char *tokens[KEY_POOL_MAX_TOKENS];       // sorted, for encoding lookups
+    unsigned char tokenLens[KEY_POOL_MAX_TOKENS];
+    int numTokens;
+};
+
+/* Helpers */
+static int compareWords(const void *a, const void *b);
+static int compareSavings(const void *a, const void *b);
+static void chooseTokens(struct keyPool *pool, char **keys, int n);
+static int findToken(struct keyPool *pool, const char *s, size_t len);
+static size_t encodeText(struct keyPool *pool, const char *s, size_t len,
+                         unsigned char *out);
+
+/* helper: qsort order of words (bytes, then length) */
+static int compareWords(const void *a, const void *b) {
+    const struct tokenCount *x = a, *y = b;
+    size_t len = (x->len < y->len) ? x->len : y->len;
+    int cmp = memcmp(x->s, y->s, len);
+    if (cmp != 0) return cmp;
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+/* helper: qsort order by bytes saved, largest first */
+static int compareSavings(const void *a, const void *b) {
+    const struct tokenCount *x = a, *y = b;
+    size_t saveX = (x->len - 1) * x->count, saveY = (y->len - 1) * y->count;
+    return (saveX < saveY) - (saveX > saveY);
+}
+
+/* helper: pick the words that save the most bytes in a sample of keys */
+static void chooseTokens(struct keyPool *pool, char **keys, int n) {
+    int step = (n > TOKEN_SAMPLE_KEYS) ? n / TOKEN_SAMPLE_KEYS : 1;
+    size_t numWords = 0, capWords = 0;
+    struct tokenCount *words = NULL;
+
+    for (int i = 0; i < n; i += step) {
+        const char *k = keys[i];
+        for (const char *p = strchr(k, ' '); p; p = strchr(p + 1, ' ')) {
+            const char *end = strchr(p + 1, ' ');
+            size_t len = end ? (size_t)(end - p) : strlen(p);
+            if (len < TOKEN_MIN_LEN || len > UINT8_MAX) continue;
+            if (numWords == capWords) {
+                capWords = capWords ? capWords * 2 : 256;
+                words = realloc(words, sizeof(*words) * capWords);
+                assert(words);
+            }
+            words[numWords].s = p;
+            words[numWords].len = len;
+            words[numWords].count = 1;
+            numWords++;
+        }
+    }
+
+    pool->numTokens = 0;
+    if (numWords == 0) return;
+
+    // Merge equal words into counts
+    qsort(words, numWords, sizeof(*words), compareWords);
+    size_t distinct = 0;
+    for (size_t i = 0; i < numWords; i++) {
+        if (distinct > 0 && compareWords(&words[distinct - 1], &words[i]) == 0) {
+            words[distinct - 1].count++;
+        } else {
+            words[distinct++] = words[i];
+        }
+    }
+
+    // Keep the most profitable ones (a word seen once saves nothing)
+    qsort(words, distinct, sizeof(*words), compareSavings);
+    for (size_t i = 0; i < distinct && pool->numTokens < KEY_POOL_MAX_TOKENS; i++) {
+        if (words[i].count < 2) break;
+        words[pool->numTokens++] = words[i];
+    }
+    qsort(words, pool->numTokens, sizeof(*words), compareWords);
+    for (int t = 0; t < pool->numTokens; t++) {
+        pool->tokens[t] = malloc(words[t].len);
+        assert(pool->tokens[t]);
+        memcpy(pool->tokens[t], words[t].s, words[t].len);
+        pool->tokenLens[t] = (unsigned char)words[t].len;
+    }
+    free(words);
+}
+
+/* helper: token number of the word s[0..len), or -1 */
+static int findToken(struct keyPool *pool, const char *s, size_t len) {
+    int lo = 0, hi = pool->numTokens - 1;
+    struct tokenCount word = {s, len, 0};
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        struct tokenCount token = {pool->tokens[mid], pool->tokenLens[mid], 0};
+        int cmp = compareWords(&word, &token);
+        if (cmp == 0) return mid;
+        if (cmp < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    return -1;
+}
+
+/* helper: word code s[0..len) into out, returns bytes written */
+static size_t encodeText(struct keyPool *pool, const char *s, size_t len,
+                         unsigned char *out) {
+    size_t used = 0;
+    size_t i = 0;
+    while (i < len) {
+        if (s[i] == ' ') {
+            const char *end = memchr(s + i + 1, ' ', len - i - 1);
+            size_t wordLen = end ? (size_t)(end - (s + i)) : len - i;
+            int t = findToken(pool, s + i, wordLen);
+            if (t >= 0) {
+                out[used++] = (unsigned char)(TOKEN_BASE + t);
+                i += wordLen;
+                continue;
+            }
+        }
+        if ((unsigned char)s[i] >= TOKEN_ESCAPE) {
+            out[used++] = TOKEN_ESCAPE;
+        }
+        out[used++] = (unsigned char)s[i++];
+    }
+    return used;
+}
+
+struct keyPool *keyPoolNew(char **sortedKeys, int n) {
+    assert(n >= 0 && (sortedKeys || n == 0));
+    struct keyPool *pool = malloc(sizeof(*pool));
+    assert(pool);
+    pool->n = n;
+    pool->maxLen = 0;
+    chooseTokens(pool, sortedKeys, n);
+
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(sortedKeys[i]);
+        if (len > pool->maxLen) pool->maxLen = len;
+    }
+    int numBlocks = (n + KEY_POOL_BLOCK_KEYS - 1) / KEY_POOL_BLOCK_KEYS;
+    pool->blockOffsets = malloc(sizeof(uint32_t) * (numBlocks > 0 ? numBlocks : 1));
+    // Worst case for one key: every byte escaped plus three varints
+    size_t keyBound = 2 * pool->maxLen + 3 * VARINT_MAX_BYTES;
+    size_t cap = keyBound * KEY_POOL_BLOCK_KEYS;
+    unsigned char *out = malloc(cap);
+    unsigned char *scratch = malloc(keyBound);
+    assert(pool->blockOffsets && out && scratch);
+
+    size_t used = 0;
+    for (int i = 0; i < n; i++) {
+        const char *key = sortedKeys[i];
+        size_t len = strlen(key);
+        size_t shared = 0;
+        if (used + keyBound > cap) {
+            cap *= 2;
+            out = realloc(out, cap);
+            assert(out);
+        }
+        if (i % KEY_POOL_BLOCK_KEYS == 0) {
+            assert(used <= UINT32_MAX);
+            pool->blockOffsets[i / KEY_POOL_BLOCK_KEYS] = (uint32_t)used;
+        } else {
+            const char *prev = sortedKeys[i - 1];
+            while (shared < len && prev[shared] == key[shared]) {
+                shared++;
+            }
+            used += putVarint(out + used, shared);
+        }
+        size_t encoded = encodeText(pool, key + shared, len - shared, scratch);
+        used += putVarint(out + used, encoded);
+        memcpy(out + used, scratch, encoded);
+        used += encoded;
+    }
+    free(scratch);
+
+    // Shrink to the encoded size
+    pool->bytes = realloc(out, used > 0 ? used : 1);
+    assert(pool->bytes);
+    pool->numBytes = used;
+    memAccountAlloc(MEM_LEAF_KEYS, keyPoolBytes(pool));
+    return pool;
+}
+
+int keyPoolSize(struct keyPool *pool) {
+    return pool->n;
+}
+
+size_t keyPoolMaxLen(struct keyPool *pool) {
+    return pool->maxLen;
+}
+
+char *keyPoolGet(struct keyPool *pool, int id, char *buf) {
+    assert(id >= 0 && id < pool->n && buf);
+    const unsigned char *in = pool->bytes + pool->blockOffsets[id / KEY_POOL_BLOCK_KEYS];
+
+    // Replay the front-coded keys of the block up to `id`
+    size_t len = 0;
+    for (int k = 0; k <= id % KEY_POOL_BLOCK_KEYS; k++) {
+        size_t shared = 0, encoded = 0;
+        if (k > 0) {
+            in += getVarint(in, &shared);
+        }
+        in += getVarint(in, &encoded);
+        len = shared;
+        const unsigned char *end = in + encoded;
+        while (in < end) {
+            unsigned char c = *in++;
+            if (c == TOKEN_ESCAPE) {
+                buf[len++] = (char)*in++;
+            } else if (c >= TOKEN_BASE) {
+                memcpy(buf + len, pool->tokens[c - TOKEN_BASE], pool->tokenLens[c - TOKEN_BASE]);
+                len += pool->tokenLens[c - TOKEN_BASE];
+            } else {
+                buf[len++] = (char)c;
+            }
+        }
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+size_t keyPoolBytes(struct keyPool *pool) {
+    int numBlocks = (pool->n + KEY_POOL_BLOCK_KEYS - 1) / KEY_POOL_BLOCK_KEYS;
+    size_t bytes = sizeof(*pool) + pool->numBytes + sizeof(uint32_t) * numBlocks;
+    for (int t = 0; t < pool->numTokens; t++) {
+        bytes += pool->tokenLens[t];
+    }
+    return bytes;
+}
+
+void keyPoolFree(struct keyPool *pool) {
+    if (!pool) return;
+    memAccountFree(MEM_LEAF_KEYS, keyPoolBytes(pool));
+    for (int t = 0; t < pool->numTokens; t++) {
+        free(pool->tokens[t]);
+    }
+    free(pool->bytes);
+    free(pool->blockOffsets);
+    free(pool);
+}
@@ -6,7 +6,9 @@
     Provides:
         - create (specify key field index)
         - insert
-        - lookup by exact string on chosen key field
+        - lookup by exact string on chosen key field, with or without
+          comparison counts
+        - an optional Bloom filter that answers most misses without a scan
         - free
 
     This module uses common functions from dict_common.c
@@ -14,6 +16,7 @@
 #include "dict_common.h"
 #include "linked_list_dict.h"
 #include "bit.h"
+#include "bloom_filter.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,8 +38,18 @@ struct llDict {
     struct llDictNode *head;
     struct llDictNode *tail;
     int keyFieldIndex;   // which field is used for lookups
+    struct bloomFilter *bloom;   // NULL unless enabled
+    struct queryResult *(*lookup)(struct llDict *, char *);  // counted or plain
 };
 
+/* Helpers */
+static inline struct queryResult *scanList(struct llDict *dict, char *query,
+                                           int counting);
+static struct queryResult *lookupCounted(struct llDict *dict, char *query);
+static struct queryResult *lookupPlain(struct llDict *dict, char *query);
+static int keyMatchCounted(char *query, int queryBitCount, char *candidateKey,
+                           int *bitCount);
+
 /* --------------------- Linked List Dictionary --------------------- */
 
 /* Create a new linked list dictionary, specify key field index */
@@ -47,9 +60,25 @@ struct llDict *llDictNew(int keyFieldIndex) {
     ret->head = NULL;
     ret->tail = NULL;
     ret->keyFieldIndex = keyFieldIndex;
+    ret->bloom = NULL;
+    ret->lookup = lookupCounted;
     return ret;
 }
 
+/* Choose the counted or the plain lookup */
+void llDictSetCounting(struct llDict *dict, int counting) {
+    assert(dict);
+    dict->lookup = counting ? lookupCounted : lookupPlain;
+}
+
+/* Keep a Bloom filter of the keys inserted from now on */
+void llDictEnableBloom(struct llDict *dict, int expectedKeys, int bitsPerKey) {
+    assert(dict && !dict->head && !dict->bloom);
+    dict->bloom = bloomFilterNew(expectedKeys, bitsPerKey);
+    // A list is scanned by one thread, so counting costs no contention
+    bloomFilterSetCounting(dict->bloom, 1);
+}
+
 /* Insert a CSV record into the linked list dictionary */
 void llDictInsert(struct llDict *dict, struct csvRecord *record) {
     if (!dict) return;
@@ -57,6 +86,10 @@ void llDictInsert(struct llDict *dict, struct csvRecord *record) {
     assert(newNode);
     newNode->record = readRecord(record);  // from dict_common
     newNode->next = NULL;
+    if (dict->bloom) {
+        bloomFilterAdd(dict->bloom,
+                       dataField(newNode->record, dict->keyFieldIndex));
+    }
 
     if (!dict->head) {
         dict->head = newNode;
@@ -69,38 +102,80 @@ void llDictInsert(struct llDict *dict, struct csvRecord *record) {
 
 /* Lookup by exact string match on the configured key field */
 struct queryResult *llDictLookup(struct llDict *dict, char *query) {
-    int numRecords = 0;
+    return dict->lookup(dict, query);
+}
+
+/* helpers: the two specialisations of scanList; the plain one compiles
+   without any of the counting */
+static struct queryResult *lookupCounted(struct llDict *dict, char *query) {
+    return scanList(dict, query, 1);
+}
+
+static struct queryResult *lookupPlain(struct llDict *dict, char *query) {
+    return scanList(dict, query, 0);
+}
+
+/* helper: compare a key with the query bit by bit, adding the bits
+   compared to *bitCount; returns 1 if they are equal */
+static int keyMatchCounted(char *query, int queryBitCount, char *candidateKey,
+                           int *bitCount) {
+    int nodeBitCount = (strlen(candidateKey) + 1) * BITS_PER_BYTE;
+
+    for (int i = 0; i <= nodeBitCount && i <= queryBitCount; i++) {
+        if (i == queryBitCount && i == nodeBitCount) {
+            return 1;
+        } else if (i == queryBitCount || i == nodeBitCount) {
+            return 0; /* one string ended */
+        } else {
+            (*bitCount)++;
+            if (getBit(query, i) != getBit(candidateKey, i)) {
+                return 0;
+            }
+        }
+    }
+    return 0;
+}
+
+/* helper: scan the list for query; with counting 0 the counts stay 0 and
+   keys are compared with strcmp */
+static inline __attribute__((always_inline))
+struct queryResult *scanList(struct llDict *dict, char *query, int counting) {
+    int numRecords = 0, capacity = 0;
     struct data **records = NULL;
     int bitCount = 0, nodeCount = 0, stringCount = 0;
-    int queryBitCount = (strlen(query) + 1) * BITS_PER_BYTE;
+    int queryBitCount = counting ? (strlen(query) + 1) * BITS_PER_BYTE : 0;
 
-    struct llDictNode *current = dict->head;
+    /* A key the filter rejects is in no node: skip the scan */
+    int rejected = dict->bloom && !bloomFilterMayContain(dict->bloom, query);
+    struct llDictNode *current = rejected ? NULL : dict->head;
     while (current) {
-        nodeCount++;
-        stringCount++;
-
-        char *candidateKey = current->record->fields[dict->keyFieldIndex];
-        int nodeBitCount = (strlen(candidateKey) + 1) * BITS_PER_BYTE;
+        char *candidateKey = dataField(current->record, dict->keyFieldIndex);
+        int match;
+        if (counting) {
+            nodeCount++;
+            stringCount++;
+            match = keyMatchCounted(query, queryBitCount, candidateKey,
+                                    &bitCount);
+        } else {
+            match = strcmp(query, candidateKey) == 0;
+        }
 
-        for (int i = 0; i <= nodeBitCount && i <= queryBitCount; i++) {
-            if (i == queryBitCount && i == nodeBitCount) {
-                /* Match */
-                records = realloc(records, sizeof(struct data *) * (numRecords + 1));
+        if (match) {
+            /* Match: grow geometrically, not once per record */
+            if (numRecords == capacity) {
+                capacity = capacity ? capacity * 2 : 1;
+                records = realloc(records, sizeof(struct data *) * capacity);
                 assert(records);
-                records[numRecords++] = current->record;
-                break;
-            } else if (i == queryBitCount || i == nodeBitCount) {
-                break; /* one string ended */
-            } else {
-                bitCount++;
-                if (getBit(query, i) != getBit(candidateKey, i)) {
-                    break;
-                }
             }
+            records[numRecords++] = current->record;
         }
         current = current->next;
     }
 
+    if (dict->bloom && !rejected && numRecords == 0) {
+        bloomFilterMissed(dict->bloom);
+    }
+
     struct queryResult *qr = malloc(sizeof(struct queryResult));
     assert(qr);
     qr->searchString = strdup(query);
@@ -112,9 +187,16 @@ struct queryResult *llDictLookup(struct llDict *dict, char *query) {
     return qr;
 }
 
+/* Print the filter's expected and measured false positive rates */
+void llDictPrintFilterStats(struct llDict *dict, FILE *out) {
+    assert(dict && out);
+    if (dict->bloom) bloomFilterPrintStats(dict->bloom, "key", out);
+}
+
 /* Free entire linked list dictionary */
 void llDictFree(struct llDict *dict) {
     if (!dict) return;
+    bloomFilterFree(dict->bloom);
     struct llDictNode *current = dict->head;
     while (current) {
         struct llDictNode *next = current->next;
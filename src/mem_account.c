@@ -0,0 +1,94 @@
+/*
+    Memory accounting: one cache line of counters per category and one
+    for the total, updated with relaxed atomics; peaks are raised with a
+    compare-and-swap.
+*/
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#define CACHE_LINE 64
+#define MB (1024.0 * 1024.0)
+
+struct memCounter {
+    _Alignas(CACHE_LINE) atomic_long bytes;   // live
+    atomic_long allocs;                       // live
+    atomic_long peak;                         // highest live bytes seen
+};
+
+static struct memCounter counters[MEM_CATEGORIES];
+
+static const char *categoryNames[MEM_CATEGORIES] = {
+    "csv fields", "data records", "tree nodes", "leaf keys",
+    "record arrays", "query buffers", "symspell", "text indexes",
+    "k-d tree", "typed columns", "bloom filters"
+};
+
+// All categories together, for the true high-water mark: the sum of the
+// per-category peaks overstates it, as they are reached at different times
+static struct memCounter total;
+
+/* Helpers */
+static void addBytes(struct memCounter *c, long delta);
+
+/* helper: add delta to the live bytes and raise the peak */
+static void addBytes(struct memCounter *c, long delta) {
+    long now = atomic_fetch_add_explicit(&c->bytes, delta,
+                                         memory_order_relaxed) + delta;
+    long peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+    while (now > peak &&
+           !atomic_compare_exchange_weak_explicit(&c->peak, &peak, now,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+void memAccountAlloc(enum memCategory c, size_t bytes) {
+    atomic_fetch_add_explicit(&counters[c].allocs, 1, memory_order_relaxed);
+    addBytes(&counters[c], (long)bytes);
+    addBytes(&total, (long)bytes);
+}
+
+void memAccountFree(enum memCategory c, size_t bytes) {
+    atomic_fetch_sub_explicit(&counters[c].allocs, 1, memory_order_relaxed);
+    addBytes(&counters[c], -(long)bytes);
+    addBytes(&total, -(long)bytes);
+}
+
+void memAccountResize(enum memCategory c, size_t oldBytes, size_t newBytes) {
+    addBytes(&counters[c], (long)newBytes - (long)oldBytes);
+    addBytes(&total, (long)newBytes - (long)oldBytes);
+}
+
+long memAccountBytes(enum memCategory c) {
+    return atomic_load_explicit(&counters[c].bytes, memory_order_relaxed);
+}
+
+void memAccountPrint(FILE *out, int records) {
+    double perRecord = records > 0 ? 1.0 / records : 0.0;
+    long totalBytes = 0, totalAllocs = 0;
+    fprintf(out, "memory: %-14s %10s %12s %12s %10s\n", "category",
+            "allocs", "bytes", "peak bytes", "B/record");
+    for (int i = 0; i < MEM_CATEGORIES; i++) {
+        long bytes = atomic_load(&counters[i].bytes);
+        long allocs = atomic_load(&counters[i].allocs);
+        long peak = atomic_load(&counters[i].peak);
+        fprintf(out, "memory: %-14s %10ld %12ld %12ld %10.1f\n",
+                categoryNames[i], allocs, bytes, peak, bytes * perRecord);
+        totalBytes += bytes;
+        totalAllocs += allocs;
+    }
+    fprintf(out, "memory: %-14s %10ld %12ld %12ld %10.1f\n", "total",
+            totalAllocs, totalBytes, atomic_load(&total.peak),
+            totalBytes * perRecord);
+
+    // ru_maxrss is in kilobytes on Linux
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(out, "memory: peak RSS %.1f MB, %d records; "
+                 "%d records would take about %.0f MB\n",
+            usage.ru_maxrss / 1024.0, records, MEM_PROJECTION_RECORDS,
+            totalBytes * perRecord * MEM_PROJECTION_RECORDS / MB);
+}
@@ -0,0 +1,409 @@
+/*
+    Multi-index implementation: a list of Patricia tree dictionaries that
+    reference rows of one recordStore. Composite keys are built by
+    joining the chosen columns with a single space.
+*/
+#include "multi_index.h"
+#include "patricia_tree_dict.h"
+#include "record_store.h"
+#include "symspell.h"
+#include "bloom_filter.h"
+#include "dict_common.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define COMPOSITE_SEPARATOR " "
+
+/* One declared index */
+struct miIndex {
+    char *name;                    // spec as declared, e.g. "POSTCODE+LOCALITY"
+    int columns[MI_MAX_COLUMNS];
+    int numColumns;
+    struct ptDict *dict;
+    struct symSpell *spell;        // NULL unless SymSpell is enabled
+    struct bloomFilter *bloom;     // NULL unless a filter is enabled
+};
+
+struct multiIndex {
+    struct recordStore *store;
+    char **headers;
+    struct miIndex indexes[MI_MAX_INDEXES];
+    int numIndexes;
+    int spellDistance;             // 0: no SymSpell indexes
+    int bloomBitsPerKey;           // 0: no key filters
+    int bloomStats;                // filters count their probes
+    int exact;                     // misses are not corrected
+    int counting;                  // tree lookups fill comparison counts
+};
+
+/* Helpers */
+static int columnIndex(char **headers, const char *name, size_t len);
+static char *buildKey(struct miIndex *index, struct data *rec);
+static void addBloomKey(const char *key, void *arg);
+static void *buildIndexThread(void *arg);
+static struct miIndex *resolveIndex(struct multiIndex *mi, char *query,
+                                    char **value);
+static void spellLookupSpan(struct miIndex *index, char *value,
+                            struct resultSpan *span);
+static void exactLookupSpan(struct miIndex *index, char *value,
+                            struct resultSpan *span);
+
+struct multiIndex *multiIndexNew(struct recordStore *store, char **headers) {
+    assert(store && headers);
+    struct multiIndex *mi = malloc(sizeof(*mi));
+    assert(mi);
+    mi->store = store;
+    mi->headers = headers;
+    mi->numIndexes = 0;
+    mi->spellDistance = 0;
+    mi->bloomBitsPerKey = 0;
+    mi->bloomStats = 0;
+    mi->exact = 0;
+    mi->counting = 1;
+    return mi;
+}
+
+/* helper: position of the header called name[0..len), or -1 */
+static int columnIndex(char **headers, const char *name, size_t len) {
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (strlen(headers[i]) == len && strncmp(headers[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int multiIndexDeclare(struct multiIndex *mi, const char *spec) {
+    assert(mi && spec);
+    if (mi->numIndexes == MI_MAX_INDEXES || strchr(spec, MI_NAME_SEPARATOR)) {
+        return -1;
+    }
+    struct miIndex *index = &mi->indexes[mi->numIndexes];
+    index->numColumns = 0;
+
+    const char *start = spec;
+    while (1) {
+        const char *end = strchr(start, MI_COLUMN_SEPARATOR);
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        int column = columnIndex(mi->headers, start, len);
+        if (column < 0 || index->numColumns == MI_MAX_COLUMNS) {
+            return -1;
+        }
+        index->columns[index->numColumns++] = column;
+        if (!end) break;
+        start = end + 1;
+    }
+
+    index->name = strdup(spec);
+    assert(index->name);
+    index->dict = ptDictNew(index->columns[0]);
+    ptDictSetCounting(index->dict, mi->counting);
+    index->spell = NULL;
+    index->bloom = NULL;
+    return mi->numIndexes++;
+}
+
+/* helper: the key of `rec` in `index`; a fresh string the caller frees */
+static char *buildKey(struct miIndex *index, struct data *rec) {
+    size_t len = 0;
+    for (int c = 0; c < index->numColumns; c++) {
+        len += strlen(dataField(rec, index->columns[c])) + 1;
+    }
+    char *key = malloc(len);
+    assert(key);
+    memAccountAlloc(MEM_LEAF_KEYS, len);
+    key[0] = '\0';
+    for (int c = 0; c < index->numColumns; c++) {
+        if (c > 0) strcat(key, COMPOSITE_SEPARATOR);
+        strcat(key, dataField(rec, index->columns[c]));
+    }
+    return key;
+}
+
+struct buildJob {
+    struct miIndex *index;
+    struct recordStore *store;
+    int spellDistance;
+    int bloomBitsPerKey;
+    int bloomStats;
+    int threads;                   // threads for this index's tree
+};
+
+/* helper: ptKeyFn adding a key to a Bloom filter */
+static void addBloomKey(const char *key, void *arg) {
+    bloomFilterAdd(arg, key);
+}
+
+/* helper: thread body inserting every row of the store into one index */
+static void *buildIndexThread(void *arg) {
+    struct buildJob *job = arg;
+    struct miIndex *index = job->index;
+    int n = recordStoreSize(job->store);
+    // Single column keys are borrowed from the store unless they are
+    // only cached (on-disk rows); composite keys only have to last until
+    // they are compacted into the key pool
+    int copyKeys = index->numColumns > 1 ||
+                   (n > 0 && !dataFieldStable(recordStoreGet(job->store, 0),
+                                              index->columns[0]));
+    char **keys = malloc(sizeof(char *) * (n > 0 ? n : 1));
+    struct data **recs = malloc(sizeof(struct data *) * (n > 0 ? n : 1));
+    assert(keys && recs);
+    for (int row = 0; row < n; row++) {
+        recs[row] = recordStoreGet(job->store, row);
+        keys[row] = copyKeys ? buildKey(index, recs[row])
+                             : dataField(recs[row], index->columns[0]);
+    }
+    ptDictInsertAll(index->dict, keys, recs, n, job->threads);
+
+    // Built keys go into the key pool. Keys borrowed from the rows stay
+    // there: a pool would only add to the copy each row keeps, and every
+    // leaf compared would have to decode its key. SymSpell needs the
+    // pool's key ids, so it pays for one either way.
+    if (copyKeys || job->spellDistance > 0) {
+        ptDictCompactKeys(index->dict);
+    }
+    if (copyKeys) {
+        for (int row = 0; row < n; row++) {
+            memAccountFree(MEM_LEAF_KEYS, strlen(keys[row]) + 1);
+            free(keys[row]);
+        }
+    }
+    free(keys);
+    free(recs);
+
+    struct keyPool *pool = ptDictKeyPool(index->dict);
+    if (job->spellDistance > 0 && pool) {
+        index->spell = symSpellNew(pool, job->spellDistance,
+                                   SYMSPELL_PREFIX_LENGTH);
+    }
+    // The filter holds the distinct keys, taken from the tree in order
+    if (job->bloomBitsPerKey > 0) {
+        index->bloom = bloomFilterNew(ptDictKeyCount(index->dict),
+                                      job->bloomBitsPerKey);
+        ptDictForEachKey(index->dict, addBloomKey, index->bloom);
+        bloomFilterSetCounting(index->bloom, job->bloomStats);
+    }
+    return NULL;
+}
+
+void multiIndexBuild(struct multiIndex *mi, int threads) {
+    assert(mi && threads >= 1);
+    pthread_t tids[MI_MAX_INDEXES];
+    struct buildJob jobs[MI_MAX_INDEXES];
+
+    // Indexes are built side by side and share the threads out
+    int perIndex = mi->numIndexes > 0 ? threads / mi->numIndexes : 1;
+    if (perIndex < 1) perIndex = 1;
+    if (perIndex > PT_MAX_BUILD_THREADS) perIndex = PT_MAX_BUILD_THREADS;
+    for (int i = 0; i < mi->numIndexes; i++) {
+        jobs[i].index = &mi->indexes[i];
+        jobs[i].store = mi->store;
+        jobs[i].spellDistance = mi->spellDistance;
+        jobs[i].bloomBitsPerKey = mi->bloomBitsPerKey;
+        jobs[i].bloomStats = mi->bloomStats;
+        jobs[i].threads = perIndex;
+        int err = pthread_create(&tids[i], NULL, buildIndexThread, &jobs[i]);
+        assert(err == 0);
+    }
+    for (int i = 0; i < mi->numIndexes; i++) {
+        pthread_join(tids[i], NULL);
+    }
+}
+
+/* helper: the index named by a "NAME:" prefix of query (value points past
+   it), or the default index (value is the whole query) */
+static struct miIndex *resolveIndex(struct multiIndex *mi, char *query,
+                                    char **value) {
+    *value = query;
+    char *sep = strchr(query, MI_NAME_SEPARATOR);
+    if (sep) {
+        for (int i = 0; i < mi->numIndexes; i++) {
+            size_t len = strlen(mi->indexes[i].name);
+            if ((size_t)(sep - query) == len &&
+                strncmp(query, mi->indexes[i].name, len) == 0) {
+                *value = sep + 1;
+                return &mi->indexes[i];
+            }
+        }
+    }
+    return &mi->indexes[0];
+}
+
+/* helper: exact lookup; if value is not a key, the globally nearest key
+   within the SymSpell distance, else the tree's own closest match */
+static void spellLookupSpan(struct miIndex *index, char *value,
+                            struct resultSpan *span) {
+    if (ptDictFindSpan(index->dict, value, span)) return;
+
+    struct resultSpan missed = *span;
+    int candidates = 0;
+    char key[keyPoolMaxLen(ptDictKeyPool(index->dict)) + 1];
+    if (symSpellCorrect(index->spell, value, key, &candidates) >= 0) {
+        ptDictFindSpan(index->dict, key, span);
+    } else {
+        ptDictLookupSpan(index->dict, value, span);
+    }
+    // Count the failed walk and every candidate compared as well
+    span->bitCount += missed.bitCount;
+    span->nodeCount += missed.nodeCount;
+    span->stringCount += missed.stringCount + candidates;
+}
+
+/* helper: exact lookup only; a key the filter rejects costs one probe
+   and no walk */
+static void exactLookupSpan(struct miIndex *index, char *value,
+                            struct resultSpan *span) {
+    if (index->bloom && !bloomFilterMayContain(index->bloom, value)) {
+        *span = (struct resultSpan){value, NULL, 0, 0, 0, 0};
+        return;
+    }
+    if (!ptDictFindSpan(index->dict, value, span) && index->bloom) {
+        bloomFilterMissed(index->bloom);
+    }
+}
+
+struct queryResult *multiIndexLookup(struct multiIndex *mi, char *query) {
+    struct resultSpan span;
+    multiIndexLookupSpan(mi, query, &span);
+    return spanToQueryResult(&span);
+}
+
+void multiIndexLookupSpan(struct multiIndex *mi, char *query,
+                          struct resultSpan *span) {
+    assert(mi && query && span && mi->numIndexes > 0);
+    char *value = NULL;
+    struct miIndex *index = resolveIndex(mi, query, &value);
+    if (mi->exact) {
+        exactLookupSpan(index, value, span);
+    } else if (index->spell) {
+        spellLookupSpan(index, value, span);
+    } else {
+        ptDictLookupSpan(index->dict, value, span);
+    }
+    // Report the query as typed, including the index name
+    span->searchString = query;
+}
+
+void multiIndexFindSpan(struct multiIndex *mi, char *query,
+                        struct resultSpan *span) {
+    assert(mi && query && span && mi->numIndexes > 0);
+    char *value = NULL;
+    struct miIndex *index = resolveIndex(mi, query, &value);
+    exactLookupSpan(index, value, span);
+    span->searchString = query;
+}
+
+struct prefixResult *multiIndexPrefixQuery(struct multiIndex *mi, char *query,
+                                           int limit) {
+    assert(mi && query && mi->numIndexes > 0 && limit > 0);
+    size_t len = strlen(MI_PREFIX_QUERY);
+    if (strncmp(query, MI_PREFIX_QUERY, len) != 0) return NULL;
+
+    // Optional "@cursor" between PREFIX and the separator; a malformed
+    // one gets an empty page rather than a lookup of the literal text
+    char *rest = query + len;
+    int cursor = 0;
+    if (*rest == MI_CURSOR_SEPARATOR) {
+        char *end = NULL;
+        errno = 0;
+        long parsed = strtol(rest + 1, &end, 10);
+        if (end == rest + 1 || errno == ERANGE || parsed < 0 ||
+            parsed > INT_MAX) {
+            return newPrefixResult(query);
+        }
+        cursor = (int)parsed;
+        rest = end;
+    }
+    if (*rest != MI_NAME_SEPARATOR) return newPrefixResult(query);
+
+    char *value = NULL;
+    struct miIndex *index = resolveIndex(mi, rest + 1, &value);
+    struct prefixResult *pr = ptDictPrefixSearch(index->dict, value, cursor, limit);
+
+    // Report the query as typed
+    free(pr->prefix);
+    pr->prefix = strdup(query);
+    assert(pr->prefix);
+    return pr;
+}
+
+void multiIndexEnableSymSpell(struct multiIndex *mi, int maxDistance) {
+    assert(mi && maxDistance >= 1 && maxDistance <= SYMSPELL_MAX_DISTANCE);
+    mi->spellDistance = maxDistance;
+}
+
+void multiIndexEnableBloom(struct multiIndex *mi, int bitsPerKey) {
+    assert(mi && bitsPerKey >= 1 && bitsPerKey <= BLOOM_MAX_BITS_PER_KEY);
+    mi->bloomBitsPerKey = bitsPerKey;
+}
+
+void multiIndexSetBloomStats(struct multiIndex *mi, int on) {
+    assert(mi);
+    mi->bloomStats = on;
+}
+
+void multiIndexSetExact(struct multiIndex *mi, int exact) {
+    assert(mi);
+    mi->exact = exact;
+}
+
+void multiIndexSetCounting(struct multiIndex *mi, int counting) {
+    assert(mi);
+    mi->counting = counting;
+    for (int i = 0; i < mi->numIndexes; i++) {
+        ptDictSetCounting(mi->indexes[i].dict, counting);
+    }
+}
+
+void multiIndexPrintStats(struct multiIndex *mi, FILE *out) {
+    assert(mi && out);
+    for (int i = 0; i < mi->numIndexes; i++) {
+        struct miIndex *index = &mi->indexes[i];
+        struct keyPool *keys = ptDictKeyPool(index->dict);
+        fprintf(out, "index %s: %d keys", index->name,
+                ptDictKeyCount(index->dict));
+        if (keys) {
+            fprintf(out, ", key pool %zu bytes", keyPoolBytes(keys));
+        } else {
+            fprintf(out, ", borrowed from the rows");
+        }
+        if (index->spell) {
+            fprintf(out, ", symspell d=%d: %zu deletions, %zu bytes",
+                    symSpellMaxDistance(index->spell),
+                    symSpellVariants(index->spell),
+                    symSpellBytes(index->spell));
+        }
+        if (index->bloom) {
+            fprintf(out, ", bloom %zu bytes", bloomFilterBytes(index->bloom));
+        }
+        fprintf(out, "\n");
+    }
+}
+
+void multiIndexPrintFilterStats(struct multiIndex *mi, FILE *out) {
+    assert(mi && out);
+    for (int i = 0; i < mi->numIndexes; i++) {
+        if (mi->indexes[i].bloom) {
+            bloomFilterPrintStats(mi->indexes[i].bloom, mi->indexes[i].name,
+                                  out);
+        }
+    }
+}
+
+void multiIndexFree(struct multiIndex *mi) {
+    if (!mi) return;
+    for (int i = 0; i < mi->numIndexes; i++) {
+        symSpellFree(mi->indexes[i].spell);
+        bloomFilterFree(mi->indexes[i].bloom);
+        ptDictFree(mi->indexes[i].dict);
+        free(mi->indexes[i].name);
+    }
+    free(mi);
+}
@@ -0,0 +1,315 @@
+/*
+    Output formats: every answer is a query and a list of rows of string
+    values, written into the writer's buffer with the quoting of its
+    format. Headers are written once, when the writer is created.
+*/
+#include "output_format.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#define BINARY_MAGIC "ADB1"
+#define PREFIX_COLUMNS 2      // completion key and record count
+#define COUNT_CHARS 16
+
+static const char *formatNames[] = {"text", "ndjson", "tsv", "binary"};
+
+struct recordWriter {
+    FILE *out;
+    enum outputFormat format;
+    char **headers;
+    int fields[NUM_FIELDS];
+    int numFields;
+    char *buf;
+    size_t len;
+};
+
+/* Helpers */
+static void flushBuffer(struct recordWriter *w);
+static void put(struct recordWriter *w, const char *text, size_t len);
+static void putText(struct recordWriter *w, const char *text);
+static void putChar(struct recordWriter *w, char c);
+static void putU32(struct recordWriter *w, uint32_t v);
+static void putValue(struct recordWriter *w, const char *value);
+static void writeStreamHeader(struct recordWriter *w);
+static void beginAnswer(struct recordWriter *w, const char *query,
+                        int numRows, int numColumns);
+static void beginRow(struct recordWriter *w, const char *query, int row);
+static void putColumn(struct recordWriter *w, const char *header,
+                      const char *value, int column);
+static void endRow(struct recordWriter *w);
+static void endAnswer(struct recordWriter *w);
+
+/* helper: write the buffer to the output file */
+static void flushBuffer(struct recordWriter *w) {
+    if (w->len == 0) return;
+    size_t done = fwrite(w->buf, 1, w->len, w->out);
+    assert(done == w->len);
+    w->len = 0;
+}
+
+/* helper: append len bytes, flushing first if they do not fit */
+static void put(struct recordWriter *w, const char *text, size_t len) {
+    if (w->len + len > OUTPUT_BUFFER_BYTES) {
+        flushBuffer(w);
+        if (len > OUTPUT_BUFFER_BYTES) {
+            size_t done = fwrite(text, 1, len, w->out);
+            assert(done == len);
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, text, len);
+    w->len += len;
+}
+
+static void putText(struct recordWriter *w, const char *text) {
+    put(w, text, strlen(text));
+}
+
+static void putChar(struct recordWriter *w, char c) {
+    if (w->len == OUTPUT_BUFFER_BYTES) flushBuffer(w);
+    w->buf[w->len++] = c;
+}
+
+/* helper: little-endian 32-bit integer */
+static void putU32(struct recordWriter *w, uint32_t v) {
+    char bytes[4] = {(char)(v & 0xff), (char)((v >> 8) & 0xff),
+                     (char)((v >> 16) & 0xff), (char)(v >> 24)};
+    put(w, bytes, sizeof(bytes));
+}
+
+/* helper: one string value, quoted for the writer's format. Runs of
+   characters that need no quoting are copied in one go. */
+static void putValue(struct recordWriter *w, const char *value) {
+    if (w->format == OUTPUT_TEXT) {
+        putText(w, value);
+        return;
+    }
+    size_t len = strlen(value);
+    if (w->format == OUTPUT_BINARY) {
+        putU32(w, (uint32_t)len);
+        put(w, value, len);
+        return;
+    }
+
+    int json = w->format == OUTPUT_NDJSON;
+    if (json) putChar(w, '"');
+    const char *run = value;
+    for (const char *p = value; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        const char *escape = NULL;
+        char control[8];
+        if (c == '\\') {
+            escape = "\\\\";
+        } else if (c == '\t') {
+            escape = "\\t";
+        } else if (c == '\n') {
+            escape = "\\n";
+        } else if (json && c == '"') {
+            escape = "\\\"";
+        } else if (json && c < 0x20) {
+            snprintf(control, sizeof(control), "\\u%04x", c);
+            escape = control;
+        } else if (!json && c == '\r') {
+            escape = "\\r";
+        }
+        if (!escape) continue;
+        put(w, run, (size_t)(p - run));
+        putText(w, escape);
+        run = p + 1;
+    }
+    put(w, run, strlen(run));
+    if (json) putChar(w, '"');
+}
+
+/* helper: the part of a stream written once, before any answer */
+static void writeStreamHeader(struct recordWriter *w) {
+    switch (w->format) {
+    case OUTPUT_NDJSON:
+        putText(w, "{\"fields\":[");
+        for (int i = 0; i < w->numFields; i++) {
+            if (i > 0) putChar(w, ',');
+            putValue(w, w->headers[w->fields[i]]);
+        }
+        putText(w, "]}\n");
+        break;
+    case OUTPUT_TSV:
+        putText(w, "query");
+        for (int i = 0; i < w->numFields; i++) {
+            putChar(w, '\t');
+            putValue(w, w->headers[w->fields[i]]);
+        }
+        putChar(w, '\n');
+        break;
+    case OUTPUT_BINARY:
+        put(w, BINARY_MAGIC, strlen(BINARY_MAGIC));
+        putU32(w, (uint32_t)w->numFields);
+        for (int i = 0; i < w->numFields; i++) {
+            putValue(w, w->headers[w->fields[i]]);
+        }
+        break;
+    case OUTPUT_TEXT:
+        break;
+    }
+}
+
+/* helper: start the answer to a query */
+static void beginAnswer(struct recordWriter *w, const char *query,
+                        int numRows, int numColumns) {
+    switch (w->format) {
+    case OUTPUT_TEXT:
+        putText(w, query);
+        putChar(w, '\n');
+        if (numRows == 0) {
+            putText(w, "--> " NOTFOUND "\n");
+        }
+        break;
+    case OUTPUT_NDJSON:
+        putText(w, "{\"query\":");
+        putValue(w, query);
+        putText(w, ",\"rows\":[");
+        break;
+    case OUTPUT_TSV:
+        if (numRows == 0) {
+            putValue(w, query);
+            putChar(w, '\n');
+        }
+        break;
+    case OUTPUT_BINARY:
+        putValue(w, query);
+        putU32(w, (uint32_t)numRows);
+        putU32(w, (uint32_t)numColumns);
+        break;
+    }
+}
+
+/* helper: start row number `row` of an answer */
+static void beginRow(struct recordWriter *w, const char *query, int row) {
+    switch (w->format) {
+    case OUTPUT_TEXT:
+        putText(w, "--> ");
+        break;
+    case OUTPUT_NDJSON:
+        putText(w, row > 0 ? ",[" : "[");
+        break;
+    case OUTPUT_TSV:
+        putValue(w, query);
+        break;
+    case OUTPUT_BINARY:
+        break;
+    }
+}
+
+/* helper: one value of a row; header only matters to the text format */
+static void putColumn(struct recordWriter *w, const char *header,
+                      const char *value, int column) {
+    switch (w->format) {
+    case OUTPUT_TEXT:
+        putText(w, header);
+        putText(w, ": ");
+        putValue(w, value);
+        putText(w, " || ");
+        break;
+    case OUTPUT_NDJSON:
+        if (column > 0) putChar(w, ',');
+        putValue(w, value);
+        break;
+    case OUTPUT_TSV:
+        putChar(w, '\t');
+        putValue(w, value);
+        break;
+    case OUTPUT_BINARY:
+        putValue(w, value);
+        break;
+    }
+}
+
+static void endRow(struct recordWriter *w) {
+    if (w->format == OUTPUT_NDJSON) {
+        putChar(w, ']');
+    } else if (w->format != OUTPUT_BINARY) {
+        putChar(w, '\n');
+    }
+}
+
+static void endAnswer(struct recordWriter *w) {
+    if (w->format == OUTPUT_NDJSON) putText(w, "]}\n");
+}
+
+int outputFormatByName(const char *name) {
+    int count = (int)(sizeof(formatNames) / sizeof(formatNames[0]));
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, formatNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+struct recordWriter *recordWriterNew(FILE *out, enum outputFormat format,
+                                     char **headers, const int *fields,
+                                     int numFields) {
+    assert(out && headers && fields && numFields > 0 &&
+           numFields <= NUM_FIELDS);
+    struct recordWriter *w = malloc(sizeof(*w));
+    assert(w);
+    w->out = out;
+    w->format = format;
+    w->headers = headers;
+    memcpy(w->fields, fields, (size_t)numFields * sizeof(*fields));
+    w->numFields = numFields;
+    w->buf = malloc(OUTPUT_BUFFER_BYTES);
+    assert(w->buf);
+    memAccountAlloc(MEM_QUERY, OUTPUT_BUFFER_BYTES);
+    w->len = 0;
+    writeStreamHeader(w);
+    return w;
+}
+
+void recordWriterRecords(struct recordWriter *w, const char *query,
+                         struct data **records, int numRecords) {
+    assert(w && query && (records || numRecords == 0));
+    beginAnswer(w, query, numRecords, w->numFields);
+    dataPrefetch(records, numRecords);
+    for (int r = 0; r < numRecords; r++) {
+        beginRow(w, query, r);
+        for (int c = 0; c < w->numFields; c++) {
+            int field = w->fields[c];
+            putColumn(w, w->headers[field], dataField(records[r], field), c);
+        }
+        endRow(w);
+    }
+    endAnswer(w);
+}
+
+void recordWriterPrefix(struct recordWriter *w, struct prefixResult *r) {
+    assert(w && r);
+    beginAnswer(w, r->prefix, r->numKeys, PREFIX_COLUMNS);
+    for (int k = 0; k < r->numKeys; k++) {
+        char count[COUNT_CHARS];
+        snprintf(count, sizeof(count), "%d", r->recordCounts[k]);
+        beginRow(w, r->prefix, k);
+        if (w->format == OUTPUT_TEXT) {
+            // Same line as printPrefixResult
+            putText(w, r->keys[k]);
+            putText(w, " (");
+            putText(w, count);
+            putText(w, " records)\n");
+            continue;
+        }
+        putColumn(w, NULL, r->keys[k], 0);
+        putColumn(w, NULL, count, 1);
+        endRow(w);
+    }
+    endAnswer(w);
+}
+
+void recordWriterFree(struct recordWriter *w) {
+    if (!w) return;
+    flushBuffer(w);
+    memAccountFree(MEM_QUERY, OUTPUT_BUFFER_BYTES);
+    free(w->buf);
+    free(w);
+}
@@ -3,35 +3,90 @@
 #include <assert.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "patricia_tree_dict.h"
 #include "bit.h"
+#include "key_pool.h"
+#include "edit_distance.h"
+#include "mem_account.h"
+
+/* Parallel build: rows are partitioned by the first two bytes of
+   their key */
+#define PARTITION_BITS 16
+#define NUM_PARTITIONS (1 << PARTITION_BITS)
+
+/* bitIndex of a leaf */
+#define PT_LEAF -1
+
+/* Size of a buffer able to hold any key decoded from dict->keys */
+#define KEY_BUF_LEN(dict) ((dict)->keys ? keyPoolMaxLen((dict)->keys) + 1 : 1)
+
+struct ptNode;
+struct ptBranch;
+struct ptLeaf;
 
 /* Helpers*/
 static inline unsigned int keyBits(const char *key);
+static inline int isLeaf(const struct ptNode *node);
+static inline struct ptBranch *asBranch(struct ptNode *node);
+static inline struct ptLeaf *asLeaf(struct ptNode *node);
+static inline int subtreeKeys(struct ptNode *node);
 static struct ptNode *ptNodeNewLeaf(char *key, struct data *record);
-static void ptNodeAddRecord(struct ptNode *node, struct data *record);
-static int editDistance(char *str1, char *str2, int n, int m);
-static int minOf3(int a, int b, int c);
-static void collectDescendants(struct ptNode *node,
-                               struct data ***list,
-                               int *count,
-                               int *cap);
-static void freeNode(struct ptNode *node);
-
-
-/* Node in the Patricia tree */
+static struct ptNode *ptNodeNewBranch(unsigned int bitIndex,
+                                      struct ptNode *zero, struct ptNode *one);
+static struct ptLeaf *descendToLeaf(struct ptNode *node, char *key,
+                                    unsigned int bits, int *depth);
+static struct ptNode *mismatchNode(struct ptNode *root, char *key,
+                                   unsigned int mismatch,
+                                   struct ptBranch **parent, int *depth);
+static struct ptLeaf *firstLeaf(struct ptNode *node);
+static char *leafKey(struct ptDict *dict, char *key);
+static void ptNodeAddRecord(struct ptLeaf *leaf, struct data *record);
+static void collectLeaves(struct ptNode *node,
+                          struct ptLeaf ***list,
+                          int *count,
+                          int *cap);
+static void ptDictInsertNode(struct ptDict *dict, char *key, struct data *rec);
+static void countNewKey(struct ptDict *dict, char *key, struct ptNode *stop);
+static void collectPage(struct ptDict *dict, struct ptNode *node, int skip,
+                        int limit, struct prefixResult *pr);
+static char *nodeKey(struct ptDict *dict, struct ptLeaf *leaf, char *buf);
+static void freeNode(struct ptNode *node, int freeRecords, int freeKeys);
+static inline int lookupSpan(struct ptDict *dict, char *query,
+                             struct resultSpan *qr, int allowFuzzy,
+                             int counting);
+static int lookupSpanCounted(struct ptDict *dict, char *query,
+                             struct resultSpan *qr, int allowFuzzy);
+static int lookupSpanPlain(struct ptDict *dict, char *query,
+                           struct resultSpan *qr, int allowFuzzy);
+static int keyPartition(const char *key);
+static void *buildPartitionsThread(void *arg);
+static struct ptNode *graftSubtrees(struct ptNode **roots, int lo, int hi);
+
+
+/* Node in the Patricia tree: the head of a struct ptBranch or of a
+   struct ptLeaf, told apart by bitIndex. A branch keeps no copy of the
+   prefix its keys share: any leaf below it holds those bits. */
 struct ptNode {
-    char *stem;                // compressed bits (not printable as a string)
-    unsigned int stemBits;     // how many bits the stem represents
-
-    int bitIndex;              // bit position for branching (if internal node)
+    int bitIndex;              // bit position for branching, PT_LEAF for a leaf
+};
 
+struct ptBranch {
+    struct ptNode node;
+    int keyCount;              // distinct keys (leaves) in this subtree
     struct ptNode *left;       // child when bit = 0
     struct ptNode *right;      // child when bit = 1
+};
 
-    // Records stored at this node (if any match exactly)
-    struct data **records;     // array of pointers to data
+/* One distinct key and the records stored under it, in insertion order */
+struct ptLeaf {
+    struct ptNode node;
+    int keyId;                 // key in the dict's key pool when key is NULL
+    char *key;                 // the full key (borrowed or owned as the
+                               // dict's ownsKeys says)
+    struct data **records;     // &first until a second record arrives
+    struct data *first;
     int recordCount;
     int recordCapacity;
 };
@@ -40,6 +95,11 @@ struct ptNode {
 struct ptDict {
     struct ptNode *root;
     int keyFieldIndex;         // which field of struct data is used as key (EZI_ADD = 1)
+    int ownsRecords;           // 1 if built by ptDictInsert (deep copies), 0 for references
+    int ownsKeys;              // 1 if leaves hold private copies of their keys
+    struct keyPool *keys;      // front-coded leaf keys after ptDictCompactKeys
+    int (*lookup)(struct ptDict *, char *, struct resultSpan *, int);
+                               // counted or plain, as ptDictSetCounting says
 };
 
 struct ptDict *ptDictNew(int keyFieldIndex) {
@@ -48,199 +108,412 @@ struct ptDict *ptDictNew(int keyFieldIndex) {
     assert(d);
     d->root = NULL;
     d->keyFieldIndex = keyFieldIndex;
+    d->ownsRecords = -1;       // decided by the first insert
+    d->ownsKeys = -1;
+    d->keys = NULL;
+    d->lookup = lookupSpanCounted;
     return d;
 }
 
+void ptDictSetCounting(struct ptDict *dict, int counting) {
+    assert(dict);
+    dict->lookup = counting ? lookupSpanCounted : lookupSpanPlain;
+}
+
 /* Helper: number of bits in a key including the null terminator */
 static inline unsigned int keyBits(const char *key) {
     return (strlen(key) + 1) * BITS_PER_BYTE;
 }
 
-/* Helper: allocate a new leaf node for a record */
-static struct ptNode *ptNodeNewLeaf(char *key, struct data *record) {
-    struct ptNode *node = malloc(sizeof(*node));
-    assert(node);
+/* Helpers: the two kinds of node */
+static inline int isLeaf(const struct ptNode *node) {
+    return node->bitIndex == PT_LEAF;
+}
 
-    // Store full key (treat it bit-by-bit using getBit)
-    node->stem = strdup(key);
-    assert(node->stem);
+static inline struct ptBranch *asBranch(struct ptNode *node) {
+    return (struct ptBranch *)node;
+}
 
-    // Include '\0' in bit length
-    node->stemBits = keyBits(key);
+static inline struct ptLeaf *asLeaf(struct ptNode *node) {
+    return (struct ptLeaf *)node;
+}
 
-    node->bitIndex = -1;         // leaf node, no branching
-    node->left = NULL;
-    node->right = NULL;
+/* Helper: distinct keys in the subtree of node */
+static inline int subtreeKeys(struct ptNode *node) {
+    return isLeaf(node) ? 1 : asBranch(node)->keyCount;
+}
 
-    // Store records
-    node->records = malloc(sizeof(struct data *));
-    assert(node->records);
-    node->records[0] = record;
-    node->recordCount = 1;
-    node->recordCapacity = 1;
+/* Helper: the key of a leaf, decoded into buf if it was moved to the key
+   pool */
+static char *nodeKey(struct ptDict *dict, struct ptLeaf *leaf, char *buf) {
+    if (leaf->key) return leaf->key;
+    return keyPoolGet(dict->keys, leaf->keyId, buf);
+}
 
-    return node;
+/* Helper: allocate a new leaf node for a record */
+static struct ptNode *ptNodeNewLeaf(char *key, struct data *record) {
+    struct ptLeaf *leaf = malloc(sizeof(*leaf));
+    assert(leaf);
+    memAccountAlloc(MEM_NODES, sizeof(*leaf));
+    leaf->node.bitIndex = PT_LEAF;
+
+    // Full key (treat it bit-by-bit using getBit); owned or borrowed as
+    // the dict's ownsKeys says
+    leaf->key = key;
+    leaf->keyId = -1;
+
+    // Most keys have one record: it is kept in the leaf itself
+    leaf->first = record;
+    leaf->records = &leaf->first;
+    leaf->recordCount = 1;
+    leaf->recordCapacity = 1;
+    return &leaf->node;
+}
+
+/* Helper: allocate a branch on bitIndex over the subtrees of keys whose bit
+   is 0 and 1 there */
+static struct ptNode *ptNodeNewBranch(unsigned int bitIndex,
+                                      struct ptNode *zero, struct ptNode *one) {
+    struct ptBranch *branch = malloc(sizeof(*branch));
+    assert(branch);
+    memAccountAlloc(MEM_NODES, sizeof(*branch));
+    branch->node.bitIndex = bitIndex;
+    branch->left = zero;
+    branch->right = one;
+    branch->keyCount = subtreeKeys(zero) + subtreeKeys(one);
+    return &branch->node;
 }
 
 /* Helper: Expand record array (for duplicates) */
-static void ptNodeAddRecord(struct ptNode *node, struct data *record) {
-    if (node->recordCount == node->recordCapacity) {
-        node->recordCapacity *= 2;
-        node->records = realloc(node->records,
-                                node->recordCapacity * sizeof(struct data *));
-        assert(node->records);
+static void ptNodeAddRecord(struct ptLeaf *leaf, struct data *record) {
+    if (leaf->recordCount == leaf->recordCapacity) {
+        leaf->recordCapacity *= 2;
+        if (leaf->records == &leaf->first) {
+            leaf->records = malloc(leaf->recordCapacity * sizeof(struct data *));
+            assert(leaf->records);
+            leaf->records[0] = leaf->first;
+            memAccountAlloc(MEM_RECORD_ARRAYS,
+                            leaf->recordCapacity * sizeof(struct data *));
+        } else {
+            leaf->records = realloc(leaf->records,
+                                    leaf->recordCapacity * sizeof(struct data *));
+            assert(leaf->records);
+            memAccountResize(MEM_RECORD_ARRAYS,
+                             leaf->recordCapacity / 2 * sizeof(struct data *),
+                             leaf->recordCapacity * sizeof(struct data *));
+        }
     }
-    node->records[node->recordCount++] = record;
+    leaf->records[leaf->recordCount++] = record;
 }
 
 /* Insert a record into the Patricia tree */
 void ptDictInsert(struct ptDict *dict, struct csvRecord *csvRec) {
-    assert(dict && csvRec);
+    assert(dict && csvRec && dict->ownsRecords != 0);
+    dict->ownsRecords = 1;
+    dict->ownsKeys = 0;        // the key lives in the owned record
 
     // Convert csvRecord -> data (deep copy of fields)
     struct data *rec = readRecord(csvRec);
-    char *key = rec->fields[dict->keyFieldIndex];
+    ptDictInsertNode(dict, dataField(rec, dict->keyFieldIndex), rec);
+}
+
+/* Insert a reference to a record owned elsewhere under an explicit key */
+void ptDictInsertRef(struct ptDict *dict, char *key, struct data *rec) {
+    assert(dict && key && rec && dict->ownsRecords != 1 && dict->ownsKeys != 0);
+    dict->ownsRecords = 0;
+    dict->ownsKeys = 1;
+    ptDictInsertNode(dict, key, rec);
+}
+
+/* Insert a reference under a key that outlives the dict (or its compaction) */
+void ptDictInsertBorrowed(struct ptDict *dict, char *key, struct data *rec) {
+    assert(dict && key && rec && dict->ownsRecords != 1 && dict->ownsKeys != 1);
+    dict->ownsRecords = 0;
+    dict->ownsKeys = 0;
+    ptDictInsertNode(dict, key, rec);
+}
+
+/* Helper: the key a new leaf keeps - a copy only if the dict owns its keys */
+static char *leafKey(struct ptDict *dict, char *key) {
+    if (!dict->ownsKeys) return key;
+    char *copy = strdup(key);
+    assert(copy);
+    memAccountAlloc(MEM_LEAF_KEYS, strlen(copy) + 1);
+    return copy;
+}
+
+/* Shared insertion path: descend on the key's branching bits to a leaf,
+   find the first bit where the key differs from that leaf's key, and put
+   a branch on that bit above the first node on the path whose keys all
+   share it */
+static void ptDictInsertNode(struct ptDict *dict, char *key, struct data *rec) {
     unsigned int keyLenBits = keyBits(key);
 
     // Case A: empty tree
     if (!dict->root) {
-        dict->root = ptNodeNewLeaf(key, rec);
+        dict->root = ptNodeNewLeaf(leafKey(dict, key), rec);
         return;
     }
 
-    struct ptNode *curr = dict->root;
-    struct ptNode *parent = NULL;
-
-    while (1) {
-        // Compare bit by bit against current node’s stem
-        unsigned int minBits = (keyLenBits < curr->stemBits)
-                                 ? keyLenBits
-                                 : curr->stemBits;
-
-        unsigned int i;
-        for (i = 0; i < minBits; i++) {
-            if (getBit(key, i) != getBit(curr->stem, i)) {
-                break; // mismatch
-            }
+    char keyBuf[KEY_BUF_LEN(dict)];
+    struct ptLeaf *leaf = descendToLeaf(dict->root, key, keyLenBits, NULL);
+    unsigned int mismatch = firstBitDifference(key, nodeKey(dict, leaf, keyBuf));
+
+    // Case B: the key is there → append record
+    if (mismatch == keyLenBits) {
+        ptNodeAddRecord(leaf, rec);
+        return;
+    }
+
+    // Case C: split above the node whose shared bits run past the mismatch
+    struct ptBranch *parent = NULL;
+    struct ptNode *curr = mismatchNode(dict->root, key, mismatch, &parent, NULL);
+    struct ptNode *newLeaf = ptNodeNewLeaf(leafKey(dict, key), rec);
+    struct ptNode *branch = (getBit(key, mismatch) == 0)
+                                ? ptNodeNewBranch(mismatch, newLeaf, curr)
+                                : ptNodeNewBranch(mismatch, curr, newLeaf);
+    if (!parent) {
+        dict->root = branch;
+    } else {
+        if (parent->left == curr) parent->left = branch;
+        else parent->right = branch;
+    }
+    countNewKey(dict, key, branch);
+}
+
+/* helper: follow key's branching bits from node down to a leaf; bits past
+   the end of the key (bits long) go left. Counts the nodes visited into
+   *depth if given. */
+static struct ptLeaf *descendToLeaf(struct ptNode *node, char *key,
+                                    unsigned int bits, int *depth) {
+    int visited = 1;
+    while (!isLeaf(node)) {
+        struct ptBranch *branch = asBranch(node);
+        unsigned int bit = node->bitIndex;
+        node = (bit < bits && getBit(key, bit)) ? branch->right : branch->left;
+        visited++;
+    }
+    if (depth) *depth = visited;
+    return asLeaf(node);
+}
+
+/* helper: the first node on key's path whose keys all share more than
+   `mismatch` bits, i.e. where key leaves the tree: a branch on a later
+   bit, or the leaf key reached (mismatch always lies within its key);
+   its parent (NULL for the root) and the nodes visited (if depth is
+   given) come with it */
+static struct ptNode *mismatchNode(struct ptNode *root, char *key,
+                                   unsigned int mismatch,
+                                   struct ptBranch **parent, int *depth) {
+    struct ptBranch *prev = NULL;
+    struct ptNode *node = root;
+    int visited = 1;
+    while (!isLeaf(node) && (unsigned int)node->bitIndex <= mismatch) {
+        prev = asBranch(node);
+        node = (getBit(key, node->bitIndex) == 0) ? prev->left : prev->right;
+        visited++;
+    }
+    if (parent) *parent = prev;
+    if (depth) *depth = visited;
+    return node;
+}
+
+/* helper: the smallest leaf of a subtree, whose key holds the bits every
+   key of the subtree shares */
+static struct ptLeaf *firstLeaf(struct ptNode *node) {
+    while (!isLeaf(node)) node = asBranch(node)->left;
+    return asLeaf(node);
+}
+
+/* helper: partition of a key - its first two bytes (the empty key has
+   only one) */
+static int keyPartition(const char *key) {
+    const unsigned char *k = (const unsigned char *)key;
+    if (k[0] == '\0') return 0;
+    return k[0] << BITS_PER_BYTE | k[1];
+}
+
+/* Rows and partitions given to one build thread */
+struct partitionJob {
+    struct ptDict *dict;
+    char **keys;
+    struct data **recs;
+    int *order;                // rows grouped by partition, in file order
+    int *partitionStart;       // first entry of each partition in order
+    int first, last;           // partitions [first, last) of this thread
+    struct ptNode **roots;     // subtree of each partition
+};
+
+/* helper: thread body building one subtree per partition, inserting
+   its rows in file order */
+static void *buildPartitionsThread(void *arg) {
+    struct partitionJob *job = arg;
+    struct ptDict part = *job->dict;
+    for (int p = job->first; p < job->last; p++) {
+        part.root = NULL;
+        for (int i = job->partitionStart[p]; i < job->partitionStart[p + 1]; i++) {
+            int row = job->order[i];
+            ptDictInsertNode(&part, job->keys[row], job->recs[row]);
         }
+        job->roots[p] = part.root;
+    }
+    return NULL;
+}
+
+/* helper: join the subtrees roots[lo..hi) (of distinct partitions, in key
+   order) into the tree inserting all their keys would have built: the
+   root branches at the first bit where the smallest and largest key
+   differ, which comes before the end of the bits every key of a root
+   shares */
+static struct ptNode *graftSubtrees(struct ptNode **roots, int lo, int hi) {
+    if (hi - lo == 1) return roots[lo];
+    unsigned int common = firstBitDifference(firstLeaf(roots[lo])->key,
+                                             firstLeaf(roots[hi - 1])->key);
+    int split = lo + 1;
+    while (getBit(firstLeaf(roots[split])->key, common) == 0) split++;
+
+    return ptNodeNewBranch(common, graftSubtrees(roots, lo, split),
+                           graftSubtrees(roots, split, hi));
+}
 
-        if (i < curr->stemBits) {
-            /* Case C: mismatch inside stem → split */
-
-            struct ptNode *newLeaf = ptNodeNewLeaf(key, rec);
-
-            struct ptNode *branch = malloc(sizeof(*branch));
-            assert(branch);
-
-            branch->stem = createStem(key, 0, i); // common prefix bits
-            branch->stemBits = i;
-            branch->bitIndex = i;
-            branch->records = NULL;
-            branch->recordCount = 0;
-            branch->recordCapacity = 0;
-
-            if (getBit(key, i) == 0) {
-                branch->left = newLeaf;
-                branch->right = curr;
-            } else {
-                branch->right = newLeaf;
-                branch->left = curr;
-            }
-
-            if (!parent) {
-                dict->root = branch;
-            } else {
-                if (parent->left == curr) parent->left = branch;
-                else parent->right = branch;
-            }
-            return;
+void ptDictInsertAll(struct ptDict *dict, char **keys, struct data **recs,
+                     int n, int threads) {
+    assert(dict && !dict->root && dict->ownsRecords != 1 &&
+           dict->ownsKeys != 1 && ((keys && recs) || n == 0));
+    assert(threads >= 1 && threads <= PT_MAX_BUILD_THREADS);
+    dict->ownsRecords = 0;
+    dict->ownsKeys = 0;
+    if (threads == 1) {
+        for (int row = 0; row < n; row++) {
+            ptDictInsertNode(dict, keys[row], recs[row]);
         }
+        return;
+    }
 
-        // Full stem matched
-        if (!curr->left && !curr->right) {
-            /* Case B: leaf node */
-            if (strcmp(key, curr->stem) == 0) {
-                // Exact match → append record
-                ptNodeAddRecord(curr, rec);
-            } else {
-                // Need to split (different full keys)
-                unsigned int mismatchBit = 0;
-                while (getBit(key, mismatchBit) == getBit(curr->stem, mismatchBit)) {
-                    mismatchBit++;
-                }
-
-                struct ptNode *newLeaf = ptNodeNewLeaf(key, rec);
-
-                struct ptNode *branch = malloc(sizeof(*branch));
-                assert(branch);
-
-                branch->stem = createStem(key, 0, mismatchBit);
-                branch->stemBits = mismatchBit;
-                branch->bitIndex = mismatchBit;
-                branch->records = NULL;
-                branch->recordCount = 0;
-                branch->recordCapacity = 0;
-
-                if (getBit(key, mismatchBit) == 0) {
-                    branch->left = newLeaf;
-                    branch->right = curr;
-                } else {
-                    branch->right = newLeaf;
-                    branch->left = curr;
-                }
-
-                if (!parent) {
-                    dict->root = branch;
-                } else {
-                    if (parent->left == curr) parent->left = branch;
-                    else parent->right = branch;
-                }
-            }
-            return;
+    // Counting sort of the rows by partition, stable so each key still
+    // meets its rows in file order
+    int *partitionStart = calloc(NUM_PARTITIONS + 1, sizeof(int));
+    int *order = malloc(sizeof(int) * (n > 0 ? n : 1));
+    struct ptNode **roots = calloc(NUM_PARTITIONS, sizeof(*roots));
+    assert(partitionStart && order && roots);
+    for (int row = 0; row < n; row++) {
+        partitionStart[keyPartition(keys[row]) + 1]++;
+    }
+    for (int p = 0; p < NUM_PARTITIONS; p++) {
+        partitionStart[p + 1] += partitionStart[p];
+    }
+    int *fill = malloc(sizeof(int) * NUM_PARTITIONS);
+    assert(fill);
+    memcpy(fill, partitionStart, sizeof(int) * NUM_PARTITIONS);
+    for (int row = 0; row < n; row++) {
+        order[fill[keyPartition(keys[row])]++] = row;
+    }
+    free(fill);
+
+    // Contiguous runs of partitions with about n / threads rows each
+    pthread_t tids[PT_MAX_BUILD_THREADS];
+    struct partitionJob jobs[PT_MAX_BUILD_THREADS];
+    int p = 0;
+    for (int t = 0; t < threads; t++) {
+        long goal = (long)n * (t + 1) / threads;
+        jobs[t] = (struct partitionJob){dict, keys, recs, order,
+                                        partitionStart, p, p, roots};
+        while (p < NUM_PARTITIONS && (partitionStart[p + 1] <= goal ||
+                                      t == threads - 1)) {
+            p++;
         }
+        jobs[t].last = p;
+        int err = pthread_create(&tids[t], NULL, buildPartitionsThread, &jobs[t]);
+        assert(err == 0);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    // Graft the subtrees under a spine of branch nodes
+    int numRoots = 0;
+    for (int q = 0; q < NUM_PARTITIONS; q++) {
+        if (roots[q]) roots[numRoots++] = roots[q];
+    }
+    if (numRoots > 0) dict->root = graftSubtrees(roots, 0, numRoots);
+
+    free(roots);
+    free(order);
+    free(partitionStart);
+}
 
-        /* Otherwise: keep descending */
-        parent = curr;
-        int nextBit = getBit(key, curr->bitIndex);
-        curr = (nextBit == 0) ? curr->left : curr->right;
+/* helper: a new key was added under `stop`; bump the key counts of its
+   ancestors (the branches on the path of `key` above `stop`) */
+static void countNewKey(struct ptDict *dict, char *key, struct ptNode *stop) {
+    struct ptNode *node = dict->root;
+    while (node != stop) {
+        struct ptBranch *branch = asBranch(node);
+        branch->keyCount++;
+        node = (getBit(key, node->bitIndex) == 0) ? branch->left : branch->right;
     }
 }
 
-/* helper: Recursively collect all records under a subtree into a dynamic array */
-static void collectDescendants(struct ptNode *node,
-                               struct data ***list,
-                               int *count,
-                               int *cap) {
+/* helper: Recursively collect all leaves under a subtree (in key order);
+   every leaf holds one distinct key */
+static void collectLeaves(struct ptNode *node,
+                          struct ptLeaf ***list,
+                          int *count,
+                          int *cap) {
     if (!node) return;
 
-    // Collect records at this node (if any)
-    for (int i = 0; i < node->recordCount; i++) {
+    if (isLeaf(node)) {
         if (*count == *cap) {
             *cap = (*cap == 0) ? 4 : (*cap * 2);
-            *list = realloc(*list, (*cap) * sizeof(struct data *));
+            *list = realloc(*list, (*cap) * sizeof(struct ptLeaf *));
             assert(*list);
         }
-        (*list)[(*count)++] = node->records[i];
+        (*list)[(*count)++] = asLeaf(node);
+        return;
     }
 
     // Recurse left and right
-    collectDescendants(node->left, list, count, cap);
-    collectDescendants(node->right, list, count, cap);
+    collectLeaves(asBranch(node)->left, list, count, cap);
+    collectLeaves(asBranch(node)->right, list, count, cap);
 }
 
-/* helper: have we already processed this key? */
-static int hasKeySeen(const char **seen, int seenCount, const char *k) {
-    for (int i = 0; i < seenCount; i++) {
-        if (strcmp(seen[i], k) == 0) return 1;
-    }
-    return 0;
+struct queryResult *ptDictLookup(struct ptDict *dict, char *query) {
+    struct resultSpan span;
+    ptDictLookupSpan(dict, query, &span);
+    return spanToQueryResult(&span);
 }
 
-struct queryResult *ptDictLookup(struct ptDict *dict, char *query) {
-    struct queryResult *qr = malloc(sizeof(*qr));
-    assert(qr);
+void ptDictLookupSpan(struct ptDict *dict, char *query, struct resultSpan *qr) {
+    dict->lookup(dict, query, qr, 1);
+}
+
+int ptDictFindSpan(struct ptDict *dict, char *query, struct resultSpan *qr) {
+    return dict->lookup(dict, query, qr, 0);
+}
 
-    qr->searchString = strdup(query);
+/* helpers: the two specialisations of lookupSpan; the plain one compiles
+   without any of the counting */
+static int lookupSpanCounted(struct ptDict *dict, char *query,
+                             struct resultSpan *qr, int allowFuzzy) {
+    return lookupSpan(dict, query, qr, allowFuzzy, 1);
+}
+
+static int lookupSpanPlain(struct ptDict *dict, char *query,
+                           struct resultSpan *qr, int allowFuzzy) {
+    return lookupSpan(dict, query, qr, allowFuzzy, 0);
+}
+
+/* helper: walk towards query; returns 1 on an exact match. On a mismatch
+   the closest key under the mismatch point is used if allowFuzzy is set,
+   otherwise the span is left empty. Only the branching bits are read on
+   the way down; the key is compared once, at the leaf. The counts are
+   those of a walk comparing each node's share of the prefix bits: up to
+   and including the first differing bit, at the nodes down to the one
+   where the query leaves the tree. With counting 0 the counts stay 0, and
+   an exact miss skips the walk to that node. */
+static inline __attribute__((always_inline))
+int lookupSpan(struct ptDict *dict, char *query, struct resultSpan *qr,
+               int allowFuzzy, int counting) {
+    qr->searchString = query;
     qr->numRecords = 0;
     qr->records = NULL;
     qr->bitCount = 0;
@@ -248,198 +521,238 @@ struct queryResult *ptDictLookup(struct ptDict *dict, char *query) {
     qr->stringCount = 0;
 
     if (!dict->root) {
-        return qr;  // empty tree
+        return 0;  // empty tree
     }
 
-    struct ptNode *curr = dict->root;
-    unsigned int offset = 0;  // number of prefix bits already checked
-
-    while (curr) {
-        qr->nodeCount++;
-
-        // Compare only the *new* portion of this node's stem (beyond offset)
-        unsigned int queryBits = keyBits(query);
-        unsigned int newBits = (curr->stemBits > offset) ? (curr->stemBits - offset) : 0;
-        unsigned int minBits = (queryBits - offset < newBits) ? (queryBits - offset) : newBits;
-
-        unsigned int i;
-        for (i = 0; i < minBits; i++) {
-            qr->bitCount++;
-            if (getBit((char*)query, offset + i) != getBit(curr->stem, offset + i)) {
-                break; // mismatch inside this segment
-            }
-        }
-
-        /* -------- internal mismatch -------- */
-        if (i < newBits) {
-            struct data **candidates = NULL;
-            int count = 0, cap = 0;
-            collectDescendants(curr, &candidates, &count, &cap);
-
-            // Pass 1: evaluate each DISTINCT key exactly once
-            int bestDist = INT_MAX;
-            const char *bestKey = NULL;
-
-            const char **seenKeys = NULL;
-            int seenCount = 0, seenCap = 0;
-
-            for (int k = 0; k < count; k++) {
-                const char *candKey = candidates[k]->fields[dict->keyFieldIndex];
-                if (hasKeySeen(seenKeys, seenCount, candKey)) {
-                    continue; // already counted this key
-                }
-                // mark as seen
-                if (seenCount == seenCap) {
-                    seenCap = (seenCap == 0) ? 8 : (seenCap * 2);
-                    seenKeys = realloc(seenKeys, seenCap * sizeof(*seenKeys));
-                    assert(seenKeys);
-                }
-                seenKeys[seenCount++] = candKey;
-
-                // one string comparison per DISTINCT key
-                qr->stringCount++;
-                int dist = editDistance((char*)query, (char*)candKey,
-                                        (int)strlen(query),
-                                        (int)strlen(candKey));
-                if (dist < bestDist ||
-                    (dist == bestDist && (!bestKey || strcmp(candKey, bestKey) < 0))) {
-                    bestDist = dist;
-                    bestKey = candKey;
-                }
-            }
-
-            // Pass 2: collect *all* records whose key == bestKey (preserve order)
-            for (int k = 0; k < count; k++) {
-                const char *candKey = candidates[k]->fields[dict->keyFieldIndex];
-                if (bestKey && strcmp(candKey, bestKey) == 0) {
-                    qr->records = realloc(qr->records,
-                                          (qr->numRecords + 1) * sizeof(*qr->records));
-                    assert(qr->records);
-                    qr->records[qr->numRecords++] = candidates[k];
-                }
-            }
-
-            free(seenKeys);
-            free(candidates);
-            return qr;
+    char keyBuf[KEY_BUF_LEN(dict)];
+    unsigned int queryBits = keyBits(query);
+    int depth;
+    struct ptLeaf *leaf = descendToLeaf(dict->root, query, queryBits,
+                                        counting ? &depth : NULL);
+    unsigned int mismatch = firstBitDifference(query, nodeKey(dict, leaf, keyBuf));
+
+    /* -------- exact match: 1 string comparison, all records at this leaf -------- */
+    if (mismatch == queryBits) {
+        if (counting) {
+            qr->bitCount = queryBits;
+            qr->nodeCount = depth;
+            qr->stringCount++;
         }
+        qr->numRecords = leaf->recordCount;
+        qr->records = leaf->records;
+        return 1;
+    }
 
-        offset += i; // fully matched this node's stem
-
-        /* -------- reached a leaf -------- */
-        if (!curr->left && !curr->right) {
-            if (strcmp(query, curr->stem) == 0) {
-                // exact match: 1 string comparison
-                qr->stringCount++;
-                qr->numRecords = curr->recordCount;
-                qr->records = malloc(qr->numRecords * sizeof(*qr->records));
-                assert(qr->records);
-                memcpy(qr->records, curr->records,
-                       qr->numRecords * sizeof(*qr->records));
-            } else {
-                // leaf mismatch: only one DISTINCT key at this leaf
-                qr->stringCount++;  // count one comparison for this candidate key
-            
-                // return all records at this leaf (same key)
-                qr->numRecords = curr->recordCount;
-                qr->records = malloc(qr->numRecords * sizeof(*qr->records));
-                assert(qr->records);
-                for (int k = 0; k < curr->recordCount; k++) {
-                    qr->records[k] = curr->records[k];
-                }
-            }
-            return qr;
+    /* -------- mismatch: closest key below where the query leaves the tree -------- */
+    if (!allowFuzzy && !counting) return 0;
+    struct ptNode *curr = mismatchNode(dict->root, query, mismatch, NULL,
+                                       counting ? &depth : NULL);
+    if (counting) {
+        qr->bitCount = mismatch + 1;
+        qr->nodeCount = depth;
+    }
+    if (!allowFuzzy) return 0;
+    struct ptLeaf **leaves = NULL;
+    int count = 0, cap = 0;
+    collectLeaves(curr, &leaves, &count, &cap);
+
+    // Evaluate each DISTINCT key (one per leaf) exactly once
+    int bestDist = INT_MAX;
+    struct ptLeaf *best = NULL;
+
+    char bestBuf[KEY_BUF_LEN(dict)];
+    for (int k = 0; k < count; k++) {
+        const char *candKey = nodeKey(dict, leaves[k], keyBuf);
+
+        // one string comparison per DISTINCT key
+        if (counting) qr->stringCount++;
+        int dist = editDistance((char*)query, (char*)candKey,
+                                (int)strlen(query),
+                                (int)strlen(candKey));
+        if (dist < bestDist ||
+            (dist == bestDist &&
+             strcmp(candKey, nodeKey(dict, best, bestBuf)) < 0)) {
+            bestDist = dist;
+            best = leaves[k];
         }
+    }
 
-        /* -------- descend to child decided by branching bit -------- */
-        int nextBit = getBit((char*)query, curr->bitIndex);
-        curr = (nextBit == 0) ? curr->left : curr->right;
+    // Point at *all* records stored under bestKey (in order)
+    if (best) {
+        qr->numRecords = best->recordCount;
+        qr->records = best->records;
     }
 
-    return qr;
+    free(leaves);
+    return 0;
 }
 
 
 
 
-/* Returns min of 3 integers 
-    reference: https://www.geeksforgeeks.org/edit-distance-in-c/ */
-static int minOf3(int a, int b, int c) {
-    if (a < b) {
-        if(a < c) {
-            return a;
-        } else {
-            return c;
-        }
-    } else {
-        if(b < c) {
-            return b;
-        } else {
-            return c;
-        }
+/* helper: append up to `limit` keys of the subtree, skipping the first
+   `skip` in key order. Subtrees entirely before the page are skipped
+   using their key counts, so only the paths to returned keys are walked. */
+static void collectPage(struct ptDict *dict, struct ptNode *node, int skip,
+                        int limit, struct prefixResult *pr) {
+    if (!node || pr->numKeys == limit || skip >= subtreeKeys(node)) return;
+
+    if (isLeaf(node)) {
+        char keyBuf[KEY_BUF_LEN(dict)];
+        struct ptLeaf *leaf = asLeaf(node);
+        pr->keys[pr->numKeys] = strdup(nodeKey(dict, leaf, keyBuf));
+        assert(pr->keys[pr->numKeys]);
+        pr->recordCounts[pr->numKeys] = leaf->recordCount;
+        pr->numKeys++;
+        return;
     }
+
+    struct ptBranch *branch = asBranch(node);
+    int leftCount = subtreeKeys(branch->left);
+    collectPage(dict, branch->left, skip, limit, pr);
+    collectPage(dict, branch->right, (skip > leftCount) ? skip - leftCount : 0,
+                limit, pr);
 }
 
-/* Returns the edit distance of two strings
-    reference: https://www.geeksforgeeks.org/edit-distance-in-c/ */
-static int editDistance(char *str1, char *str2, int n, int m){
-    assert(m >= 0 && n >= 0 && (str1 || m == 0) && (str2 || n == 0));
-    // Declare a 2D array to store the dynamic programming
-    // table
-    int dp[n + 1][m + 1];
-
-    // Initialize the dp table
-    for (int i = 0; i <= n; i++) {
-        for (int j = 0; j <= m; j++) {
-            // If the first string is empty, the only option
-            // is to insert all characters of the second
-            // string
-            if (i == 0) {
-                dp[i][j] = j;
-            }
-            // If the second string is empty, the only
-            // option is to remove all characters of the
-            // first string
-            else if (j == 0) {
-                dp[i][j] = i;
-            }
-            // If the last characters are the same, no
-            // modification is necessary to the string.
-            else if (str1[i - 1] == str2[j - 1]) {
-                dp[i][j] = dp[i - 1][j - 1];
-            }
-            // If the last characters are different,
-            // consider all three operations and find the
-            // minimum
-            else {
-                dp[i][j] = 1 + minOf3(dp[i - 1][j], dp[i][j - 1],
-                    dp[i - 1][j - 1]);
-            }
-        }
+struct prefixResult *ptDictPrefixSearch(struct ptDict *dict, char *prefix,
+                                        int cursor, int limit) {
+    assert(dict && prefix && cursor >= 0 && limit > 0);
+    struct prefixResult *pr = malloc(sizeof(*pr));
+    assert(pr);
+    pr->prefix = strdup(prefix);
+    assert(pr->prefix);
+    pr->total = 0;
+    pr->cursor = cursor;
+    pr->nextCursor = -1;
+    pr->numKeys = 0;
+    pr->keys = NULL;
+    pr->recordCounts = NULL;
+
+    // Prefix bits exclude the null terminator: keys may continue. Walk
+    // down to the first node whose keys share all of them, then check
+    // the prefix against one of its keys.
+    size_t prefixLen = strlen(prefix);
+    unsigned int prefixBits = prefixLen * BITS_PER_BYTE;
+    struct ptNode *curr = dict->root;
+    char keyBuf[KEY_BUF_LEN(dict)];
+
+    if (!curr) return pr;
+    while (!isLeaf(curr) && (unsigned int)curr->bitIndex < prefixBits) {
+        struct ptBranch *branch = asBranch(curr);
+        curr = (getBit(prefix, curr->bitIndex) == 0) ? branch->left
+                                                      : branch->right;
+    }
+    if (strncmp(nodeKey(dict, firstLeaf(curr), keyBuf), prefix, prefixLen) != 0) {
+        return pr;  // no key starts with prefix
     }
 
-    // Return the result from the dynamic programming table
-    return dp[n][m];
+    pr->total = subtreeKeys(curr);
+    if (cursor < pr->total) {
+        int pageSize = (pr->total - cursor < limit) ? pr->total - cursor : limit;
+        pr->keys = malloc(sizeof(char *) * pageSize);
+        pr->recordCounts = malloc(sizeof(int) * pageSize);
+        assert(pr->keys && pr->recordCounts);
+        collectPage(dict, curr, cursor, pageSize, pr);
+        if (cursor + pr->numKeys < pr->total) {
+            pr->nextCursor = cursor + pr->numKeys;
+        }
+    }
+    return pr;
 }
 
 /* free nodes recursively */
-static void freeNode(struct ptNode *node) {
+static void freeNode(struct ptNode *node, int freeRecords, int freeKeys) {
     if (!node) return;
-    freeNode(node->left);
-    freeNode(node->right);
-    if (node->records) {
-        for (int i = 0; i < node->recordCount; i++) {
-            freeData(node->records[i]);  // free the record itself
+    if (!isLeaf(node)) {
+        struct ptBranch *branch = asBranch(node);
+        freeNode(branch->left, freeRecords, freeKeys);
+        freeNode(branch->right, freeRecords, freeKeys);
+        memAccountFree(MEM_NODES, sizeof(*branch));
+        free(branch);
+        return;
+    }
+
+    struct ptLeaf *leaf = asLeaf(node);
+    for (int i = 0; freeRecords && i < leaf->recordCount; i++) {
+        freeData(leaf->records[i]);  // free the record itself
+    }
+    if (leaf->records != &leaf->first) {
+        memAccountFree(MEM_RECORD_ARRAYS,
+                       leaf->recordCapacity * sizeof(struct data *));
+        free(leaf->records);
+    }
+    if (freeKeys && leaf->key) {
+        memAccountFree(MEM_LEAF_KEYS, strlen(leaf->key) + 1);
+        free(leaf->key);
+    }
+    memAccountFree(MEM_NODES, sizeof(*leaf));
+    free(leaf);
+}
+
+
+void ptDictCompactKeys(struct ptDict *dict) {
+    assert(dict);
+    struct ptLeaf **leaves = NULL;
+    int count = 0, cap = 0;
+    collectLeaves(dict->root, &leaves, &count, &cap);
+
+    // Leaves come out in key order, which is what front coding needs
+    char **keys = malloc(sizeof(char *) * (count > 0 ? count : 1));
+    assert(keys);
+    char keyBuf[KEY_BUF_LEN(dict)];
+    for (int i = 0; i < count; i++) {
+        keys[i] = leaves[i]->key ? leaves[i]->key
+                                 : strdup(nodeKey(dict, leaves[i], keyBuf));
+        assert(keys[i]);
+    }
+
+    struct keyPool *pool = keyPoolNew(keys, count);
+    for (int i = 0; i < count; i++) {
+        if (leaves[i]->key && dict->ownsKeys == 1) {
+            memAccountFree(MEM_LEAF_KEYS, strlen(keys[i]) + 1);
         }
-        free(node->records);
+        if (!leaves[i]->key || dict->ownsKeys == 1) {
+            free(keys[i]);     // decoded from the previous pool, or a copy
+        }
+        leaves[i]->key = NULL;
+        leaves[i]->keyId = i;
     }
-    free(node->stem);
-    free(node);
+    keyPoolFree(dict->keys);
+    dict->keys = pool;
+
+    free(keys);
+    free(leaves);
 }
 
+struct keyPool *ptDictKeyPool(struct ptDict *dict) {
+    assert(dict);
+    if (!dict->keys || !dict->root ||
+        keyPoolSize(dict->keys) != subtreeKeys(dict->root)) {
+        return NULL;  // not compacted, or keys added since
+    }
+    return dict->keys;
+}
+
+int ptDictKeyCount(struct ptDict *dict) {
+    assert(dict);
+    return dict->root ? subtreeKeys(dict->root) : 0;
+}
+
+void ptDictForEachKey(struct ptDict *dict, ptKeyFn visit, void *arg) {
+    assert(dict && visit);
+    struct ptLeaf **leaves = NULL;
+    int count = 0, cap = 0;
+    collectLeaves(dict->root, &leaves, &count, &cap);
+    char keyBuf[KEY_BUF_LEN(dict)];
+    for (int i = 0; i < count; i++) {
+        visit(nodeKey(dict, leaves[i], keyBuf), arg);
+    }
+    free(leaves);
+}
 
 void ptDictFree(struct ptDict *dict) {
     if (!dict) return;
-    freeNode(dict->root);
+    freeNode(dict->root, dict->ownsRecords == 1, dict->ownsKeys == 1);
+    keyPoolFree(dict->keys);
     free(dict);
 }
@@ -0,0 +1,237 @@
+/*
+    Posting list codec.
+
+    Block b is encoded as the gaps row[i] - row[i - 1] (the row before
+    the first of the block is blocks[b - 1].lastRow, or -1) followed by
+    the counts, all as varints. Counts are only written if some count is
+    not 1.
+
+    Inside a decoded block the first row >= target is found by counting
+    the rows < target with 16-byte vector compares (no -march needed);
+    the unused tail of the block is padded with POSTINGS_END.
+*/
+#include "postings.h"
+#include "varint.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define BATCH_BYTES 16
+#define BATCH_LANES (BATCH_BYTES / (int)sizeof(int32_t))
+
+typedef int32_t rowBatch __attribute__((vector_size(BATCH_BYTES)));
+
+/* Skip table entry */
+struct postingsBlock {
+    int32_t lastRow;
+    uint32_t offset;           // start of the block in bytes
+    float maxWeight;           // rounded up, 0 without weights
+};
+
+struct postings {
+    int n;
+    int numBlocks;
+    int hasCounts;
+    struct postingsBlock *blocks;
+    unsigned char *bytes;
+    size_t numBytes;
+};
+
+/* Helpers */
+static void decodeBlock(struct postingsCursor *c, int block);
+static int countBelow(const struct postingsCursor *c, int target);
+static void finish(struct postingsCursor *c);
+static int findBlock(const struct postings *list, int from, int target);
+
+struct postings *postingsEncode(const int *rows, const int *counts,
+                                const double *weights, int n) {
+    assert(rows && n >= 0);
+    struct postings *list = malloc(sizeof(*list));
+    assert(list);
+    list->n = n;
+    list->numBlocks = (n + POSTINGS_BLOCK - 1) / POSTINGS_BLOCK;
+    list->hasCounts = 0;
+    for (int i = 0; counts && i < n; i++) {
+        if (counts[i] != 1) list->hasCounts = 1;
+    }
+    list->blocks = malloc(sizeof(*list->blocks) *
+                          (list->numBlocks > 0 ? list->numBlocks : 1));
+    assert(list->blocks);
+    list->bytes = malloc((size_t)n * 2 * VARINT_MAX_BYTES + 1);
+    assert(list->bytes);
+
+    size_t used = 0;
+    int prev = -1;
+    for (int b = 0; b < list->numBlocks; b++) {
+        int first = b * POSTINGS_BLOCK;
+        int last = (first + POSTINGS_BLOCK < n) ? first + POSTINGS_BLOCK : n;
+        list->blocks[b].offset = (uint32_t)used;
+        float bound = 0;
+        for (int i = first; weights && i < last; i++) {
+            float w = (float)weights[i];
+            if (w < weights[i]) w = nextafterf(w, INFINITY);
+            if (w > bound) bound = w;
+        }
+        list->blocks[b].maxWeight = bound;
+        for (int i = first; i < last; i++) {
+            assert(rows[i] > prev && rows[i] < POSTINGS_END);
+            used += putVarint(list->bytes + used, (size_t)(rows[i] - prev));
+            prev = rows[i];
+        }
+        for (int i = first; list->hasCounts && i < last; i++) {
+            assert(counts[i] > 0);
+            used += putVarint(list->bytes + used, (size_t)counts[i]);
+        }
+        list->blocks[b].lastRow = prev;
+    }
+    assert(used <= UINT32_MAX);
+    list->numBytes = used;
+    list->bytes = realloc(list->bytes, used > 0 ? used : 1);
+    assert(list->bytes);
+    return list;
+}
+
+int postingsSize(const struct postings *list) {
+    return list->n;
+}
+
+size_t postingsBytes(const struct postings *list) {
+    return sizeof(*list) + list->numBytes +
+           sizeof(*list->blocks) * list->numBlocks;
+}
+
+/* helper: decode `block` into the cursor and put it on its first row */
+static void decodeBlock(struct postingsCursor *c, int block) {
+    const struct postings *list = c->list;
+    const unsigned char *in = list->bytes + list->blocks[block].offset;
+    int first = block * POSTINGS_BLOCK;
+    int len = (list->n - first < POSTINGS_BLOCK) ? list->n - first
+                                                 : POSTINGS_BLOCK;
+    int row = (block > 0) ? list->blocks[block - 1].lastRow : -1;
+    size_t value = 0;
+    for (int i = 0; i < len; i++) {
+        in += getVarint(in, &value);
+        row += (int)value;
+        c->rows[i] = row;
+    }
+    for (int i = 0; i < len; i++) {
+        if (list->hasCounts) {
+            in += getVarint(in, &value);
+            c->counts[i] = (int32_t)value;
+        } else {
+            c->counts[i] = 1;
+        }
+    }
+    // Pad to whole batches so countBelow never reads a stale row
+    for (int i = len; i % BATCH_LANES != 0; i++) {
+        c->rows[i] = POSTINGS_END;
+    }
+    c->block = block;
+    c->len = len;
+    c->pos = 0;
+    c->row = c->rows[0];
+    c->blocksDecoded++;
+}
+
+/* helper: how many rows of the decoded block are < target */
+static int countBelow(const struct postingsCursor *c, int target) {
+    rowBatch bound = {target, target, target, target};
+    rowBatch below = {0, 0, 0, 0};
+    for (int i = 0; i < c->len; i += BATCH_LANES) {
+        rowBatch batch;
+        memcpy(&batch, c->rows + i, sizeof(batch));
+        below += (batch < bound);   // lanes are 0 or -1
+    }
+    return -(below[0] + below[1] + below[2] + below[3]);
+}
+
+/* helper: mark the cursor exhausted */
+static void finish(struct postingsCursor *c) {
+    c->row = POSTINGS_END;
+    c->pos = 0;
+}
+
+void postingsOpen(const struct postings *list, struct postingsCursor *c) {
+    assert(list && c);
+    c->list = list;
+    c->block = -1;
+    c->len = 0;
+    c->blocksDecoded = 0;
+    if (list->n == 0) {
+        finish(c);
+        return;
+    }
+    decodeBlock(c, 0);
+}
+
+void postingsNext(struct postingsCursor *c) {
+    if (c->row == POSTINGS_END) return;
+    if (++c->pos < c->len) {
+        c->row = c->rows[c->pos];
+    } else if (c->block + 1 < c->list->numBlocks) {
+        decodeBlock(c, c->block + 1);
+    } else {
+        finish(c);
+    }
+}
+
+/* helper: the first block from `from` on whose last row is >= target,
+   or numBlocks. Gallops over the skip table (1, 2, 4, ... blocks ahead)
+   and finishes with a binary search. */
+static int findBlock(const struct postings *list, int from, int target) {
+    const struct postingsBlock *blocks = list->blocks;
+    int numBlocks = list->numBlocks;
+    int lo = from, hi = lo, step = 1;
+    while (hi < numBlocks && blocks[hi].lastRow < target) {
+        lo = hi + 1;
+        hi = lo + step;
+        step *= 2;
+    }
+    if (hi >= numBlocks) {
+        hi = numBlocks - 1;
+        if (lo > hi || blocks[hi].lastRow < target) return numBlocks;
+    }
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (blocks[mid].lastRow < target) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void postingsAdvance(struct postingsCursor *c, int target) {
+    if (c->row >= target) return;
+    if (target > c->list->blocks[c->block].lastRow) {
+        int block = findBlock(c->list, c->block + 1, target);
+        if (block == c->list->numBlocks) {
+            finish(c);
+            return;
+        }
+        decodeBlock(c, block);
+    }
+    c->pos = countBelow(c, target);
+    c->row = c->rows[c->pos];
+}
+
+double postingsBlockBound(struct postingsCursor *c, int row, int *blockEnd) {
+    if (c->row == POSTINGS_END) {
+        *blockEnd = POSTINGS_END;
+        return 0;
+    }
+    int block = findBlock(c->list, c->block, row);
+    if (block == c->list->numBlocks) {
+        *blockEnd = POSTINGS_END;
+        return 0;
+    }
+    *blockEnd = c->list->blocks[block].lastRow;
+    return c->list->blocks[block].maxWeight;
+}
+
+void postingsFree(struct postings *list) {
+    if (!list) return;
+    free(list->blocks);
+    free(list->bytes);
+    free(list);
+}
@@ -0,0 +1,174 @@
+/*
+    Query pipeline: the reader runs on the calling thread, lookups on
+    `workers` threads and output on one writer thread. Batch i goes to
+    worker i % workers; a NULL batch tells a worker (and after it the
+    writer) that input has ended.
+*/
+#include "query_pipeline.h"
+#include "spsc_ring.h"
+#include "read.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <assert.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+struct queryBatch {
+    int count;
+    char *queries[PIPELINE_BATCH];
+    max_align_t answers[];    // PIPELINE_BATCH slots of slotSize bytes
+};
+
+struct pipeline {
+    int workers;
+    size_t slotSize;          // answerSize rounded up to max_align_t
+    pipelineAnswerFn answer;
+    pipelineEmitFn emit;
+    void *context;
+    struct spscRing *toWorker[PIPELINE_MAX_WORKERS];
+    struct spscRing *toWriter[PIPELINE_MAX_WORKERS];
+};
+
+struct workerJob {
+    struct pipeline *p;
+    int id;
+};
+
+/* Helpers */
+static int inputPending(FILE *in);
+static void *workerThread(void *arg);
+static void *writerThread(void *arg);
+static void runSequential(FILE *in, size_t answerSize,
+                          pipelineAnswerFn answer, pipelineEmitFn emit,
+                          void *context);
+static void *answerSlot(struct pipeline *p, struct queryBatch *batch, int i);
+
+/* helper: whether more input can be read from `in` without blocking.
+   Regular files never make a reader wait for long, so batches are only
+   cut short for pipes and terminals that have nothing more to give. */
+static int inputPending(FILE *in) {
+    struct stat st;
+    if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode)) return 1;
+    struct pollfd pfd = {fileno(in), POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/* helper: the answer slot of query i of a batch */
+static void *answerSlot(struct pipeline *p, struct queryBatch *batch, int i) {
+    return (char *)batch->answers + (size_t)i * p->slotSize;
+}
+
+/* Lookup stage: answer every query of each batch */
+static void *workerThread(void *arg) {
+    struct workerJob *job = arg;
+    struct pipeline *p = job->p;
+    while (1) {
+        struct queryBatch *batch = ringPop(p->toWorker[job->id]);
+        if (batch) {
+            for (int i = 0; i < batch->count; i++) {
+                p->answer(p->context, batch->queries[i], answerSlot(p, batch, i));
+            }
+        }
+        ringPush(p->toWriter[job->id], batch);
+        if (!batch) return NULL;
+    }
+}
+
+/* Output stage: emit batches in the order the reader dealt them */
+static void *writerThread(void *arg) {
+    struct pipeline *p = arg;
+    for (long next = 0;; next++) {
+        struct queryBatch *batch = ringPop(p->toWriter[next % p->workers]);
+        if (!batch) return NULL;
+        for (int i = 0; i < batch->count; i++) {
+            p->emit(p->context, batch->queries[i], answerSlot(p, batch, i));
+            freeQuery(batch->queries[i]);
+        }
+        memAccountFree(MEM_QUERY,
+                       sizeof(*batch) + PIPELINE_BATCH * p->slotSize);
+        free(batch);
+    }
+}
+
+/* helper: the unpipelined loop */
+static void runSequential(FILE *in, size_t answerSize,
+                          pipelineAnswerFn answer, pipelineEmitFn emit,
+                          void *context) {
+    void *slot = malloc(answerSize > 0 ? answerSize : 1);
+    assert(slot);
+    char *query = NULL;
+    while ((query = getQuery(in)) != NULL) {
+        answer(context, query, slot);
+        emit(context, query, slot);
+        freeQuery(query);
+    }
+    free(slot);
+}
+
+void pipelineRun(FILE *in, int workers, size_t answerSize,
+                 pipelineAnswerFn answer, pipelineEmitFn emit, void *context) {
+    assert(in && answer && emit && workers >= 0 &&
+           workers <= PIPELINE_MAX_WORKERS);
+    if (workers == 0) {
+        runSequential(in, answerSize, answer, emit, context);
+        return;
+    }
+
+    size_t align = sizeof(max_align_t);
+    size_t slotSize = (answerSize + align - 1) / align * align;
+    struct pipeline p = {workers, slotSize, answer, emit, context,
+                         {NULL}, {NULL}};
+    struct workerJob jobs[PIPELINE_MAX_WORKERS];
+    pthread_t threads[PIPELINE_MAX_WORKERS];
+    pthread_t writer;
+    for (int w = 0; w < workers; w++) {
+        p.toWorker[w] = ringNew(PIPELINE_RING_BATCHES);
+        p.toWriter[w] = ringNew(PIPELINE_RING_BATCHES);
+        jobs[w].p = &p;
+        jobs[w].id = w;
+        int err = pthread_create(&threads[w], NULL, workerThread, &jobs[w]);
+        assert(err == 0);
+    }
+    int err = pthread_create(&writer, NULL, writerThread, &p);
+    assert(err == 0);
+
+    // Reader stage: batch queries until EOF
+    long dealt = 0;
+    struct queryBatch *batch = NULL;
+    char *query = NULL;
+    while ((query = getQuery(in)) != NULL) {
+        if (!batch) {
+            batch = malloc(sizeof(*batch) + PIPELINE_BATCH * p.slotSize);
+            assert(batch);
+            memAccountAlloc(MEM_QUERY,
+                            sizeof(*batch) + PIPELINE_BATCH * p.slotSize);
+            batch->count = 0;
+        }
+        batch->queries[batch->count++] = query;
+        // Don't hold queries back while waiting on slow input
+        if (batch->count == PIPELINE_BATCH || !inputPending(in)) {
+            ringPush(p.toWorker[dealt++ % workers], batch);
+            batch = NULL;
+        }
+    }
+    if (batch) {
+        ringPush(p.toWorker[dealt++ % workers], batch);
+    }
+    // End of input, in round-robin order so the writer meets it last
+    for (int w = 0; w < workers; w++) {
+        ringPush(p.toWorker[(dealt + w) % workers], NULL);
+    }
+
+    for (int w = 0; w < workers; w++) {
+        pthread_join(threads[w], NULL);
+    }
+    pthread_join(writer, NULL);
+    for (int w = 0; w < workers; w++) {
+        ringFree(p.toWorker[w]);
+        ringFree(p.toWriter[w]);
+    }
+}
@@ -12,16 +12,44 @@
 #include "read.h"
 #include "record.h"
 #include "record.c"
+#include "intern.h"
+#include "mem_account.h"
 
 #define INIT_RECORDS 1
 #define NUM_FIELDS 35
 #define MAX_RECORD_LEN 512  // 511 chars + '\0'
+#define INTERN_SAMPLE_ROWS 1024
+
+/* Row filter applied to one cleaned field before anything is copied */
+struct rowKeep {
+    int field;
+    rowKeepFn keep;
+    void *arg;
+};
+
+/* Per-column interning decisions made while loading: during the first
+   INTERN_SAMPLE_ROWS rows every value is interned and new values are
+   counted; afterwards columns where most values were new (unique keys,
+   coordinates...) are only copied into the pool arena. Lazy rows in
+   memory parse their first INTERN_SAMPLE_ROWS lines for the count too,
+   so the decisions can be applied when the rest are parsed on use. */
+struct internColumns {
+    struct internPool *pool;
+    int rowsSeen;
+    int newValues[NUM_FIELDS];
+    int dedupe[NUM_FIELDS];
+    int lazyKey;           // -1, or the only field parsed up front
+    FILE *spill;           // lazy rows go to this record file, or NULL
+};
 
 /* 
 Reads a line - removing trailing whitespace, returns a csvRecord or NULL
-if parsing was unsuccessful. 
+if parsing was unsuccessful or keep (if any) rejects the row. Field
+strings are strdup'd, or taken from the interning pool when columns is
+not NULL.
 */
-struct csvRecord *parseLine(char *line);
+struct csvRecord *parseLine(char *line, struct internColumns *columns,
+                            struct rowKeep *keep);
 /*
 Uses the parsing structure to see if the next line from the CSV needs to
 be included.
@@ -29,8 +57,68 @@ be included.
 void checkLine(char **line, FILE *csvFile, char **line2);
 /* Used to clean the tracing newline / carriage*/
 void rstrip_newline(char **line);
+/* Steps of splitLine: cut the line into fields, clean one field */
+static void cutLine(char *line, char **fields);
+static void unquoteField(char *field);
+/* A lazy row: its cleaned fields in the pool arena, or its line in the
+   record file and its key in the arena */
+static struct csvRecord *lazyRow(char *line, int len,
+                                 struct internColumns *columns);
+/* Count one more sample row; after the last one, settle which columns
+   stay deduplicated */
+static void sampleRow(struct internColumns *columns);
+/* Shared loop of the readCSV variants */
+static struct csvRecord **readRows(FILE *csvFile, int *num_records,
+                                   struct internPool *pool, struct rowKeep *keep,
+                                   int lazyKey, FILE *spill, int *dedupe);
 
 struct csvRecord **readCSV(FILE *csvFile, int *num_records){
+    return readCSVInterned(csvFile, num_records, NULL);
+}
+
+struct csvRecord **readCSVInterned(FILE *csvFile, int *num_records,
+                                   struct internPool *pool){
+    return readCSVFiltered(csvFile, num_records, pool, -1, NULL, NULL);
+}
+
+struct csvRecord **readCSVFiltered(FILE *csvFile, int *num_records,
+                                   struct internPool *pool, int keyField,
+                                   rowKeepFn keep, void *arg){
+    struct rowKeep rowKeep = {keyField, keep, arg};
+    return readRows(csvFile, num_records, pool, keep ? &rowKeep : NULL, -1,
+                    NULL, NULL);
+}
+
+struct csvRecord **readCSVLazy(FILE *csvFile, int *num_records,
+                               struct internPool *pool, int keyField,
+                               int *dedupe){
+    assert(pool && keyField >= 0 && keyField < NUM_FIELDS && dedupe);
+    return readRows(csvFile, num_records, pool, NULL, keyField, NULL, dedupe);
+}
+
+struct csvRecord **readCSVOnDisk(FILE *csvFile, int *num_records,
+                                 struct internPool *pool, int keyField,
+                                 FILE *recordFile){
+    assert(pool && keyField >= 0 && keyField < NUM_FIELDS && recordFile);
+    return readRows(csvFile, num_records, pool, NULL, keyField, recordFile,
+                    NULL);
+}
+
+static struct csvRecord **readRows(FILE *csvFile, int *num_records,
+                                   struct internPool *pool, struct rowKeep *keep,
+                                   int lazyKey, FILE *spill, int *dedupe){
+    struct internColumns columns;
+    if(pool){
+        columns.pool = pool;
+        columns.lazyKey = lazyKey;
+        columns.spill = spill;
+        columns.rowsSeen = 0;
+        for(int i = 0; i < NUM_FIELDS; i++){
+            columns.newValues[i] = 0;
+            columns.dedupe[i] = 1;
+        }
+    }
+
     struct csvRecord **records = NULL;
     int numRecords = 0;
     int spaceRecords = 0;
@@ -47,17 +135,21 @@ struct csvRecord **readCSV(FILE *csvFile, int *num_records){
             records = (struct csvRecord **) 
                 malloc(sizeof(struct csvRecord *) * INIT_RECORDS);
             assert(records);
+            memAccountAlloc(MEM_FIELDS, sizeof(struct csvRecord *) * INIT_RECORDS);
             spaceRecords = INIT_RECORDS;
         } else if(numRecords >= spaceRecords){
             spaceRecords *= 2;
             records = (struct csvRecord **)
                 realloc(records, sizeof(struct csvRecord *) * spaceRecords);
             assert(records);
+            memAccountResize(MEM_FIELDS,
+                             sizeof(struct csvRecord *) * spaceRecords / 2,
+                             sizeof(struct csvRecord *) * spaceRecords);
         }
         /* If the line ends in an open double quote, we may need to extend the 
             line. */
         checkLine(&line, csvFile, &line2);
-        records[numRecords] = parseLine(line);
+        records[numRecords] = parseLine(line, pool ? &columns : NULL, keep);
         if(records[numRecords]){
             numRecords++;
         }
@@ -68,10 +160,24 @@ struct csvRecord **readCSV(FILE *csvFile, int *num_records){
     if(line2){
         free(line2);
     }
+    /* Loading is over: the pool stops growing and may be shared. */
+    if(pool){
+        internPoolSeal(pool);
+    }
+    if(dedupe){
+        memcpy(dedupe, columns.dedupe, sizeof(columns.dedupe));
+    }
 
-    /* Shrink. */
-    records = (struct csvRecord **)
-                realloc(records, sizeof(struct csvRecord *) * numRecords);
+    /* Shrink (a filtered read may keep no rows at all). */
+    size_t recordsBytes = sizeof(struct csvRecord *) *
+                          (numRecords > 0 ? numRecords : 1);
+    if(records){
+        memAccountResize(MEM_FIELDS,
+                         sizeof(struct csvRecord *) * spaceRecords, recordsBytes);
+    } else {
+        memAccountAlloc(MEM_FIELDS, recordsBytes);
+    }
+    records = (struct csvRecord **) realloc(records, recordsBytes);
     assert(records);
 
     *num_records = numRecords;
@@ -116,24 +222,27 @@ void checkLine(char **line, FILE *csvFile, char **line2) {
     }
 }
 
-/* This function reads CSVs. */
-struct csvRecord *parseLine(char *line){
-    struct csvRecord *ret = NULL;
-    char **fields = (char **) malloc(sizeof(char *) * NUM_FIELDS);
-    assert(fields);
-    int fieldNum = 0;
-    int len = strlen(line);
-    
-    /* Remove trailing whitespace first. */
-    while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')){
-        line[len - 1] = '\0';
-        len--;
-    }
-    /* Check for empty lines. */
-    if(len == 0){
-        return NULL;
+/* Splits a line into its cleaned fields, in place. */
+void splitLine(char *line, char **fields){
+    cutLine(line, fields);
+    for(int i = 0; i < NUM_FIELDS; i++){
+        unquoteField(fields[i]);
     }
+}
+
+/* Cuts a line in place but cleans only the one field it returns. */
+char *lineField(char *line, int field){
+    assert(field >= 0 && field < NUM_FIELDS);
+    char *fields[NUM_FIELDS];
+    cutLine(line, fields);
+    unquoteField(fields[field]);
+    return fields[field];
+}
 
+/* Step 1: terminate every field where its separator was. */
+static void cutLine(char *line, char **fields){
+    int fieldNum = 0;
+    int len = strlen(line);
     int progress = 0;
     int start = 0;
     /* For simplicity assume quotes only escape comma fields. */
@@ -157,8 +266,7 @@ struct csvRecord *parseLine(char *line){
                 /* Terminate */
                 line[progress] = '\0';
                 assert(fieldNum < NUM_FIELDS);
-                fields[fieldNum] = strdup(line + start);
-                assert(fields[fieldNum]);
+                fields[fieldNum] = line + start;
                 fieldNum++;
                 start = progress + 1;
             }
@@ -167,64 +275,189 @@ struct csvRecord *parseLine(char *line){
     }
     /* Sanity check! Did we get everything? */
     assert(fieldNum == NUM_FIELDS);
+}
 
+static void unquoteField(char *field){
     /* Step 2: Clean extraneous quotes. */
-    for(int i = 0; i < NUM_FIELDS; i++){
-        if(strlen(fields[i]) > 0){
-            if(fields[i][0] == '\"'){
-                assert(fields[i][strlen(fields[i]) - 1] == '\"');
-                fields[i][strlen(fields[i]) - 1] = '\0';
-                int len = strlen(fields[i]);
-                for(int j = 0; j < len; j++){
-                    // Shuffle all characters along one character.
-                    fields[i][j] = fields[i][j + 1];
-                }
+    if(strlen(field) > 0){
+        if(field[0] == '\"'){
+            assert(field[strlen(field) - 1] == '\"');
+            field[strlen(field) - 1] = '\0';
+            int len = strlen(field);
+            for(int j = 0; j < len; j++){
+                // Shuffle all characters along one character.
+                field[j] = field[j + 1];
             }
         }
     }
 
     /* Step 3: Reduce quote count where occuring. */
+    if(strlen(field) > 0){
+        /* Progress pointer - marks how much of the string has 
+            been written. */
+        int progress = 0;
+        for(int j = 0; j <= strlen(field); j++){
+            if(field[j] == '\"'){
+                /* Quotes always appear in pairs, so skip over first 
+                    quote. */
+                j++;
+            }
+            if(j != progress){
+                field[progress] = field[j];
+            }
+            progress++;
+        }
+    }
+}
+
+static struct csvRecord *lazyRow(char *line, int len,
+                                 struct internColumns *columns){
+    struct csvRecord *ret = (struct csvRecord *) malloc(sizeof(struct csvRecord));
+    assert(ret);
+    memAccountAlloc(MEM_FIELDS, sizeof(struct csvRecord));
+    ret->fieldCount = NUM_FIELDS;
+    ret->fields = NULL;
+    ret->raw = NULL;
+    ret->offset = 0;
+    if(columns->spill){
+        ret->offset = ftell(columns->spill);
+        size_t written = fwrite(line, 1, len + 1, columns->spill);
+        assert(written == (size_t)len + 1);
+        char *key = lineField(line, columns->lazyKey);
+        ret->key = internCopy(columns->pool, key, strlen(key));
+        return ret;
+    }
+
+    /* Keep the cleaned fields back to back (never longer than the line):
+        parsing on use only has to find the terminators, and the key and
+        mostly unique columns are then read from it without a copy. */
+    char *fields[NUM_FIELDS];
+    splitLine(line, fields);
+    char cleaned[len + 1];
+    int keyOffset = 0;
+    int cleanedLen = 0;
     for(int i = 0; i < NUM_FIELDS; i++){
-        if(strlen(fields[i]) > 0){
-            /* Progress pointer - marks how much of the string has 
-                been written. */
-            int progress = 0;
-            for(int j = 0; j <= strlen(fields[i]); j++){
-                if(fields[i][j] == '\"'){
-                    /* Quotes always appear in pairs, so skip over first 
-                        quote. */
-                    j++;
-                }
-                if(j != progress){
-                    fields[i][progress] = fields[i][j];
-                }
-                progress++;
+        int fieldLen = strlen(fields[i]);
+        if(i == columns->lazyKey){
+            keyOffset = cleanedLen;
+        }
+        memcpy(cleaned + cleanedLen, fields[i], fieldLen + 1);
+        cleanedLen += fieldLen + 1;
+    }
+    ret->raw = internCopy(columns->pool, cleaned, cleanedLen - 1);
+    ret->key = ret->raw + keyOffset;
+
+    if(columns->rowsSeen < INTERN_SAMPLE_ROWS){
+        /* Intern a sample row's values only to count the new ones. */
+        for(int i = 0; i < NUM_FIELDS; i++){
+            int isNew = 0;
+            if(i == columns->lazyKey){
+                continue;
             }
+            internString(columns->pool, fields[i], strlen(fields[i]), &isNew);
+            columns->newValues[i] += isNew;
         }
+        sampleRow(columns);
+    }
+    return ret;
+}
+
+/* This function reads CSVs. */
+struct csvRecord *parseLine(char *line, struct internColumns *columns,
+                            struct rowKeep *keep){
+    struct csvRecord *ret = NULL;
+    /* Fields are first cleaned in place inside line (each one is 
+        terminated where its separator was), then copied out. */
+    char *fields[NUM_FIELDS];
+    int len = strlen(line);
+    
+    /* Remove trailing whitespace first. */
+    while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')){
+        line[len - 1] = '\0';
+        len--;
+    }
+    /* Check for empty lines. */
+    if(len == 0){
+        return NULL;
+    }
+
+    /* A lazy row keeps its whole line and only parses its key. */
+    if(columns && columns->lazyKey >= 0){
+        return lazyRow(line, len, columns);
+    }
+    splitLine(line, fields);
+
+    /* Rows of other shards are dropped before anything is copied. */
+    if(keep && ! keep->keep(fields[keep->field], keep->arg)){
+        return NULL;
+    }
+
+    /* Step 4: Copy cleaned fields out of the line. */
+    char **copies = (char **) malloc(sizeof(char *) * NUM_FIELDS);
+    assert(copies);
+    memAccountAlloc(MEM_FIELDS, sizeof(char *) * NUM_FIELDS);
+    for(int i = 0; i < NUM_FIELDS; i++){
+        size_t fieldLen = strlen(fields[i]);
+        if(! columns){
+            copies[i] = strdup(fields[i]);
+            assert(copies[i]);
+            memAccountAlloc(MEM_FIELDS, fieldLen + 1);
+        } else if(columns->dedupe[i]){
+            int isNew = 0;
+            copies[i] = internString(columns->pool, fields[i], fieldLen, &isNew);
+            columns->newValues[i] += isNew;
+        } else {
+            copies[i] = internCopy(columns->pool, fields[i], fieldLen);
+        }
+    }
+    if(columns){
+        sampleRow(columns);
     }
 
     ret = (struct csvRecord *) malloc(sizeof(struct csvRecord));
     assert(ret);
-    ret->fieldCount = fieldNum;
-    ret->fields = fields;
+    memAccountAlloc(MEM_FIELDS, sizeof(struct csvRecord));
+    ret->fieldCount = NUM_FIELDS;
+    ret->fields = copies;
+    ret->raw = NULL;
+    ret->key = NULL;
+    ret->offset = 0;
 
     return ret;
 }
 
+static void sampleRow(struct internColumns *columns){
+    if(++columns->rowsSeen == INTERN_SAMPLE_ROWS){
+        /* Stop deduplicating columns that are mostly unique. */
+        for(int i = 0; i < NUM_FIELDS; i++){
+            if(columns->newValues[i] * 2 > INTERN_SAMPLE_ROWS){
+                columns->dedupe[i] = 0;
+            }
+        }
+    }
+}
+
 char *getQuery(FILE *f){
     char *line = malloc(MAX_RECORD_LEN);
     assert(line);
+    memAccountAlloc(MEM_QUERY, MAX_RECORD_LEN);
     if(fgets(line, MAX_RECORD_LEN, f) != NULL){
         rstrip_newline(&line);
         return line;
     } else {
-        if(line){
-            free(line);
-        }
+        freeQuery(line);
         return NULL;
     }
 }
 
+void freeQuery(char *query){
+    if(! query){
+        return;
+    }
+    memAccountFree(MEM_QUERY, MAX_RECORD_LEN);
+    free(query);
+}
+
 /* Read the csv header row from `fp`,
  each dynamically allocated of exact string length. 
 -> Return the Array of header strings*/
@@ -236,6 +469,7 @@ char **parse_header(FILE *input_file) {
     assert(input_file != NULL);
 
     if (fgets(line, MAX_RECORD_LEN, input_file) == NULL) {
+        free(line);
         free(headers);
         return NULL; // No header / error
     }
@@ -252,6 +486,11 @@ char **parse_header(FILE *input_file) {
         token = strtok(NULL, ",");
     }
 
+    // Columns the header does not name stay NULL
+    for (int i = count; i < NUM_FIELDS; i++) {
+        headers[i] = NULL;
+    }
+
     free(line); // free buffer allocated by malloc
 
     return headers;
@@ -273,11 +512,16 @@ void freeCSV(struct csvRecord **dataset, int num_records){
     }
     for(int i = 0; i < num_records; i++){
         for(int j = 0; j < dataset[i]->fieldCount; j++){
+            memAccountFree(MEM_FIELDS, strlen(dataset[i]->fields[j]) + 1);
             free(dataset[i]->fields[j]);
         }
+        memAccountFree(MEM_FIELDS, sizeof(char *) * NUM_FIELDS);
+        memAccountFree(MEM_FIELDS, sizeof(struct csvRecord));
         free(dataset[i]->fields);
         free(dataset[i]);
     }
+    memAccountFree(MEM_FIELDS, sizeof(struct csvRecord *) *
+                               (num_records > 0 ? num_records : 1));
     free(dataset);
 }
 
@@ -5,8 +5,3 @@
     data encapsulation in a C-centric way.
 */
 #include "record.h"
-
-struct csvRecord {
-    int fieldCount;
-    char **fields;
-};
\ No newline at end of file
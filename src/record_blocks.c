@@ -0,0 +1,331 @@
+/*
+    Record blocks: block b holds the lines starting at stream offsets
+    [blockStart[b], blockStart[b + 1]), deflated with the shared preset
+    dictionary into packed[b]. A read finds its block by binary search
+    over blockStart and inflates it into the calling thread's block
+    cache unless the part it needs is there already: a block is first
+    inflated only up to the end of the line read, and completely if a
+    later line of it is read.
+*/
+#include "record_blocks.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <zlib.h>
+
+/* Raw deflate: no header or checksum, so a block starts with no dictionary
+   id to check and inflating needs no adler32 of the dictionary */
+#define RAW_WINDOW_BITS 15
+#define DEFLATE_MEM_LEVEL 8
+
+struct recordBlocks {
+    unsigned long id;            // tells the blocks of different stores apart
+    int numBlocks;
+    long *blockStart;            // numBlocks + 1 stream offsets
+    unsigned char **packed;      // deflated bytes of each block
+    unsigned int *packedLen;
+    unsigned char *dict;         // preset dictionary
+    unsigned int dictLen;
+    size_t packedBytes;          // sum of packedLen
+    atomic_long hits;            // reads served by an inflated block
+    atomic_long misses;          // reads that inflated their block
+};
+
+/* One inflated block in a thread's cache */
+struct cachedBlock {
+    unsigned long owner;         // id of its recordBlocks, 0 while free
+    int block;
+    unsigned long used;          // LRU stamp
+    char *data;
+    size_t cap;
+    size_t have;                 // bytes of the block inflated
+};
+
+/* A thread's inflated blocks, and the stream it inflates them with */
+struct blockCache {
+    unsigned long clock;
+    z_stream z;
+    struct cachedBlock slots[RECORD_BLOCK_CACHE];
+};
+
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+static atomic_ulong nextId = 1;
+
+/* Helpers */
+static void createCacheKey(void);
+static void freeBlockCache(void *arg);
+static struct blockCache *threadCache(void);
+static unsigned char *sampleDictionary(FILE *lines, const long *offsets, int n,
+                                       unsigned int *len);
+static void readBytes(FILE *lines, long start, size_t len, unsigned char *out);
+static void packBlock(struct recordBlocks *b, z_stream *z, int block,
+                      const unsigned char *raw);
+static int findBlock(struct recordBlocks *b, long start);
+static void inflateBlock(struct recordBlocks *b, z_stream *z, int block,
+                         size_t want, struct cachedBlock *slot);
+
+static void createCacheKey(void) {
+    int err = pthread_key_create(&cacheKey, freeBlockCache);
+    assert(err == 0);
+}
+
+/* helper: free a block cache (also run for each thread as it exits) */
+static void freeBlockCache(void *arg) {
+    struct blockCache *cache = arg;
+    if (!cache) return;
+    for (int i = 0; i < RECORD_BLOCK_CACHE; i++) {
+        if (!cache->slots[i].data) continue;
+        memAccountFree(MEM_DATA, cache->slots[i].cap);
+        free(cache->slots[i].data);
+    }
+    inflateEnd(&cache->z);
+    memAccountFree(MEM_DATA, sizeof(*cache));
+    free(cache);
+}
+
+/* helper: the calling thread's block cache, made on first use */
+static struct blockCache *threadCache(void) {
+    pthread_once(&cacheKeyOnce, createCacheKey);
+    struct blockCache *cache = pthread_getspecific(cacheKey);
+    if (cache) return cache;
+    cache = calloc(1, sizeof(*cache));
+    assert(cache);
+    memAccountAlloc(MEM_DATA, sizeof(*cache));
+    int err = inflateInit2(&cache->z, -RAW_WINDOW_BITS);
+    assert(err == Z_OK);
+    pthread_setspecific(cacheKey, cache);
+    return cache;
+}
+
+/* helper: read [start, start + len) of the line file */
+static void readBytes(FILE *lines, long start, size_t len, unsigned char *out) {
+    int moved = fseek(lines, start, SEEK_SET);
+    assert(moved == 0);
+    size_t got = fread(out, 1, len, lines);
+    assert(got == len);
+}
+
+/* helper: up to RECORD_DICT_BYTES of whole lines taken at an even stride
+   through the file. zlib finds the end of a dictionary cheapest to
+   refer to, so the sample keeps file order. */
+static unsigned char *sampleDictionary(FILE *lines, const long *offsets, int n,
+                                       unsigned int *len) {
+    unsigned char *dict = malloc(RECORD_DICT_BYTES);
+    assert(dict);
+    *len = 0;
+    if (n == 0) return dict;
+    long average = (offsets[n] - offsets[0]) / n;
+    long wanted = RECORD_DICT_BYTES / (average > 0 ? average : 1);
+    int stride = wanted > 0 && wanted < n ? (int)(n / wanted) : 1;
+    for (int row = 0; row < n; row += stride) {
+        size_t lineLen = (size_t)(offsets[row + 1] - offsets[row]);
+        if (*len + lineLen > RECORD_DICT_BYTES) break;
+        readBytes(lines, offsets[row], lineLen, dict + *len);
+        *len += (unsigned int)lineLen;
+    }
+    dict = realloc(dict, *len > 0 ? *len : 1);
+    assert(dict);
+    return dict;
+}
+
+/* helper: deflate the raw bytes of one block with the dictionary */
+static void packBlock(struct recordBlocks *b, z_stream *z, int block,
+                      const unsigned char *raw) {
+    uLong rawLen = (uLong)(b->blockStart[block + 1] - b->blockStart[block]);
+    uLong cap = deflateBound(z, rawLen);
+    unsigned char *out = malloc(cap);
+    assert(out);
+    int err = deflateReset(z);
+    assert(err == Z_OK);
+    if (b->dictLen > 0) {
+        err = deflateSetDictionary(z, b->dict, b->dictLen);
+        assert(err == Z_OK);
+    }
+    z->next_in = (unsigned char *)raw;
+    z->avail_in = (uInt)rawLen;
+    z->next_out = out;
+    z->avail_out = (uInt)cap;
+    err = deflate(z, Z_FINISH);
+    assert(err == Z_STREAM_END);
+
+    // Keep only the bytes used
+    unsigned int used = (unsigned int)(cap - z->avail_out);
+    b->packed[block] = realloc(out, used > 0 ? used : 1);
+    assert(b->packed[block]);
+    b->packedLen[block] = used;
+    b->packedBytes += used;
+}
+
+struct recordBlocks *recordBlocksNew(FILE *lines, const long *offsets, int n) {
+    assert(lines && offsets && n >= 0);
+    int flushed = fflush(lines);
+    assert(flushed == 0);
+    struct recordBlocks *b = malloc(sizeof(*b));
+    assert(b);
+    b->id = atomic_fetch_add(&nextId, 1);
+    b->packedBytes = 0;
+    atomic_init(&b->hits, 0);
+    atomic_init(&b->misses, 0);
+    b->dict = sampleDictionary(lines, offsets, n, &b->dictLen);
+
+    // Cut the lines into runs of at most RECORD_BLOCK_BYTES (a longer
+    // line gets a block of its own)
+    b->blockStart = malloc(sizeof(long) * (n + 1));
+    assert(b->blockStart);
+    int numBlocks = 0;
+    for (int row = 0; row < n; row++) {
+        if (numBlocks == 0 ||
+            offsets[row + 1] - b->blockStart[numBlocks - 1] > RECORD_BLOCK_BYTES) {
+            b->blockStart[numBlocks++] = offsets[row];
+        }
+    }
+    b->blockStart[numBlocks] = offsets[n];
+    b->numBlocks = numBlocks;
+    b->blockStart = realloc(b->blockStart, sizeof(long) * (numBlocks + 1));
+    b->packed = malloc(sizeof(*b->packed) * (numBlocks > 0 ? numBlocks : 1));
+    b->packedLen = malloc(sizeof(*b->packedLen) *
+                          (numBlocks > 0 ? numBlocks : 1));
+    assert(b->blockStart && b->packed && b->packedLen);
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    int err = deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                           -RAW_WINDOW_BITS, DEFLATE_MEM_LEVEL,
+                           Z_DEFAULT_STRATEGY);
+    assert(err == Z_OK);
+    unsigned char *raw = NULL;
+    size_t rawCap = 0;
+    for (int block = 0; block < numBlocks; block++) {
+        size_t rawLen = (size_t)(b->blockStart[block + 1] - b->blockStart[block]);
+        if (rawLen > rawCap) {
+            rawCap = rawLen;
+            raw = realloc(raw, rawCap);
+            assert(raw);
+        }
+        readBytes(lines, b->blockStart[block], rawLen, raw);
+        packBlock(b, &z, block, raw);
+    }
+    deflateEnd(&z);
+    free(raw);
+    memAccountAlloc(MEM_DATA, recordBlocksBytes(b));
+    return b;
+}
+
+/* helper: the block holding stream offset start */
+static int findBlock(struct recordBlocks *b, long start) {
+    int lo = 0, hi = b->numBlocks - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (b->blockStart[mid] <= start) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/* helper: inflate the first `want` bytes of block into a cache slot */
+static void inflateBlock(struct recordBlocks *b, z_stream *z, int block,
+                         size_t want, struct cachedBlock *slot) {
+    size_t rawLen = (size_t)(b->blockStart[block + 1] - b->blockStart[block]);
+    if (rawLen > slot->cap) {
+        if (slot->data) {
+            memAccountResize(MEM_DATA, slot->cap, rawLen);
+        } else {
+            memAccountAlloc(MEM_DATA, rawLen);
+        }
+        slot->data = realloc(slot->data, rawLen);
+        assert(slot->data);
+        slot->cap = rawLen;
+    }
+    int err = inflateReset(z);
+    assert(err == Z_OK);
+    if (b->dictLen > 0) {
+        err = inflateSetDictionary(z, b->dict, b->dictLen);
+        assert(err == Z_OK);
+    }
+    z->next_in = b->packed[block];
+    z->avail_in = b->packedLen[block];
+    z->next_out = (unsigned char *)slot->data;
+    z->avail_out = (uInt)want;
+    err = inflate(z, Z_NO_FLUSH);
+    assert((err == Z_OK || err == Z_STREAM_END) && z->avail_out == 0);
+    slot->have = want;
+}
+
+void recordBlocksRead(struct recordBlocks *b, long start, size_t len,
+                      char *out) {
+    assert(b && b->numBlocks > 0 && start >= b->blockStart[0]);
+    int block = findBlock(b, start);
+    assert(start + (long)len <= b->blockStart[block + 1]);
+    struct blockCache *cache = threadCache();
+
+    struct cachedBlock *victim = &cache->slots[0];
+    struct cachedBlock *slot = NULL;
+    for (int i = 0; i < RECORD_BLOCK_CACHE; i++) {
+        struct cachedBlock *s = &cache->slots[i];
+        if (s->owner == b->id && s->block == block) {
+            slot = s;
+            break;
+        }
+        if (s->used < victim->used) victim = s;
+    }
+    size_t end = (size_t)(start - b->blockStart[block]) + len;
+    if (slot && slot->have >= end) {
+        atomic_fetch_add_explicit(&b->hits, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&b->misses, 1, memory_order_relaxed);
+        // Inflated from the start again: up to this line the first time,
+        // all of the block the next
+        size_t want = slot ? (size_t)(b->blockStart[block + 1] -
+                                      b->blockStart[block])
+                           : end;
+        if (!slot) slot = victim;
+        slot->owner = 0;             // until the block is inflated
+        inflateBlock(b, &cache->z, block, want, slot);
+        slot->owner = b->id;
+        slot->block = block;
+    }
+    slot->used = ++cache->clock;
+    memcpy(out, slot->data + (start - b->blockStart[block]), len);
+}
+
+size_t recordBlocksBytes(struct recordBlocks *b) {
+    assert(b);
+    return sizeof(*b) + b->packedBytes + b->dictLen +
+           (size_t)b->numBlocks * (sizeof(*b->packed) + sizeof(*b->packedLen)) +
+           sizeof(long) * (size_t)(b->numBlocks + 1);
+}
+
+void recordBlocksPrintStats(struct recordBlocks *b, FILE *out) {
+    assert(b && out);
+    long raw = b->numBlocks > 0
+                   ? b->blockStart[b->numBlocks] - b->blockStart[0] : 0;
+    long hits = atomic_load(&b->hits);
+    long misses = atomic_load(&b->misses);
+    fprintf(out, "record blocks: %d blocks, %ld raw bytes, %zu packed bytes "
+                 "(%.2fx, dictionary %u bytes); %ld reads, %ld inflated "
+                 "(%.1f%% block cache hits)\n",
+            b->numBlocks, raw, b->packedBytes,
+            b->packedBytes > 0 ? (double)raw / b->packedBytes : 0.0,
+            b->dictLen, hits + misses, misses,
+            hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+}
+
+void recordBlocksFree(struct recordBlocks *b) {
+    if (!b) return;
+    pthread_once(&cacheKeyOnce, createCacheKey);
+    freeBlockCache(pthread_getspecific(cacheKey));
+    pthread_setspecific(cacheKey, NULL);
+    memAccountFree(MEM_DATA, recordBlocksBytes(b));
+    for (int block = 0; block < b->numBlocks; block++) free(b->packed[block]);
+    free(b->packed);
+    free(b->packedLen);
+    free(b->blockStart);
+    free(b->dict);
+    free(b);
+}
@@ -0,0 +1,161 @@
+/*
+    Record store: the single owner of all parsed rows.
+
+    Rows live in one contiguous array of struct data in file order, so a
+    row reference is just a pointer into that array and its row number
+    can be recovered by pointer arithmetic.
+*/
+#include "record_store.h"
+#include "dict_common.h"
+#include "record.h"
+#include "intern.h"
+#include "record_blocks.h"
+#include "mem_account.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+struct recordStore {
+    struct data *rows;   // n rows, file order
+    int n;
+    struct internPool *pool;  // owner of the field strings, or NULL
+    struct lazyRows lazy;     // shared by lazy and on-disk rows
+    FILE *recordFile;         // lines of the on-disk rows, or NULL
+    struct recordBlocks *blocks;  // lines of the packed rows, or NULL
+    long *offsets;            // on-disk and packed rows: n + 1 line offsets
+};
+
+struct recordStore *recordStoreNew(struct csvRecord **dataset, int n,
+                                   struct internPool *pool) {
+    return recordStoreNewOnDisk(dataset, n, pool, -1, NULL, 0);
+}
+
+struct recordStore *recordStoreNewLazy(struct csvRecord **dataset, int n,
+                                       struct internPool *pool,
+                                       int keyField, const int *dedupe) {
+    struct recordStore *store = recordStoreNewOnDisk(dataset, n, pool,
+                                                     keyField, NULL, 0);
+    memcpy(store->lazy.dedupe, dedupe, sizeof(store->lazy.dedupe));
+    return store;
+}
+
+struct recordStore *recordStoreNewOnDisk(struct csvRecord **dataset, int n,
+                                         struct internPool *pool,
+                                         int keyField, FILE *recordFile,
+                                         int cacheRows) {
+    assert(n >= 0 && (dataset || n == 0));
+    struct recordStore *store = malloc(sizeof(*store));
+    assert(store);
+
+    store->n = n;
+    store->pool = pool;
+    store->recordFile = recordFile;
+    store->blocks = NULL;
+    store->offsets = NULL;
+    store->lazy.pool = pool;
+    store->lazy.keyField = keyField;
+    store->lazy.fd = -1;
+    store->lazy.blocks = NULL;
+    store->lazy.offsets = NULL;
+    store->lazy.cacheRows = cacheRows;
+    for (int i = 0; i < NUM_FIELDS; i++) store->lazy.dedupe[i] = 1;
+    store->rows = malloc(sizeof(struct data) * (n > 0 ? n : 1));
+    assert(store->rows);
+    memAccountAlloc(MEM_DATA, sizeof(*store));
+    memAccountAlloc(MEM_DATA, sizeof(struct data) * (n > 0 ? n : 1));
+    store->lazy.rows = store->rows;
+    if (recordFile) {
+        // Row i ends where row i + 1 starts; the last one at end of file
+        int flushed = fflush(recordFile);
+        assert(flushed == 0);
+        store->offsets = malloc(sizeof(long) * (n + 1));
+        assert(store->offsets);
+        memAccountAlloc(MEM_DATA, sizeof(long) * (n + 1));
+        for (int i = 0; i < n; i++) store->offsets[i] = dataset[i]->offset;
+        store->offsets[n] = ftell(recordFile);
+        store->lazy.fd = fileno(recordFile);
+        store->lazy.offsets = store->offsets;
+    }
+
+    for (int i = 0; i < n; i++) {
+        assert(dataset[i]->fieldCount == NUM_FIELDS);
+        // Move the field strings instead of copying them
+        struct data *row = &store->rows[i];
+        row->fields = dataset[i]->fields;
+        row->raw = dataset[i]->raw;
+        row->key = dataset[i]->key;
+        row->lazy = NULL;
+        if (!row->fields) {
+            // Lazy (raw line in memory) or on disk (line in recordFile)
+            assert(pool && keyField >= 0 && (row->raw || recordFile));
+            row->lazy = &store->lazy;
+        }
+        memAccountFree(MEM_FIELDS, sizeof(*dataset[i]));
+        free(dataset[i]);
+    }
+    memAccountFree(MEM_FIELDS, sizeof(*dataset) * (n > 0 ? n : 1));
+    free(dataset);
+    return store;
+}
+
+struct recordStore *recordStoreNewPacked(struct csvRecord **dataset, int n,
+                                         struct internPool *pool,
+                                         int keyField, FILE *recordFile,
+                                         int cacheRows) {
+    assert(recordFile);
+    struct recordStore *store = recordStoreNewOnDisk(dataset, n, pool, keyField,
+                                                     recordFile, cacheRows);
+    // Same rows and offsets; only where the lines are read from changes
+    store->blocks = recordBlocksNew(recordFile, store->offsets, n);
+    fclose(recordFile);
+    store->recordFile = NULL;
+    store->lazy.fd = -1;
+    store->lazy.blocks = store->blocks;
+    return store;
+}
+
+struct recordBlocks *recordStoreBlocks(struct recordStore *store) {
+    return store->blocks;
+}
+
+int recordStoreSize(struct recordStore *store) {
+    return store->n;
+}
+
+struct data *recordStoreGet(struct recordStore *store, int row) {
+    assert(row >= 0 && row < store->n);
+    return &store->rows[row];
+}
+
+int recordStoreRow(struct recordStore *store, struct data *rec) {
+    assert(rec >= store->rows && rec < store->rows + store->n);
+    return (int)(rec - store->rows);
+}
+
+void recordStoreFree(struct recordStore *store) {
+    if (!store) return;
+    for (int i = 0; i < store->n; i++) {
+        char **fields = store->rows[i].fields;
+        for (int j = 0; !store->pool && j < NUM_FIELDS; j++) {
+            memAccountFree(MEM_FIELDS, strlen(fields[j]) + 1);
+            free(fields[j]);
+        }
+        // Lazy rows that were never needed have no array
+        if (fields) memAccountFree(MEM_FIELDS, sizeof(char *) * NUM_FIELDS);
+        free(fields);
+    }
+    internPoolFree(store->pool);
+    if (store->recordFile || store->blocks) {
+        dataCacheRelease();
+        memAccountFree(MEM_DATA, sizeof(long) * (store->n + 1));
+        free(store->offsets);
+    }
+    if (store->recordFile) fclose(store->recordFile);
+    recordBlocksFree(store->blocks);
+    memAccountFree(MEM_DATA,
+                   sizeof(struct data) * (store->n > 0 ? store->n : 1));
+    memAccountFree(MEM_DATA, sizeof(*store));
+    free(store->rows);
+    free(store);
+}
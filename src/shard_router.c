@@ -0,0 +1,270 @@
+/*
+    Shard router: requests are a uint32 length and the query text; a reply
+    is a struct shardReply followed by textBytes bytes - the answer's key
+    (NUL terminated, only if numRecords > 0) and its record lines as they
+    go to the output file. A shard exits when its socket is closed.
+*/
+#include "shard_router.h"
+#include "multi_index.h"
+#include "record_store.h"
+#include "dict_common.h"
+#include "edit_distance.h"
+#include "intern.h"
+#include "read.h"
+#include "decompress.h"
+#include "bit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+struct shardReply {
+    int32_t numRecords;
+    int32_t bitCount;
+    int32_t nodeCount;
+    int32_t stringCount;
+    uint32_t textBytes;
+};
+
+struct shardRouter {
+    int shards;
+    int fds[SHARD_MAX];            // router end of each shard's socket
+    pid_t pids[SHARD_MAX];
+    struct shardReply replies[SHARD_MAX];
+    char *texts[SHARD_MAX];        // reply payloads, reused between queries
+    size_t textCaps[SHARD_MAX];
+};
+
+/* Rows one shard keeps */
+struct shardFilter {
+    int shard;
+    int shards;
+};
+
+/* Helpers */
+static int shardOf(const char *key, int shards);
+static int keepShardRow(const char *value, void *arg);
+static void writeAll(int fd, const void *buf, size_t len);
+static int readAll(int fd, void *buf, size_t len);
+static void shardServe(const char *inputCSV, const char *keyColumn,
+                       int shard, int shards, int fd);
+static int commonPrefixBits(char *a, char *b);
+
+/* helper: the shard owning a key (FNV-1a hash) */
+static int shardOf(const char *key, int shards) {
+    uint32_t h = FNV_OFFSET;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h = (h ^ *p) * FNV_PRIME;
+    }
+    return (int)(h % (uint32_t)shards);
+}
+
+/* helper: rowKeepFn loading the rows of one shard */
+static int keepShardRow(const char *value, void *arg) {
+    struct shardFilter *filter = arg;
+    return shardOf(value, filter->shards) == filter->shard;
+}
+
+/* helper: write all of buf, retrying short writes */
+static void writeAll(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t done = write(fd, p, len);
+        assert(done > 0);
+        p += done;
+        len -= (size_t)done;
+    }
+}
+
+/* helper: read exactly len bytes; 0 if the other side closed first */
+static int readAll(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t done = read(fd, p, len);
+        if (done <= 0) return 0;
+        p += done;
+        len -= (size_t)done;
+    }
+    return 1;
+}
+
+/* helper: body of a shard process - load, build, then answer queries
+   until the router closes the socket */
+static void shardServe(const char *inputCSV, const char *keyColumn,
+                       int shard, int shards, int fd) {
+    FILE *input = compressedOpen(inputCSV);
+    assert(input);
+    char **headers = parse_header(input);
+    assert(headers);
+    int keyField = -1;
+    for (int i = 0; i < NUM_FIELDS; i++) {
+        if (strcmp(headers[i], keyColumn) == 0) keyField = i;
+    }
+    assert(keyField >= 0);
+
+    struct shardFilter filter = {shard, shards};
+    struct internPool *pool = internPoolNew(INTERN_DEFAULT_SLOTS);
+    int n = 0;
+    struct csvRecord **dataset = readCSVFiltered(input, &n, pool, keyField,
+                                                 keepShardRow, &filter);
+    struct recordStore *store = recordStoreNew(dataset, n, pool);
+    struct multiIndex *mi = multiIndexNew(store, headers);
+    int declared = multiIndexDeclare(mi, keyColumn);
+    assert(declared == 0);
+    multiIndexBuild(mi, 1);
+
+    uint32_t queryLen = 0;
+    size_t queryCap = 0;
+    char *query = NULL;
+    while (readAll(fd, &queryLen, sizeof(queryLen))) {
+        if (queryLen + 1 > queryCap) {
+            queryCap = queryLen + 1;
+            query = realloc(query, queryCap);
+            assert(query);
+        }
+        int complete = readAll(fd, query, queryLen);
+        assert(complete);
+        query[queryLen] = '\0';
+
+        struct resultSpan span;
+        multiIndexLookupSpan(mi, query, &span);
+        char *text = NULL;
+        size_t textLen = 0;
+        FILE *out = open_memstream(&text, &textLen);
+        assert(out);
+        if (span.numRecords > 0) {
+            fputs(dataField(span.records[0], keyField), out);
+            fputc('\0', out);
+        }
+        printRecords(span.records, span.numRecords, headers, out);
+        fclose(out);
+
+        struct shardReply reply = {span.numRecords, span.bitCount,
+                                   span.nodeCount, span.stringCount,
+                                   (uint32_t)textLen};
+        writeAll(fd, &reply, sizeof(reply));
+        writeAll(fd, text, textLen);
+        free(text);
+    }
+
+    free(query);
+    multiIndexFree(mi);
+    recordStoreFree(store);
+    freeHeader(headers, NUM_FIELDS);
+    fclose(input);
+}
+
+struct shardRouter *shardRouterNew(const char *inputCSV,
+                                   const char *keyColumn, int shards) {
+    assert(inputCSV && keyColumn && shards >= 1 && shards <= SHARD_MAX);
+    struct shardRouter *router = malloc(sizeof(*router));
+    assert(router);
+    router->shards = shards;
+
+    // Nothing buffered may be written twice by a child
+    fflush(NULL);
+    for (int s = 0; s < shards; s++) {
+        int pair[2];
+        int err = socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+        assert(err == 0);
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            // Keep only this shard's end, so every shard sees EOF as soon
+            // as the router closes its socket
+            for (int t = 0; t < s; t++) close(router->fds[t]);
+            close(pair[0]);
+            shardServe(inputCSV, keyColumn, s, shards, pair[1]);
+            close(pair[1]);
+            _exit(EXIT_SUCCESS);
+        }
+        close(pair[1]);
+        router->fds[s] = pair[0];
+        router->pids[s] = pid;
+        router->texts[s] = NULL;
+        router->textCaps[s] = 0;
+    }
+    return router;
+}
+
+/* helper: number of leading bits a and b share, counting the terminating
+   NUL as part of the key (equal strings share all their bits) */
+static int commonPrefixBits(char *a, char *b) {
+    int i = 0;
+    while (a[i] == b[i] && a[i] != '\0') i++;
+    int bits = i * BITS_PER_BYTE;
+    if (a[i] == b[i]) return bits + BITS_PER_BYTE;
+    while (getBit(a, bits) == getBit(b, bits)) bits++;
+    return bits;
+}
+
+void shardRouterAnswer(struct shardRouter *router, char *query,
+                       FILE *summaryFile, FILE *outputFile) {
+    assert(router && query);
+    // Fan out first so the shards work on the query side by side
+    uint32_t queryLen = (uint32_t)strlen(query);
+    for (int s = 0; s < router->shards; s++) {
+        writeAll(router->fds[s], &queryLen, sizeof(queryLen));
+        writeAll(router->fds[s], query, queryLen);
+    }
+
+    struct resultSpan span = {query, NULL, 0, 0, 0, 0};
+    int best = -1, bestPrefix = 0, bestDist = 0;
+    for (int s = 0; s < router->shards; s++) {
+        struct shardReply *reply = &router->replies[s];
+        int complete = readAll(router->fds[s], reply, sizeof(*reply));
+        if (reply->textBytes > router->textCaps[s]) {
+            router->textCaps[s] = reply->textBytes;
+            router->texts[s] = realloc(router->texts[s], reply->textBytes);
+            assert(router->texts[s]);
+        }
+        complete = complete &&
+                   readAll(router->fds[s], router->texts[s], reply->textBytes);
+        assert(complete);
+        span.bitCount += reply->bitCount;
+        span.nodeCount += reply->nodeCount;
+        span.stringCount += reply->stringCount;
+        if (reply->numRecords == 0) continue;
+
+        char *key = router->texts[s];
+        int prefix = commonPrefixBits(query, key);
+        int dist = editDistance(query, key, (int)strlen(query),
+                                (int)strlen(key));
+        if (best < 0 || prefix > bestPrefix ||
+            (prefix == bestPrefix &&
+             (dist < bestDist ||
+              (dist == bestDist && strcmp(key, router->texts[best]) < 0)))) {
+            best = s;
+            bestPrefix = prefix;
+            bestDist = dist;
+        }
+    }
+
+    if (best >= 0) span.numRecords = router->replies[best].numRecords;
+    printSpanHeader(&span, summaryFile, outputFile);
+    if (best >= 0) {
+        size_t keyBytes = strlen(router->texts[best]) + 1;
+        fwrite(router->texts[best] + keyBytes, 1,
+               router->replies[best].textBytes - keyBytes, outputFile);
+    }
+}
+
+void shardRouterFree(struct shardRouter *router) {
+    if (!router) return;
+    for (int s = 0; s < router->shards; s++) {
+        close(router->fds[s]);
+    }
+    for (int s = 0; s < router->shards; s++) {
+        waitpid(router->pids[s], NULL, 0);
+        free(router->texts[s]);
+    }
+    free(router);
+}
@@ -0,0 +1,396 @@
+/*
+    Packed k-d tree over record coordinates.
+
+    The tree is implicit: for a range [lo, hi) of the point array the
+    node is the median element mid = (lo + hi) / 2, its left subtree is
+    [lo, mid) and its right subtree is [mid + 1, hi). The split axis
+    alternates between x (even depth) and y (odd depth).
+*/
+#include "spatial_index.h"
+#include "record_store.h"
+#include "dict_common.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define NUM_AXES 2
+#define MAX_QUERY_NUMBERS 4
+
+struct kdPoint {
+    double coord[NUM_AXES];
+    int row;
+};
+
+struct spatialIndex {
+    struct recordStore *store;
+    struct kdPoint *points;
+    int n;
+};
+
+/* A bounded max-heap of the best k candidates found so far */
+struct knnHeap {
+    double *dist;
+    int *row;
+    int size;
+    int k;
+};
+
+/* Helpers */
+static int parseCoordinate(const char *s, double *out);
+static int pointBefore(struct kdPoint *a, struct kdPoint *b, int axis);
+static void selectMedian(struct kdPoint *p, int lo, int hi, int k, int axis);
+static void buildTree(struct kdPoint *p, int lo, int hi, int depth);
+static int heapWorse(double distA, int rowA, double distB, int rowB);
+static void heapSiftDown(struct knnHeap *h, int i, double dist, int row);
+static void heapOffer(struct knnHeap *h, double dist, int row);
+static int heapPop(struct knnHeap *h);
+static void searchNearest(struct spatialIndex *si, int lo, int hi, int depth,
+                          const double q[NUM_AXES], struct knnHeap *h,
+                          int *visited);
+static void searchBox(struct spatialIndex *si, int lo, int hi, int depth,
+                      const double lower[NUM_AXES], const double upper[NUM_AXES],
+                      int **rows, int *count, int *cap, int *visited);
+static struct queryResult *newResult(const char *searchString);
+static int parseNumbers(const char *s, double *vals, int max);
+static int compareRows(const void *a, const void *b);
+static size_t indexBytes(struct spatialIndex *si);
+
+/* helper: bytes of the index and its point array */
+static size_t indexBytes(struct spatialIndex *si) {
+    return sizeof(*si) + sizeof(struct kdPoint) * (si->n > 0 ? si->n : 1);
+}
+
+/* helper: parse a whole field as a number */
+static int parseCoordinate(const char *s, double *out) {
+    char *end = NULL;
+    if (!s || *s == '\0') return 0;
+    *out = strtod(s, &end);
+    return *end == '\0';
+}
+
+struct spatialIndex *spatialIndexNew(struct recordStore *store, int xField,
+                                     int yField) {
+    assert(store && xField >= 0 && xField < NUM_FIELDS &&
+           yField >= 0 && yField < NUM_FIELDS);
+    struct spatialIndex *si = malloc(sizeof(*si));
+    assert(si);
+    si->store = store;
+
+    int rows = recordStoreSize(store);
+    si->points = malloc(sizeof(struct kdPoint) * (rows > 0 ? rows : 1));
+    assert(si->points);
+    si->n = 0;
+
+    for (int row = 0; row < rows; row++) {
+        struct data *rec = recordStoreGet(store, row);
+        struct kdPoint *p = &si->points[si->n];
+        if (parseCoordinate(dataField(rec, xField), &p->coord[0]) &&
+            parseCoordinate(dataField(rec, yField), &p->coord[1])) {
+            p->row = row;
+            si->n++;
+        }
+    }
+
+    // Rows without coordinates leave the tail of the array unused
+    si->points = realloc(si->points,
+                         sizeof(struct kdPoint) * (si->n > 0 ? si->n : 1));
+    assert(si->points);
+    buildTree(si->points, 0, si->n, 0);
+    memAccountAlloc(MEM_SPATIAL, indexBytes(si));
+    return si;
+}
+
+/* helper: strict ordering on one axis, ties broken by file order */
+static int pointBefore(struct kdPoint *a, struct kdPoint *b, int axis) {
+    if (a->coord[axis] != b->coord[axis]) {
+        return a->coord[axis] < b->coord[axis];
+    }
+    return a->row < b->row;
+}
+
+/* helper: quickselect so that p[k] is the k-th smallest of p[lo..hi) on axis */
+static void selectMedian(struct kdPoint *p, int lo, int hi, int k, int axis) {
+    hi--;
+    while (lo < hi) {
+        struct kdPoint pivot = p[(lo + hi) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (pointBefore(&p[i], &pivot, axis)) i++;
+            while (pointBefore(&pivot, &p[j], axis)) j--;
+            if (i <= j) {
+                struct kdPoint tmp = p[i];
+                p[i] = p[j];
+                p[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            return;
+        }
+    }
+}
+
+/* helper: arrange p[lo..hi) into an implicit k-d tree */
+static void buildTree(struct kdPoint *p, int lo, int hi, int depth) {
+    if (hi - lo <= 1) return;
+    int mid = (lo + hi) / 2;
+    selectMedian(p, lo, hi, mid, depth % NUM_AXES);
+    buildTree(p, lo, mid, depth + 1);
+    buildTree(p, mid + 1, hi, depth + 1);
+}
+
+/* helper: is candidate a worse than candidate b (farther, then later row) */
+static int heapWorse(double distA, int rowA, double distB, int rowB) {
+    return distA > distB || (distA == distB && rowA > rowB);
+}
+
+/* helper: fill the hole at i with (dist, row), moving worse children up */
+static void heapSiftDown(struct knnHeap *h, int i, double dist, int row) {
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= h->size) break;
+        if (child + 1 < h->size &&
+            heapWorse(h->dist[child + 1], h->row[child + 1],
+                      h->dist[child], h->row[child])) {
+            child++;
+        }
+        if (!heapWorse(h->dist[child], h->row[child], dist, row)) break;
+        h->dist[i] = h->dist[child];
+        h->row[i] = h->row[child];
+        i = child;
+    }
+    h->dist[i] = dist;
+    h->row[i] = row;
+}
+
+/* helper: keep the k best candidates, the worst one at the root */
+static void heapOffer(struct knnHeap *h, double dist, int row) {
+    if (h->size == h->k) {
+        if (heapWorse(h->dist[0], h->row[0], dist, row)) {
+            heapSiftDown(h, 0, dist, row);
+        }
+        return;
+    }
+    int i = h->size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!heapWorse(dist, row, h->dist[parent], h->row[parent])) break;
+        h->dist[i] = h->dist[parent];
+        h->row[i] = h->row[parent];
+        i = parent;
+    }
+    h->dist[i] = dist;
+    h->row[i] = row;
+}
+
+/* helper: remove and return the row of the worst candidate */
+static int heapPop(struct knnHeap *h) {
+    int worst = h->row[0];
+    h->size--;
+    if (h->size > 0) {
+        heapSiftDown(h, 0, h->dist[h->size], h->row[h->size]);
+    }
+    return worst;
+}
+
+static void searchNearest(struct spatialIndex *si, int lo, int hi, int depth,
+                          const double q[NUM_AXES], struct knnHeap *h,
+                          int *visited) {
+    if (lo >= hi) return;
+    int mid = (lo + hi) / 2;
+    int axis = depth % NUM_AXES;
+    struct kdPoint *p = &si->points[mid];
+    (*visited)++;
+
+    double dx = q[0] - p->coord[0];
+    double dy = q[1] - p->coord[1];
+    heapOffer(h, dx * dx + dy * dy, p->row);
+
+    double diff = q[axis] - p->coord[axis];
+    if (diff < 0) {
+        searchNearest(si, lo, mid, depth + 1, q, h, visited);
+        if (h->size < h->k || diff * diff <= h->dist[0]) {
+            searchNearest(si, mid + 1, hi, depth + 1, q, h, visited);
+        }
+    } else {
+        searchNearest(si, mid + 1, hi, depth + 1, q, h, visited);
+        if (h->size < h->k || diff * diff <= h->dist[0]) {
+            searchNearest(si, lo, mid, depth + 1, q, h, visited);
+        }
+    }
+}
+
+/* helper: an empty result for searchString */
+static struct queryResult *newResult(const char *searchString) {
+    struct queryResult *qr = malloc(sizeof(*qr));
+    assert(qr);
+    qr->searchString = strdup(searchString);
+    assert(qr->searchString);
+    qr->numRecords = 0;
+    qr->records = NULL;
+    qr->bitCount = 0;
+    qr->nodeCount = 0;
+    qr->stringCount = 0;
+    return qr;
+}
+
+struct queryResult *spatialIndexNearest(struct spatialIndex *si, double x,
+                                        double y, int k) {
+    assert(si && k > 0);
+    char searchString[128];
+    snprintf(searchString, sizeof(searchString), "%s%.9g,%.9g,%d",
+             SPATIAL_NEAR_PREFIX, x, y, k);
+    struct queryResult *qr = newResult(searchString);
+
+    struct knnHeap h;
+    h.k = k;
+    h.size = 0;
+    h.dist = malloc(sizeof(double) * k);
+    h.row = malloc(sizeof(int) * k);
+    assert(h.dist && h.row);
+
+    double q[NUM_AXES] = {x, y};
+    searchNearest(si, 0, si->n, 0, q, &h, &qr->nodeCount);
+
+    // Pop the heap from the worst candidate down: nearest ends up first
+    qr->numRecords = h.size;
+    qr->records = malloc(sizeof(struct data *) * (h.size > 0 ? h.size : 1));
+    assert(qr->records);
+    while (h.size > 0) {
+        int slot = h.size - 1;
+        qr->records[slot] = recordStoreGet(si->store, heapPop(&h));
+    }
+
+    free(h.dist);
+    free(h.row);
+    return qr;
+}
+
+static void searchBox(struct spatialIndex *si, int lo, int hi, int depth,
+                      const double lower[NUM_AXES], const double upper[NUM_AXES],
+                      int **rows, int *count, int *cap, int *visited) {
+    if (lo >= hi) return;
+    int mid = (lo + hi) / 2;
+    int axis = depth % NUM_AXES;
+    struct kdPoint *p = &si->points[mid];
+    (*visited)++;
+
+    if (p->coord[0] >= lower[0] && p->coord[0] <= upper[0] &&
+        p->coord[1] >= lower[1] && p->coord[1] <= upper[1]) {
+        if (*count == *cap) {
+            *cap = (*cap == 0) ? 16 : (*cap * 2);
+            *rows = realloc(*rows, sizeof(int) * (*cap));
+            assert(*rows);
+        }
+        (*rows)[(*count)++] = p->row;
+    }
+
+    if (lower[axis] <= p->coord[axis]) {
+        searchBox(si, lo, mid, depth + 1, lower, upper, rows, count, cap, visited);
+    }
+    if (upper[axis] >= p->coord[axis]) {
+        searchBox(si, mid + 1, hi, depth + 1, lower, upper, rows, count, cap, visited);
+    }
+}
+
+/* helper: qsort comparator for row numbers */
+static int compareRows(const void *a, const void *b) {
+    int ra = *(const int *)a, rb = *(const int *)b;
+    return (ra > rb) - (ra < rb);
+}
+
+struct queryResult *spatialIndexBox(struct spatialIndex *si, double minX,
+                                    double minY, double maxX, double maxY) {
+    assert(si);
+    char searchString[160];
+    snprintf(searchString, sizeof(searchString), "%s%.9g,%.9g,%.9g,%.9g",
+             SPATIAL_BOX_PREFIX, minX, minY, maxX, maxY);
+    struct queryResult *qr = newResult(searchString);
+
+    double lower[NUM_AXES] = {minX, minY};
+    double upper[NUM_AXES] = {maxX, maxY};
+    int *rows = NULL;
+    int count = 0, cap = 0;
+    searchBox(si, 0, si->n, 0, lower, upper, &rows, &count, &cap, &qr->nodeCount);
+
+    // Report matches in file order
+    if (count > 0) {
+        qsort(rows, count, sizeof(int), compareRows);
+    }
+    qr->numRecords = count;
+    qr->records = malloc(sizeof(struct data *) * (count > 0 ? count : 1));
+    assert(qr->records);
+    for (int i = 0; i < count; i++) {
+        qr->records[i] = recordStoreGet(si->store, rows[i]);
+    }
+    free(rows);
+    return qr;
+}
+
+/* helper: parse up to max comma separated finite numbers; -1 if
+   malformed */
+static int parseNumbers(const char *s, double *vals, int max) {
+    int count = 0;
+    while (count < max) {
+        char *end = NULL;
+        vals[count] = strtod(s, &end);
+        if (end == s || !isfinite(vals[count])) return -1;
+        count++;
+        while (*end == ' ') end++;
+        if (*end == '\0') return count;
+        if (*end != ',') return -1;
+        s = end + 1;
+    }
+    return -1;
+}
+
+struct queryResult *spatialIndexQuery(struct spatialIndex *si, char *query) {
+    assert(si && query);
+    double vals[MAX_QUERY_NUMBERS];
+
+    if (strncmp(query, SPATIAL_NEAR_PREFIX, strlen(SPATIAL_NEAR_PREFIX)) == 0) {
+        int count = parseNumbers(query + strlen(SPATIAL_NEAR_PREFIX), vals, 3);
+        if (count < 2) return newResult(query);   // malformed: no matches
+        // Range check the double: casting one outside int is undefined
+        if (count == 3 && !(vals[2] >= 1 && vals[2] <= SPATIAL_MAX_K)) {
+            return newResult(query);
+        }
+        int k = (count == 3) ? (int)vals[2] : SPATIAL_DEFAULT_K;
+        struct queryResult *qr = spatialIndexNearest(si, vals[0], vals[1], k);
+        free(qr->searchString);
+        qr->searchString = strdup(query);
+        assert(qr->searchString);
+        return qr;
+    }
+    if (strncmp(query, SPATIAL_BOX_PREFIX, strlen(SPATIAL_BOX_PREFIX)) == 0) {
+        int count = parseNumbers(query + strlen(SPATIAL_BOX_PREFIX), vals, 4);
+        if (count != 4) return newResult(query);
+        struct queryResult *qr = spatialIndexBox(si, vals[0], vals[1],
+                                                 vals[2], vals[3]);
+        free(qr->searchString);
+        qr->searchString = strdup(query);
+        assert(qr->searchString);
+        return qr;
+    }
+    return NULL;
+}
+
+int spatialIndexSize(struct spatialIndex *si) {
+    return si->n;
+}
+
+void spatialIndexFree(struct spatialIndex *si) {
+    if (!si) return;
+    memAccountFree(MEM_SPATIAL, indexBytes(si));
+    free(si->points);
+    free(si);
+}
@@ -0,0 +1,115 @@
+/*
+    SPSC ring: head and tail are free-running counters, slot = counter & mask.
+    The producer publishes a slot with a release store of tail, the consumer
+    frees one with a release store of head.
+
+    A side that has to wait registers in `waiters` and sleeps on the
+    condition variable; the other side checks `waiters` after every
+    update and only then takes the lock to wake it. Both the registration
+    and the update are sequentially consistent, so either the sleeper sees
+    the update or the updater sees the sleeper.
+*/
+#include "spsc_ring.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+
+#define CACHE_LINE 64
+#define RING_SPINS 64
+
+struct spscRing {
+    _Alignas(CACHE_LINE) atomic_size_t head;   // next slot to pop
+    _Alignas(CACHE_LINE) atomic_size_t tail;   // next slot to push
+    _Alignas(CACHE_LINE) size_t mask;
+    void **slots;
+    atomic_int waiters;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/* Helpers */
+static int ringFull(struct spscRing *r, size_t tail);
+static int ringEmpty(struct spscRing *r, size_t head);
+static void ringWait(struct spscRing *r, int (*blocked)(struct spscRing *, size_t),
+                     size_t own);
+static void ringWake(struct spscRing *r);
+
+struct spscRing *ringNew(size_t capacity) {
+    assert(capacity > 0);
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    struct spscRing *r = aligned_alloc(CACHE_LINE, sizeof(*r));
+    assert(r);
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->mask = size - 1;
+    r->slots = malloc(sizeof(void *) * size);
+    assert(r->slots);
+    atomic_init(&r->waiters, 0);
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    return r;
+}
+
+/* helper: producer's view - no free slot at `tail` */
+static int ringFull(struct spscRing *r, size_t tail) {
+    return tail - atomic_load(&r->head) > r->mask;
+}
+
+/* helper: consumer's view - nothing published at `head` */
+static int ringEmpty(struct spscRing *r, size_t head) {
+    return atomic_load(&r->tail) == head;
+}
+
+/* helper: wait while blocked(r, own) - spin, yield, then sleep */
+static void ringWait(struct spscRing *r, int (*blocked)(struct spscRing *, size_t),
+                     size_t own) {
+    for (int i = 0; i < RING_SPINS; i++) {
+        if (!blocked(r, own)) return;
+        sched_yield();
+    }
+    pthread_mutex_lock(&r->lock);
+    atomic_fetch_add(&r->waiters, 1);
+    while (blocked(r, own)) {
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+    atomic_fetch_sub(&r->waiters, 1);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* helper: wake the other side if it is asleep */
+static void ringWake(struct spscRing *r) {
+    if (atomic_load(&r->waiters) == 0) return;
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void ringPush(struct spscRing *r, void *item) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (ringFull(r, tail)) ringWait(r, ringFull, tail);
+    r->slots[tail & r->mask] = item;
+    atomic_store(&r->tail, tail + 1);
+    ringWake(r);
+}
+
+void *ringPop(struct spscRing *r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (ringEmpty(r, head)) ringWait(r, ringEmpty, head);
+    void *item = r->slots[head & r->mask];
+    atomic_store(&r->head, head + 1);
+    ringWake(r);
+    return item;
+}
+
+void ringFree(struct spscRing *r) {
+    if (!r) return;
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r->slots);
+    free(r);
+}
@@ -0,0 +1,264 @@
+/*
+    SymSpell index: an open-addressing table from the hash of a deletion
+    to a run of key ids in one shared array (CSR layout). It is built in
+    two passes over the keys: the first counts the keys of every
+    deletion, the second fills the runs, so each run ends up in key order.
+*/
+#include "symspell.h"
+#include "edit_distance.h"
+#include "mem_account.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define EMPTY_HASH 0
+#define INITIAL_SLOTS 1024
+#define INITIAL_CANDIDATES 64
+// Deletions of one prefix: sum of C(SYMSPELL_MAX_PREFIX, d) for d <= 3
+#define MAX_VARIANTS 697
+
+/* A deletion and its run of key ids */
+struct ssSlot {
+    uint64_t hash;             // EMPTY_HASH if unused
+    uint32_t start;            // first id in ids
+    uint32_t count;
+};
+
+struct symSpell {
+    struct keyPool *pool;
+    int maxDistance;
+    int prefixLength;
+    struct ssSlot *slots;
+    size_t mask;               // number of slots - 1
+    size_t numVariants;
+    uint32_t *ids;
+    size_t numIds;
+    unsigned char *lengths;    // key lengths (capped at UCHAR_MAX)
+};
+
+/* Helpers */
+static uint64_t hashBytes(const char *s, int len);
+static void addDeletions(const char *s, int len, int start, int left,
+                         uint64_t *out, int *n);
+static int prefixVariants(struct symSpell *ss, const char *key, uint64_t *out);
+static int compareHashes(const void *a, const void *b);
+static int compareIds(const void *a, const void *b);
+static struct ssSlot *findSlot(struct symSpell *ss, uint64_t hash);
+static void growSlots(struct symSpell *ss);
+
+/* helper: FNV-1a of s[0..len), never EMPTY_HASH */
+static uint64_t hashBytes(const char *s, int len) {
+    uint64_t h = FNV_OFFSET;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= FNV_PRIME;
+    }
+    return h == EMPTY_HASH ? 1 : h;
+}
+
+/* helper: hash s and every string made by deleting up to `left` more
+   characters at positions >= start, so each set of positions is
+   deleted exactly once */
+static void addDeletions(const char *s, int len, int start, int left,
+                         uint64_t *out, int *n) {
+    assert(*n < MAX_VARIANTS);
+    out[(*n)++] = hashBytes(s, len);
+    if (left == 0) return;
+    char next[SYMSPELL_MAX_PREFIX];
+    for (int p = start; p < len; p++) {
+        memcpy(next, s, p);
+        memcpy(next + p, s + p + 1, len - p - 1);
+        addDeletions(next, len - 1, p, left - 1, out, n);
+    }
+}
+
+static int compareHashes(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compareIds(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* helper: the distinct deletion hashes of key's prefix, sorted;
+   returns how many */
+static int prefixVariants(struct symSpell *ss, const char *key, uint64_t *out) {
+    int len = (int)strnlen(key, ss->prefixLength);
+    int n = 0;
+    addDeletions(key, len, 0, ss->maxDistance, out, &n);
+    // Repeated letters give the same deletion more than once
+    qsort(out, n, sizeof(*out), compareHashes);
+    int unique = 0;
+    for (int i = 0; i < n; i++) {
+        if (unique == 0 || out[unique - 1] != out[i]) out[unique++] = out[i];
+    }
+    return unique;
+}
+
+/* helper: the slot holding hash, or the empty slot where it belongs */
+static struct ssSlot *findSlot(struct symSpell *ss, uint64_t hash) {
+    size_t i = (size_t)(hash ^ (hash >> 32)) & ss->mask;
+    while (ss->slots[i].hash != EMPTY_HASH && ss->slots[i].hash != hash) {
+        i = (i + 1) & ss->mask;
+    }
+    return &ss->slots[i];
+}
+
+/* helper: double the table, keeping it at most half full */
+static void growSlots(struct symSpell *ss) {
+    struct ssSlot *old = ss->slots;
+    size_t oldSize = ss->mask + 1;
+    ss->mask = oldSize * 2 - 1;
+    ss->slots = calloc(oldSize * 2, sizeof(*ss->slots));
+    assert(ss->slots);
+    for (size_t i = 0; i < oldSize; i++) {
+        if (old[i].hash != EMPTY_HASH) *findSlot(ss, old[i].hash) = old[i];
+    }
+    free(old);
+}
+
+struct symSpell *symSpellNew(struct keyPool *pool, int maxDistance,
+                             int prefixLength) {
+    assert(pool);
+    assert(maxDistance >= 1 && maxDistance <= SYMSPELL_MAX_DISTANCE);
+    assert(prefixLength > maxDistance && prefixLength <= SYMSPELL_MAX_PREFIX);
+    struct symSpell *ss = malloc(sizeof(*ss));
+    assert(ss);
+    ss->pool = pool;
+    ss->maxDistance = maxDistance;
+    ss->prefixLength = prefixLength;
+    ss->mask = INITIAL_SLOTS - 1;
+    ss->slots = calloc(INITIAL_SLOTS, sizeof(*ss->slots));
+    assert(ss->slots);
+    ss->numVariants = 0;
+    ss->numIds = 0;
+
+    int n = keyPoolSize(pool);
+    char key[keyPoolMaxLen(pool) + 1];
+    uint64_t variants[MAX_VARIANTS];
+
+    ss->lengths = malloc(n > 0 ? n : 1);
+    assert(ss->lengths);
+
+    // Pass 1: count the keys under every deletion
+    for (int id = 0; id < n; id++) {
+        size_t len = strlen(keyPoolGet(pool, id, key));
+        ss->lengths[id] = (unsigned char)(len < UCHAR_MAX ? len : UCHAR_MAX);
+        int count = prefixVariants(ss, key, variants);
+        for (int v = 0; v < count; v++) {
+            struct ssSlot *slot = findSlot(ss, variants[v]);
+            if (slot->hash == EMPTY_HASH) {
+                if ((ss->numVariants + 1) * 2 > ss->mask + 1) {
+                    growSlots(ss);
+                    slot = findSlot(ss, variants[v]);
+                }
+                slot->hash = variants[v];
+                ss->numVariants++;
+            }
+            slot->count++;
+        }
+        ss->numIds += count;
+    }
+
+    // Lay the runs out back to back; count becomes the fill cursor
+    assert(ss->numIds <= UINT32_MAX);
+    uint32_t start = 0;
+    for (size_t i = 0; i <= ss->mask; i++) {
+        ss->slots[i].start = start;
+        start += ss->slots[i].count;
+        ss->slots[i].count = 0;
+    }
+    ss->ids = malloc(sizeof(*ss->ids) * (ss->numIds > 0 ? ss->numIds : 1));
+    assert(ss->ids);
+
+    // Pass 2: fill the runs in key order
+    for (int id = 0; id < n; id++) {
+        int count = prefixVariants(ss, keyPoolGet(pool, id, key), variants);
+        for (int v = 0; v < count; v++) {
+            struct ssSlot *slot = findSlot(ss, variants[v]);
+            ss->ids[slot->start + slot->count++] = (uint32_t)id;
+        }
+    }
+    memAccountAlloc(MEM_SYMSPELL, symSpellBytes(ss));
+    return ss;
+}
+
+int symSpellCorrect(struct symSpell *ss, const char *query, char *keyOut,
+                    int *candidates) {
+    assert(ss && query && keyOut && candidates);
+    uint64_t variants[MAX_VARIANTS];
+    int count = prefixVariants(ss, query, variants);
+
+    // Gather the keys sharing a deletion with the query
+    size_t numCands = 0, cap = INITIAL_CANDIDATES;
+    uint32_t *cands = malloc(sizeof(*cands) * cap);
+    assert(cands);
+    for (int v = 0; v < count; v++) {
+        struct ssSlot *slot = findSlot(ss, variants[v]);
+        if (slot->hash == EMPTY_HASH) continue;
+        if (numCands + slot->count > cap) {
+            while (numCands + slot->count > cap) cap *= 2;
+            cands = realloc(cands, sizeof(*cands) * cap);
+            assert(cands);
+        }
+        memcpy(cands + numCands, ss->ids + slot->start,
+               sizeof(*cands) * slot->count);
+        numCands += slot->count;
+    }
+    qsort(cands, numCands, sizeof(*cands), compareIds);
+
+    // Verify in key order: only a strictly closer key replaces the best
+    int queryLen = (int)strlen(query);
+    int best = -1, bestDist = ss->maxDistance;
+    char key[keyPoolMaxLen(ss->pool) + 1];
+    *candidates = 0;
+    for (size_t i = 0; i < numCands && bestDist > 0; i++) {
+        if (i > 0 && cands[i] == cands[i - 1]) continue;
+        int limit = (best < 0) ? bestDist : bestDist - 1;
+        // Keys too much longer or shorter are never decoded
+        int len = ss->lengths[cands[i]];
+        if (len < UCHAR_MAX && (len - queryLen > limit || queryLen - len > limit)) {
+            continue;
+        }
+        keyPoolGet(ss->pool, (int)cands[i], key);
+        (*candidates)++;
+        int dist = typoDistanceWithin(query, queryLen, key, (int)strlen(key),
+                                      limit);
+        if (dist <= limit) {
+            best = (int)cands[i];
+            bestDist = dist;
+            strcpy(keyOut, key);
+        }
+    }
+    free(cands);
+    return best;
+}
+
+int symSpellMaxDistance(struct symSpell *ss) {
+    return ss->maxDistance;
+}
+
+size_t symSpellVariants(struct symSpell *ss) {
+    return ss->numVariants;
+}
+
+size_t symSpellBytes(struct symSpell *ss) {
+    return sizeof(*ss) + (ss->mask + 1) * sizeof(*ss->slots) +
+           ss->numIds * sizeof(*ss->ids) + (size_t)keyPoolSize(ss->pool);
+}
+
+void symSpellFree(struct symSpell *ss) {
+    if (!ss) return;
+    memAccountFree(MEM_SYMSPELL, symSpellBytes(ss));
+    free(ss->slots);
+    free(ss->ids);
+    free(ss->lengths);
+    free(ss);
+}
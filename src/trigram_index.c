@@ -0,0 +1,379 @@
+/*
+    Trigram index: an open-addressing table from trigram (three folded
+    bytes packed into an int) to a posting list of rows, stored with the
+    codec of postings.c.
+
+    Candidates are the rows common to the TRIGRAM_MAX_LISTS shortest
+    lists of the query, found by leapfrogging: every cursor is advanced
+    to the largest row seen so far until they all agree.
+    Verification looks for the text with 16-byte vector compares: the
+    first and last bytes of the text are tested at 16 starting positions
+    at once, and only positions matching both are compared in full.
+*/
+#include "trigram_index.h"
+#include "postings.h"
+#include "record_store.h"
+#include "dict_common.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#define EMPTY_KEY 0              // no trigram contains a NUL byte
+#define INITIAL_SLOTS 4096
+#define INITIAL_POSTINGS 4
+#define INITIAL_ROW_GRAMS 256
+#define INITIAL_RESULT_CAPACITY 16
+#define TRIGRAM_MAX_LISTS 8
+#define BATCH_BYTES 16
+#define HASH_MULTIPLIER 2654435761u
+
+typedef unsigned char byteBatch __attribute__((vector_size(BATCH_BYTES)));
+
+struct trigramSlot {
+    uint32_t key;
+    int id;
+};
+
+/* Rows of one trigram while building */
+struct gramBuilder {
+    int *rows;
+    int n;
+    int cap;
+};
+
+struct trigramIndex {
+    struct recordStore *store;
+    int fields[NUM_FIELDS];
+    int numFields;
+    struct trigramSlot *slots;
+    size_t mask;
+    struct postings **lists;
+    int numGrams;
+    int gramCap;
+};
+
+/* Helpers */
+static inline unsigned char fold(unsigned char c);
+static inline byteBatch foldBatch(byteBatch b);
+static uint32_t gramKey(const char *s);
+static struct trigramSlot *findSlot(struct trigramIndex *ti, uint32_t key);
+static void growSlots(struct trigramIndex *ti);
+static int compareKeys(const void *a, const void *b);
+static int compareSizes(const void *a, const void *b);
+static int matchFolded(const char *s, const char *upper, size_t len);
+static int containsFolded(const char *hay, const char *upper, size_t m);
+static int rowContains(struct trigramIndex *ti, int row, const char *upper,
+                       size_t m);
+static void addRow(struct queryResult *qr, int *cap, struct data *rec);
+static struct queryResult *newResult(const char *searchString);
+
+/* helper: ASCII upper case */
+static inline unsigned char fold(unsigned char c) {
+    return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+/* helper: ASCII upper case of 16 bytes */
+static inline byteBatch foldBatch(byteBatch b) {
+    byteBatch lower = (byteBatch)((b >= 'a') & (b <= 'z'));
+    return b - (lower & ('a' - 'A'));
+}
+
+/* helper: the folded trigram starting at s */
+static uint32_t gramKey(const char *s) {
+    return (uint32_t)fold(s[0]) << 16 | (uint32_t)fold(s[1]) << 8 |
+           fold(s[2]);
+}
+
+/* helper: the slot holding key, or the empty slot where it belongs */
+static struct trigramSlot *findSlot(struct trigramIndex *ti, uint32_t key) {
+    size_t i = (key * HASH_MULTIPLIER) & ti->mask;
+    while (ti->slots[i].key != EMPTY_KEY && ti->slots[i].key != key) {
+        i = (i + 1) & ti->mask;
+    }
+    return &ti->slots[i];
+}
+
+/* helper: double the table, keeping it at most half full */
+static void growSlots(struct trigramIndex *ti) {
+    struct trigramSlot *old = ti->slots;
+    size_t oldSize = ti->mask + 1;
+    ti->mask = oldSize * 2 - 1;
+    ti->slots = calloc(oldSize * 2, sizeof(*ti->slots));
+    assert(ti->slots);
+    for (size_t i = 0; i < oldSize; i++) {
+        if (old[i].key != EMPTY_KEY) *findSlot(ti, old[i].key) = old[i];
+    }
+    free(old);
+}
+
+static int compareKeys(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+struct trigramIndex *trigramIndexNew(struct recordStore *store,
+                                     const int *fields, int numFields) {
+    assert(store && fields && numFields > 0 && numFields <= NUM_FIELDS);
+    struct trigramIndex *ti = malloc(sizeof(*ti));
+    assert(ti);
+    ti->store = store;
+    memcpy(ti->fields, fields, sizeof(*fields) * numFields);
+    ti->numFields = numFields;
+    ti->mask = INITIAL_SLOTS - 1;
+    ti->slots = calloc(INITIAL_SLOTS, sizeof(*ti->slots));
+    ti->numGrams = 0;
+    ti->gramCap = INITIAL_SLOTS / 2;
+    struct gramBuilder *builders = calloc(ti->gramCap, sizeof(*builders));
+    assert(ti->slots && builders);
+
+    // Distinct trigrams of each row, appended to their lists in row order
+    int gramCap = INITIAL_ROW_GRAMS;
+    uint32_t *grams = malloc(sizeof(*grams) * gramCap);
+    assert(grams);
+    int rows = recordStoreSize(store);
+    for (int row = 0; row < rows; row++) {
+        struct data *rec = recordStoreGet(store, row);
+        int numGrams = 0;
+        for (int f = 0; f < numFields; f++) {
+            const char *s = dataField(rec, fields[f]);
+            size_t len = strlen(s);
+            for (size_t i = 0; i + TRIGRAM_LENGTH <= len; i++) {
+                if (numGrams == gramCap) {
+                    gramCap *= 2;
+                    grams = realloc(grams, sizeof(*grams) * gramCap);
+                    assert(grams);
+                }
+                grams[numGrams++] = gramKey(s + i);
+            }
+        }
+        qsort(grams, numGrams, sizeof(*grams), compareKeys);
+        for (int i = 0; i < numGrams; i++) {
+            if (i > 0 && grams[i] == grams[i - 1]) continue;
+            struct trigramSlot *slot = findSlot(ti, grams[i]);
+            if (slot->key == EMPTY_KEY) {
+                if ((size_t)(ti->numGrams + 1) * 2 > ti->mask + 1) {
+                    growSlots(ti);
+                    slot = findSlot(ti, grams[i]);
+                }
+                if (ti->numGrams == ti->gramCap) {
+                    ti->gramCap *= 2;
+                    builders = realloc(builders, sizeof(*builders) * ti->gramCap);
+                    assert(builders);
+                    memset(builders + ti->numGrams, 0,
+                           sizeof(*builders) * (ti->gramCap - ti->numGrams));
+                }
+                slot->key = grams[i];
+                slot->id = ti->numGrams++;
+            }
+            struct gramBuilder *b = &builders[slot->id];
+            if (b->n == b->cap) {
+                b->cap = b->cap ? b->cap * 2 : INITIAL_POSTINGS;
+                b->rows = realloc(b->rows, sizeof(*b->rows) * b->cap);
+                assert(b->rows);
+            }
+            b->rows[b->n++] = row;
+        }
+    }
+    free(grams);
+
+    ti->lists = malloc(sizeof(*ti->lists) * (ti->numGrams > 0 ? ti->numGrams : 1));
+    assert(ti->lists);
+    for (int id = 0; id < ti->numGrams; id++) {
+        ti->lists[id] = postingsEncode(builders[id].rows, NULL, NULL,
+                                       builders[id].n);
+        free(builders[id].rows);
+    }
+    free(builders);
+    memAccountAlloc(MEM_TEXT_INDEXES, trigramIndexBytes(ti));
+    return ti;
+}
+
+/* helper: s[0..len) equals upper[0..len) ignoring case */
+static int matchFolded(const char *s, const char *upper, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (fold(s[i]) != (unsigned char)upper[i]) return 0;
+    }
+    return 1;
+}
+
+/* helper: hay contains upper[0..m) (already folded), ignoring case */
+static int containsFolded(const char *hay, const char *upper, size_t m) {
+    size_t n = strlen(hay);
+    if (m == 0) return 1;
+    if (m > n) return 0;
+    byteBatch first, last;
+    memset(&first, (unsigned char)upper[0], sizeof(first));
+    memset(&last, (unsigned char)upper[m - 1], sizeof(last));
+
+    size_t i = 0;
+    for (; i + m - 1 + BATCH_BYTES <= n; i += BATCH_BYTES) {
+        byteBatch head, tail;
+        memcpy(&head, hay + i, sizeof(head));
+        memcpy(&tail, hay + i + m - 1, sizeof(tail));
+        byteBatch hit = (byteBatch)((foldBatch(head) == first) &
+                                    (foldBatch(tail) == last));
+        uint64_t halves[2];
+        memcpy(halves, &hit, sizeof(halves));
+        if ((halves[0] | halves[1]) == 0) continue;
+        for (int j = 0; j < BATCH_BYTES; j++) {
+            if (hit[j] && matchFolded(hay + i + j, upper, m)) return 1;
+        }
+    }
+    for (; i + m <= n; i++) {
+        if (matchFolded(hay + i, upper, m)) return 1;
+    }
+    return 0;
+}
+
+/* helper: one of the indexed fields of row contains the text */
+static int rowContains(struct trigramIndex *ti, int row, const char *upper,
+                       size_t m) {
+    struct data *rec = recordStoreGet(ti->store, row);
+    for (int f = 0; f < ti->numFields; f++) {
+        if (containsFolded(dataField(rec, ti->fields[f]), upper, m)) return 1;
+    }
+    return 0;
+}
+
+/* helper: append a record to a result, growing it geometrically */
+static void addRow(struct queryResult *qr, int *cap, struct data *rec) {
+    if (qr->numRecords == *cap) {
+        *cap = *cap ? *cap * 2 : INITIAL_RESULT_CAPACITY;
+        qr->records = realloc(qr->records, sizeof(*qr->records) * *cap);
+        assert(qr->records);
+    }
+    qr->records[qr->numRecords++] = rec;
+}
+
+/* helper: an empty result for searchString */
+static struct queryResult *newResult(const char *searchString) {
+    struct queryResult *qr = malloc(sizeof(*qr));
+    assert(qr);
+    qr->searchString = strdup(searchString);
+    assert(qr->searchString);
+    qr->numRecords = 0;
+    qr->records = NULL;
+    qr->bitCount = 0;
+    qr->nodeCount = 0;
+    qr->stringCount = 0;
+    return qr;
+}
+
+/* helper: qsort order of posting lists, shortest first */
+static int compareSizes(const void *a, const void *b) {
+    int x = postingsSize(*(struct postings *const *)a);
+    int y = postingsSize(*(struct postings *const *)b);
+    return (x > y) - (x < y);
+}
+
+struct queryResult *trigramIndexSearch(struct trigramIndex *ti,
+                                       const char *text) {
+    assert(ti && text);
+    struct queryResult *qr = newResult(text);
+    size_t m = strlen(text);
+    char upper[m + 1];
+    for (size_t i = 0; i <= m; i++) upper[i] = (char)fold(text[i]);
+    int cap = 0;
+
+    // Too short for a trigram: check every row
+    if (m < TRIGRAM_LENGTH) {
+        int rows = recordStoreSize(ti->store);
+        for (int row = 0; row < rows; row++) {
+            qr->stringCount++;
+            if (rowContains(ti, row, upper, m)) {
+                addRow(qr, &cap, recordStoreGet(ti->store, row));
+            }
+        }
+        return qr;
+    }
+
+    // The lists of the query's trigrams; a missing one means no match
+    int numGrams = (int)(m - TRIGRAM_LENGTH + 1);
+    struct postings **lists = malloc(sizeof(*lists) * numGrams);
+    assert(lists);
+    int numLists = 0;
+    for (int i = 0; i < numGrams; i++) {
+        struct trigramSlot *slot = findSlot(ti, gramKey(upper + i));
+        if (slot->key == EMPTY_KEY) {
+            free(lists);
+            return qr;
+        }
+        int seen = 0;
+        for (int j = 0; j < numLists; j++) {
+            if (lists[j] == ti->lists[slot->id]) seen = 1;
+        }
+        if (!seen) lists[numLists++] = ti->lists[slot->id];
+    }
+    qsort(lists, numLists, sizeof(*lists), compareSizes);
+    if (numLists > TRIGRAM_MAX_LISTS) numLists = TRIGRAM_MAX_LISTS;
+
+    struct postingsCursor cursors[TRIGRAM_MAX_LISTS];
+    for (int j = 0; j < numLists; j++) {
+        postingsOpen(lists[j], &cursors[j]);
+    }
+    free(lists);
+
+    // Leapfrog: the shortest list proposes, the others confirm or skip
+    int target = cursors[0].row;
+    while (target != POSTINGS_END) {
+        int agreed = 1;
+        for (int j = 0; j < numLists; j++) {
+            postingsAdvance(&cursors[j], target);
+            if (cursors[j].row != target) {
+                target = cursors[j].row;
+                agreed = 0;
+                break;
+            }
+        }
+        if (!agreed) continue;
+        qr->stringCount++;
+        if (rowContains(ti, target, upper, m)) {
+            addRow(qr, &cap, recordStoreGet(ti->store, target));
+        }
+        postingsNext(&cursors[0]);
+        target = cursors[0].row;
+    }
+    for (int j = 0; j < numLists; j++) {
+        qr->nodeCount += cursors[j].blocksDecoded;
+    }
+    return qr;
+}
+
+struct queryResult *trigramIndexQuery(struct trigramIndex *ti, char *query) {
+    assert(ti && query);
+    size_t len = strlen(CONTAINS_PREFIX);
+    if (strncmp(query, CONTAINS_PREFIX, len) != 0) return NULL;
+    struct queryResult *qr = trigramIndexSearch(ti, query + len);
+    free(qr->searchString);
+    qr->searchString = strdup(query);
+    assert(qr->searchString);
+    return qr;
+}
+
+int trigramIndexTrigrams(struct trigramIndex *ti) {
+    return ti->numGrams;
+}
+
+size_t trigramIndexBytes(struct trigramIndex *ti) {
+    size_t bytes = sizeof(*ti) + sizeof(*ti->slots) * (ti->mask + 1) +
+                   sizeof(*ti->lists) * ti->numGrams;
+    for (int id = 0; id < ti->numGrams; id++) {
+        bytes += postingsBytes(ti->lists[id]);
+    }
+    return bytes;
+}
+
+void trigramIndexFree(struct trigramIndex *ti) {
+    if (!ti) return;
+    memAccountFree(MEM_TEXT_INDEXES, trigramIndexBytes(ti));
+    for (int id = 0; id < ti->numGrams; id++) {
+        postingsFree(ti->lists[id]);
+    }
+    free(ti->lists);
+    free(ti->slots);
+    free(ti);
+}
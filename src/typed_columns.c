@@ -0,0 +1,532 @@
+/*
+    Typed columns and vectorized row filters.
+
+    Each predicate is normalized to an inclusive range [lo, hi] plus an
+    excluded value ne, so one comparison kernel per storage type covers
+    every operator. Missing values are INT32_MIN (outside every integer
+    range) or NaN (which fails every double comparison).
+
+    The kernels use GCC vector extensions: a batch holds FILTER_BATCH_BYTES
+    of values (one SSE2 / NEON register, so no -march flag is needed) and
+    is compared in one go, yielding a lane mask of 0 / -1.
+    Rows are filtered FILTER_BLOCK_ROWS at a time into a mask array; a
+    lookup result is first gathered into the same block layout.
+*/
+#include "typed_columns.h"
+#include "record_store.h"
+#include "dict_common.h"
+#include "mem_account.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+
+#define FILTER_BATCH_BYTES 16
+#define FILTER_BLOCK_ROWS 2048
+#define MISSING_INT INT32_MIN
+#define DATE_LENGTH 10
+#define INITIAL_RESULT_CAPACITY 16
+#define SKIP_SPAN_ROWS 64
+
+#define INT_LANES (FILTER_BATCH_BYTES / (int)sizeof(int32_t))
+#define REAL_LANES (FILTER_BATCH_BYTES / (int)sizeof(double))
+
+typedef int32_t intBatch __attribute__((vector_size(FILTER_BATCH_BYTES)));
+typedef double realBatch __attribute__((vector_size(FILTER_BATCH_BYTES)));
+typedef int64_t realMask __attribute__((vector_size(FILTER_BATCH_BYTES)));
+typedef int32_t halfMask __attribute__((vector_size(FILTER_BATCH_BYTES / 2)));
+
+enum columnType { COLUMN_TEXT, COLUMN_INT, COLUMN_DATE, COLUMN_REAL };
+
+struct typedColumn {
+    enum columnType type;
+    int32_t *ints;      // COLUMN_INT and COLUMN_DATE
+    double *reals;      // COLUMN_REAL
+};
+
+struct typedColumns {
+    struct recordStore *store;
+    char **headers;
+    int rows;
+    struct typedColumn columns[NUM_FIELDS];
+};
+
+/* One predicate: value in [lo, hi] and value != ne */
+struct predicate {
+    int column;
+    int32_t intLo, intHi, intNe;
+    double realLo, realHi, realNe;
+};
+
+struct rowFilter {
+    int count;
+    struct predicate preds[FILTER_MAX_PREDICATES];
+};
+
+/* Per column state while the columns are built */
+struct columnBuilder {
+    const char *prev;   // last field seen, and its parsed value
+    double value;
+    int done;           // column turned out to be text
+};
+
+/* Helpers */
+static int parseDate(const char *s, int32_t *out);
+static int parseNumber(const char *s, double *out);
+static int isPackedInt(double v);
+static void addValue(struct typedColumn *col, struct columnBuilder *b,
+                     int row, int rows, const char *s);
+static int columnByName(struct typedColumns *tc, const char *name,
+                        size_t len);
+static int parsePredicate(struct typedColumns *tc, const char *term,
+                          size_t len, struct predicate *p);
+static void setRange(struct predicate *p, enum columnType type,
+                     const char *op, double t);
+static void maskInts(const int32_t *v, int n, struct predicate *p,
+                     int32_t *mask, int first);
+static void maskReals(const double *v, int n, struct predicate *p,
+                      int32_t *mask, int first);
+static void maskBlock(struct typedColumns *tc, struct rowFilter *filter,
+                      int start, const int *rows, int n, int32_t *mask);
+static int anyRow(const int32_t *mask, int n);
+static struct queryResult *newResult(const char *searchString);
+static size_t columnsBytes(struct typedColumns *tc);
+
+/* helper: bytes of the packed arrays kept */
+static size_t columnsBytes(struct typedColumns *tc) {
+    size_t bytes = sizeof(*tc);
+    for (int c = 0; c < NUM_FIELDS; c++) {
+        if (tc->columns[c].ints) bytes += sizeof(int32_t) * tc->rows;
+        if (tc->columns[c].reals) bytes += sizeof(double) * tc->rows;
+    }
+    return bytes;
+}
+
+/* helper: YYYY-MM-DD as YYYYMMDD */
+static int parseDate(const char *s, int32_t *out) {
+    if (strlen(s) != DATE_LENGTH || s[4] != '-' || s[7] != '-') return 0;
+    int32_t value = 0;
+    for (int i = 0; i < DATE_LENGTH; i++) {
+        if (i == 4 || i == 7) continue;
+        if (s[i] < '0' || s[i] > '9') return 0;
+        value = value * 10 + (s[i] - '0');
+    }
+    *out = value;
+    return 1;
+}
+
+/* helper: parse a whole field as a finite number */
+static int parseNumber(const char *s, double *out) {
+    char *end = NULL;
+    if (*s == '\0') return 0;
+    *out = strtod(s, &end);
+    return *end == '\0' && isfinite(*out);
+}
+
+/* helper: an integer that fits the packed int32 column */
+static int isPackedInt(double v) {
+    return v == floor(v) && v > (double)MISSING_INT && v <= (double)INT32_MAX;
+}
+
+/* helper: add the value of one row to a column being built, deciding its
+   type on the way: the narrowest one every non-empty value fits, or
+   COLUMN_TEXT. Values go to the int32 array, allocated at the first
+   non-empty value, until the first non-integer widens it to double. */
+static void addValue(struct typedColumn *col, struct columnBuilder *b,
+                     int row, int rows, const char *s) {
+    size_t count = rows > 0 ? rows : 1;
+    // Interned values repeat by pointer: each needs parsing once
+    if (s != b->prev) {
+        b->prev = s;
+        int32_t date;
+        if (*s == '\0') {
+            b->value = NAN;
+        } else if (col->type != COLUMN_INT && col->type != COLUMN_REAL &&
+                   parseDate(s, &date)) {
+            b->value = date;
+            if (col->type == COLUMN_TEXT) col->type = COLUMN_DATE;
+        } else if (col->type != COLUMN_DATE && parseNumber(s, &b->value)) {
+            if (col->type == COLUMN_TEXT) col->type = COLUMN_INT;
+        } else {
+            // Text: give up on this column
+            col->type = COLUMN_TEXT;
+            free(col->ints);
+            free(col->reals);
+            col->ints = NULL;
+            col->reals = NULL;
+            b->done = 1;
+            return;
+        }
+
+        if (!col->ints && !col->reals && col->type != COLUMN_TEXT) {
+            // First value: the rows before it were all empty
+            col->ints = malloc(sizeof(int32_t) * count);
+            assert(col->ints);
+            for (int i = 0; i < row; i++) col->ints[i] = MISSING_INT;
+        }
+        if (col->type == COLUMN_INT && !isnan(b->value) &&
+            !isPackedInt(b->value)) {
+            // Widen the rows so far to double
+            col->type = COLUMN_REAL;
+            col->reals = malloc(sizeof(double) * count);
+            assert(col->reals);
+            for (int i = 0; i < row; i++) {
+                col->reals[i] = (col->ints[i] == MISSING_INT) ? NAN : col->ints[i];
+            }
+            free(col->ints);
+            col->ints = NULL;
+        }
+    }
+    if (col->reals) {
+        col->reals[row] = b->value;
+    } else if (col->ints) {
+        col->ints[row] = isnan(b->value) ? MISSING_INT : (int32_t)b->value;
+    }
+}
+
+struct typedColumns *typedColumnsNew(struct recordStore *store,
+                                     char **headers) {
+    assert(store && headers);
+    struct typedColumns *tc = malloc(sizeof(*tc));
+    assert(tc);
+    tc->store = store;
+    tc->headers = headers;
+    tc->rows = recordStoreSize(store);
+
+    struct columnBuilder builders[NUM_FIELDS];
+    for (int c = 0; c < NUM_FIELDS; c++) {
+        tc->columns[c].type = COLUMN_TEXT;
+        tc->columns[c].ints = NULL;
+        tc->columns[c].reals = NULL;
+        builders[c].prev = NULL;
+        builders[c].value = NAN;
+        builders[c].done = 0;
+    }
+
+    // One pass in row order: each row's fields are touched once
+    for (int row = 0; row < tc->rows; row++) {
+        char **fields = dataFields(recordStoreGet(store, row));
+        for (int c = 0; c < NUM_FIELDS; c++) {
+            if (builders[c].done) continue;
+            addValue(&tc->columns[c], &builders[c], row, tc->rows, fields[c]);
+        }
+    }
+    memAccountAlloc(MEM_TYPED_COLUMNS, columnsBytes(tc));
+    return tc;
+}
+
+int typedColumnsCount(struct typedColumns *tc) {
+    int count = 0;
+    for (int c = 0; c < NUM_FIELDS; c++) {
+        if (tc->columns[c].type != COLUMN_TEXT) count++;
+    }
+    return count;
+}
+
+/* helper: column number of a header name, or -1 */
+static int columnByName(struct typedColumns *tc, const char *name,
+                        size_t len) {
+    for (int c = 0; c < NUM_FIELDS; c++) {
+        if (strlen(tc->headers[c]) == len &&
+            strncmp(tc->headers[c], name, len) == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+/* helper: turn "OP t" into the [lo, hi] / ne form of the column's type */
+static void setRange(struct predicate *p, enum columnType type,
+                     const char *op, double t) {
+    double lo = -INFINITY, hi = INFINITY, ne = NAN;
+    if (strcmp(op, "=") == 0) {
+        lo = hi = t;
+    } else if (strcmp(op, "!=") == 0) {
+        ne = t;
+    } else if (strcmp(op, ">=") == 0) {
+        lo = t;
+    } else if (strcmp(op, ">") == 0) {
+        lo = (type == COLUMN_REAL) ? nextafter(t, INFINITY) : floor(t) + 1;
+    } else if (strcmp(op, "<=") == 0) {
+        hi = t;
+    } else {
+        hi = (type == COLUMN_REAL) ? nextafter(t, -INFINITY) : ceil(t) - 1;
+    }
+    p->realLo = lo;
+    p->realHi = hi;
+    p->realNe = ne;
+
+    // Integers: round the bounds inwards and clamp them to int32, which
+    // keeps MISSING_INT out of every range
+    lo = ceil(lo);
+    hi = floor(hi);
+    if (lo <= (double)MISSING_INT) lo = (double)MISSING_INT + 1;
+    if (hi > (double)INT32_MAX) hi = (double)INT32_MAX;
+    if (lo > hi) {
+        p->intLo = INT32_MAX;
+        p->intHi = MISSING_INT + 1;
+    } else {
+        p->intLo = (int32_t)lo;
+        p->intHi = (int32_t)hi;
+    }
+    p->intNe = isPackedInt(ne) ? (int32_t)ne : MISSING_INT;
+}
+
+/* helper: parse one COLUMN OP VALUE term */
+static int parsePredicate(struct typedColumns *tc, const char *term,
+                          size_t len, struct predicate *p) {
+    size_t nameLen = strcspn(term, "<>=!");
+    if (nameLen == 0 || nameLen >= len) return 0;
+    int column = columnByName(tc, term, nameLen);
+    if (column < 0 || tc->columns[column].type == COLUMN_TEXT) return 0;
+
+    char op[3] = {term[nameLen], '\0', '\0'};
+    size_t valueStart = nameLen + 1;
+    if (valueStart < len && term[valueStart] == '=') {
+        op[1] = '=';
+        valueStart++;
+    }
+    if (strcmp(op, "!") == 0 || strcmp(op, "==") == 0) return 0;
+    if (valueStart >= len) return 0;
+
+    char value[len - valueStart + 1];
+    memcpy(value, term + valueStart, len - valueStart);
+    value[len - valueStart] = '\0';
+
+    double t;
+    if (tc->columns[column].type == COLUMN_DATE) {
+        int32_t date;
+        if (!parseDate(value, &date)) return 0;
+        t = date;
+    } else if (!parseNumber(value, &t)) {
+        return 0;
+    }
+    p->column = column;
+    setRange(p, tc->columns[column].type, op, t);
+    return 1;
+}
+
+struct rowFilter *typedColumnsFilter(struct typedColumns *tc,
+                                     const char *text) {
+    assert(tc && text);
+    struct rowFilter *filter = malloc(sizeof(*filter));
+    assert(filter);
+    filter->count = 0;
+
+    while (1) {
+        while (*text == ' ') text++;
+        if (*text == '\0') break;
+        size_t len = strcspn(text, " ");
+        if (filter->count == FILTER_MAX_PREDICATES ||
+            !parsePredicate(tc, text, len, &filter->preds[filter->count])) {
+            free(filter);
+            return NULL;
+        }
+        filter->count++;
+        text += len;
+    }
+    if (filter->count == 0) {
+        free(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+/* helper: mask[i] (&)= lo <= v[i] <= hi && v[i] != ne, one batch at a time */
+static void maskInts(const int32_t *v, int n, struct predicate *p,
+                     int32_t *mask, int first) {
+    intBatch zero = {0};
+    intBatch lo = zero + p->intLo, hi = zero + p->intHi, ne = zero + p->intNe;
+    int i = 0;
+    for (; i + INT_LANES <= n; i += INT_LANES) {
+        intBatch x, m;
+        memcpy(&x, v + i, sizeof(x));
+        intBatch hit = (x >= lo) & (x <= hi) & (x != ne);
+        if (first) {
+            m = hit;
+        } else {
+            memcpy(&m, mask + i, sizeof(m));
+            m &= hit;
+        }
+        memcpy(mask + i, &m, sizeof(m));
+    }
+    for (; i < n; i++) {
+        int32_t hit = -(v[i] >= p->intLo && v[i] <= p->intHi &&
+                        v[i] != p->intNe);
+        mask[i] = first ? hit : (mask[i] & hit);
+    }
+}
+
+/* helper: the double version of maskInts; lane masks are narrowed to int32 */
+static void maskReals(const double *v, int n, struct predicate *p,
+                      int32_t *mask, int first) {
+    realBatch zero = {0};
+    realBatch lo = zero + p->realLo, hi = zero + p->realHi, ne = zero + p->realNe;
+    int i = 0;
+    for (; i + REAL_LANES <= n; i += REAL_LANES) {
+        realBatch x;
+        halfMask m;
+        memcpy(&x, v + i, sizeof(x));
+        realMask wide = (x >= lo) & (x <= hi) & (x != ne);
+        halfMask hit = __builtin_convertvector(wide, halfMask);
+        if (first) {
+            m = hit;
+        } else {
+            memcpy(&m, mask + i, sizeof(m));
+            m &= hit;
+        }
+        memcpy(mask + i, &m, sizeof(m));
+    }
+    for (; i < n; i++) {
+        int32_t hit = -(v[i] >= p->realLo && v[i] <= p->realHi &&
+                        v[i] != p->realNe);
+        mask[i] = first ? hit : (mask[i] & hit);
+    }
+}
+
+/* helper: mask of n rows - rows start..start+n-1 of the store, or the
+   listed rows (gathered into a contiguous buffer first) */
+static void maskBlock(struct typedColumns *tc, struct rowFilter *filter,
+                      int start, const int *rows, int n, int32_t *mask) {
+    int32_t ints[rows ? FILTER_BLOCK_ROWS : 1];
+    double reals[rows ? FILTER_BLOCK_ROWS : 1];
+
+    for (int k = 0; k < filter->count; k++) {
+        struct predicate *p = &filter->preds[k];
+        struct typedColumn *col = &tc->columns[p->column];
+        if (col->type == COLUMN_REAL) {
+            const double *v = col->reals + start;
+            if (rows) {
+                for (int i = 0; i < n; i++) reals[i] = col->reals[rows[i]];
+                v = reals;
+            }
+            maskReals(v, n, p, mask, k == 0);
+        } else {
+            const int32_t *v = col->ints + start;
+            if (rows) {
+                for (int i = 0; i < n; i++) ints[i] = col->ints[rows[i]];
+                v = ints;
+            }
+            maskInts(v, n, p, mask, k == 0);
+        }
+    }
+}
+
+/* helper: whether any of the n masks (a multiple of INT_LANES) is set */
+static int anyRow(const int32_t *mask, int n) {
+    intBatch any = {0};
+    for (int i = 0; i < n; i += INT_LANES) {
+        intBatch m;
+        memcpy(&m, mask + i, sizeof(m));
+        any |= m;
+    }
+    uint64_t words[FILTER_BATCH_BYTES / sizeof(uint64_t)];
+    memcpy(words, &any, sizeof(words));
+    uint64_t set = 0;
+    for (size_t w = 0; w < sizeof(words) / sizeof(words[0]); w++) {
+        set |= words[w];
+    }
+    return set != 0;
+}
+
+/* helper: an empty result for searchString */
+static struct queryResult *newResult(const char *searchString) {
+    struct queryResult *qr = malloc(sizeof(*qr));
+    assert(qr);
+    qr->searchString = strdup(searchString);
+    assert(qr->searchString);
+    qr->numRecords = 0;
+    qr->records = NULL;
+    qr->bitCount = 0;
+    qr->nodeCount = 0;
+    qr->stringCount = 0;
+    return qr;
+}
+
+struct queryResult *typedColumnsScan(struct typedColumns *tc,
+                                     struct rowFilter *filter,
+                                     const char *searchString) {
+    assert(tc && filter && searchString);
+    struct queryResult *qr = newResult(searchString);
+    qr->nodeCount = tc->rows;   // rows examined
+
+    int cap = 0;
+
+    int32_t mask[FILTER_BLOCK_ROWS];
+    for (int start = 0; start < tc->rows; start += FILTER_BLOCK_ROWS) {
+        int n = tc->rows - start;
+        if (n > FILTER_BLOCK_ROWS) n = FILTER_BLOCK_ROWS;
+        maskBlock(tc, filter, start, NULL, n, mask);
+
+        for (int span = 0; span < n; span += SKIP_SPAN_ROWS) {
+            // Skip whole spans that matched nothing
+            if (span + SKIP_SPAN_ROWS <= n && !anyRow(mask + span, SKIP_SPAN_ROWS)) {
+                continue;
+            }
+            int end = (span + SKIP_SPAN_ROWS < n) ? span + SKIP_SPAN_ROWS : n;
+            for (int i = span; i < end; i++) {
+                if (!mask[i]) continue;
+                if (qr->numRecords == cap) {
+                    cap = cap ? cap * 2 : INITIAL_RESULT_CAPACITY;
+                    qr->records = realloc(qr->records,
+                                          sizeof(struct data *) * cap);
+                    assert(qr->records);
+                }
+                qr->records[qr->numRecords++] = recordStoreGet(tc->store,
+                                                               start + i);
+            }
+        }
+    }
+    return qr;
+}
+
+void typedColumnsApply(struct typedColumns *tc, struct rowFilter *filter,
+                       struct queryResult *r) {
+    assert(tc && filter && r);
+    int32_t mask[FILTER_BLOCK_ROWS];
+    int rows[FILTER_BLOCK_ROWS];
+    int kept = 0;
+
+    for (int start = 0; start < r->numRecords; start += FILTER_BLOCK_ROWS) {
+        int n = r->numRecords - start;
+        if (n > FILTER_BLOCK_ROWS) n = FILTER_BLOCK_ROWS;
+        for (int i = 0; i < n; i++) {
+            rows[i] = recordStoreRow(tc->store, r->records[start + i]);
+        }
+        maskBlock(tc, filter, 0, rows, n, mask);
+        // Compact in place: kept never overtakes start + i
+        for (int i = 0; i < n; i++) {
+            if (mask[i]) r->records[kept++] = r->records[start + i];
+        }
+    }
+    r->numRecords = kept;
+}
+
+struct queryResult *typedColumnsQuery(struct typedColumns *tc, char *query) {
+    assert(tc && query);
+    if (strncmp(query, FILTER_PREFIX, strlen(FILTER_PREFIX)) != 0) return NULL;
+    struct rowFilter *filter = typedColumnsFilter(tc, query + strlen(FILTER_PREFIX));
+    if (!filter) {
+        return newResult(query);   // a malformed filter matches nothing
+    }
+    struct queryResult *qr = typedColumnsScan(tc, filter, query);
+    rowFilterFree(filter);
+    return qr;
+}
+
+void rowFilterFree(struct rowFilter *filter) {
+    free(filter);
+}
+
+void typedColumnsFree(struct typedColumns *tc) {
+    if (!tc) return;
+    memAccountFree(MEM_TYPED_COLUMNS, columnsBytes(tc));
+    for (int c = 0; c < NUM_FIELDS; c++) {
+        free(tc->columns[c].ints);
+        free(tc->columns[c].reals);
+    }
+    free(tc);
+}
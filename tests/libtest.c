@@ -0,0 +1,192 @@
+/*
+    Test of the libaddrdict API, linked against libaddrdict.a.
+
+    Opens DATASET twice, eagerly with a PFI index and a Bloom filter and
+    lazily with the defaults, then for every query on stdin prints the
+    exact and fuzzy row counts and the EZI_ADD of the first fuzzy row.
+    The two dictionaries must agree on every field of every row, and
+    addrDictLookupBatch must return what addrDictLookup does. The fields
+    of the first row found are printed by column name.
+
+    Every BADFILE, and the dataset opened with out of range options,
+    must fail to open (NULL, not an abort).
+
+    Usage: ./libtest DATASET [BADFILE...] < queries
+    Prints "FAIL ..." for each failed check and exits 1 if there was one.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "addrdict.h"
+
+#define MAX_QUERIES 256
+#define MAX_QUERY_LEN 512
+
+static int failures = 0;
+
+/* Helpers */
+static void check(int ok, const char *what, const char *detail);
+static int sameRows(struct addrDict *d, struct addrResult *a,
+                    struct addrResult *b);
+static void printFields(struct addrDict *d, struct addrResult *r);
+static void checkOpenFails(const char *path,
+                           const struct addrDictOptions *options,
+                           const char *what);
+static int readQueries(FILE *f, char **queries);
+
+/* helper: count and report a failed check */
+static void check(int ok, const char *what, const char *detail) {
+    if (ok) return;
+    printf("FAIL %s: %s\n", what, detail);
+    failures++;
+}
+
+/* helper: 1 if both results hold the same field values, row by row */
+static int sameRows(struct addrDict *d, struct addrResult *a,
+                    struct addrResult *b) {
+    if (addrResultCount(a) != addrResultCount(b)) return 0;
+    for (int row = 0; row < addrResultCount(a); row++) {
+        for (int field = 0; field < addrDictNumFields(d); field++) {
+            if (strcmp(addrResultField(a, row, field),
+                       addrResultField(b, row, field)) != 0) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* helper: every column of the first row, by name */
+static void printFields(struct addrDict *d, struct addrResult *r) {
+    printf("fields of %s:\n", addrResultQuery(r));
+    for (int field = 0; field < addrDictNumFields(d); field++) {
+        printf("  %s: %s\n", addrDictFieldName(d, field),
+               addrResultField(r, 0, field));
+    }
+}
+
+/* helper: opening `path` with `options` must return NULL */
+static void checkOpenFails(const char *path,
+                           const struct addrDictOptions *options,
+                           const char *what) {
+    struct addrDict *d = addrDictOpen(path, options);
+    check(d == NULL, "open should fail", what);
+    printf("open %s --> %s\n", what, d ? "opened" : "NULL");
+    addrDictClose(d);
+}
+
+/* helper: read up to MAX_QUERIES lines of f; returns how many */
+static int readQueries(FILE *f, char **queries) {
+    char line[MAX_QUERY_LEN];
+    int n = 0;
+    while (n < MAX_QUERIES && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        queries[n] = strdup(line);
+        if (!queries[n]) exit(EXIT_FAILURE);
+        n++;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s DATASET [BADFILE...] < queries\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Failure paths: unreadable or malformed files, bad options
+    for (int i = 2; i < argc; i++) {
+        checkOpenFails(argv[i], NULL, argv[i]);
+    }
+    const char *unknown[] = {"NO_SUCH_COLUMN"};
+    struct addrDictOptions bad;
+    addrDictDefaultOptions(&bad);
+    bad.indexes = unknown;
+    bad.numIndexes = 1;
+    checkOpenFails(argv[1], &bad, "with an unknown index column");
+    addrDictDefaultOptions(&bad);
+    bad.numIndexes = -1;
+    checkOpenFails(argv[1], &bad, "with numIndexes -1");
+    addrDictDefaultOptions(&bad);
+    bad.numIndexes = 1;
+    checkOpenFails(argv[1], &bad, "with a NULL index list");
+    addrDictDefaultOptions(&bad);
+    bad.bloomBitsPerKey = 33;
+    checkOpenFails(argv[1], &bad, "with 33 Bloom bits per key");
+    check(addrDictOpen(NULL, NULL) == NULL, "open should fail", "NULL path");
+
+    // The dataset, eager with extras and lazy with the defaults
+    const char *indexes[] = {"PFI"};
+    struct addrDictOptions options;
+    addrDictDefaultOptions(&options);
+    options.indexes = indexes;
+    options.numIndexes = 1;
+    options.bloomBitsPerKey = 10;
+    options.buildThreads = 2;
+    struct addrDict *d = addrDictOpen(argv[1], &options);
+    addrDictDefaultOptions(&options);
+    options.lazy = 1;
+    struct addrDict *lazy = addrDictOpen(argv[1], &options);
+    if (!d || !lazy) {
+        printf("FAIL open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    printf("open %s --> %d rows, %d fields\n", argv[1], addrDictSize(d),
+           addrDictNumFields(d));
+    check(addrDictSize(lazy) == addrDictSize(d), "lazy open", "row count");
+    check(addrDictFieldIndex(d, "EZI_ADD") == 1, "field index", "EZI_ADD");
+    check(addrDictFieldIndex(d, "NO_SUCH_COLUMN") == -1, "field index",
+          "unknown column");
+
+    char *queries[MAX_QUERIES];
+    int n = readQueries(stdin, queries);
+    struct addrResult *exact[MAX_QUERIES], *fuzzy[MAX_QUERIES];
+    addrDictLookupBatch(d, (const char *const *)queries, n, ADDRDICT_EXACT,
+                        exact);
+    addrDictLookupBatch(d, (const char *const *)queries, n, ADDRDICT_FUZZY,
+                        fuzzy);
+
+    int printed = 0;
+    int keyField = addrDictFieldIndex(d, "EZI_ADD");
+    for (int i = 0; i < n; i++) {
+        struct addrResult *one = addrDictLookup(d, queries[i], ADDRDICT_EXACT);
+        check(sameRows(d, one, exact[i]), "exact batch", queries[i]);
+        addrResultFree(one);
+        one = addrDictLookup(d, queries[i], ADDRDICT_FUZZY);
+        check(sameRows(d, one, fuzzy[i]), "fuzzy batch", queries[i]);
+        addrResultFree(one);
+        one = addrDictLookup(lazy, queries[i], ADDRDICT_FUZZY);
+        // Extra indexes were only declared on the eager dictionary
+        if (!strchr(queries[i], ':')) {
+            check(sameRows(d, one, fuzzy[i]), "lazy lookup", queries[i]);
+        }
+        addrResultFree(one);
+        check(strcmp(addrResultQuery(fuzzy[i]), queries[i]) == 0,
+              "result query", queries[i]);
+        check(addrResultCount(exact[i]) == 0 ||
+              addrResultCount(exact[i]) == addrResultCount(fuzzy[i]),
+              "exact hit is the fuzzy answer", queries[i]);
+
+        printf("%s --> exact %d, fuzzy %d", queries[i],
+               addrResultCount(exact[i]), addrResultCount(fuzzy[i]));
+        if (addrResultCount(fuzzy[i]) > 0) {
+            printf(" (%s)", addrResultField(fuzzy[i], 0, keyField));
+        }
+        printf("\n");
+        if (!printed && addrResultCount(exact[i]) > 0) {
+            printFields(d, exact[i]);
+            printed = 1;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        addrResultFree(exact[i]);
+        addrResultFree(fuzzy[i]);
+        free(queries[i]);
+    }
+    addrDictClose(lazy);
+    addrDictClose(d);
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}